@@ -6,7 +6,31 @@
   read a file stream and store the information within the file in ByteBuffer, 
   and add bytes to the ByteBuffer.
 */
+#define _POSIX_C_SOURCE 200809L
+
 #include "byteBuffer.h"
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+  Make sure the given buffer has room for at least the given number of
+  bytes, doubling its capacity as many times as needed.
+  @param buffer ByteBuffer struct to make room in.
+  @param cap number of bytes it needs room for.
+*/
+static void ensureCapacity(ByteBuffer *buffer, size_t cap)
+{
+  if (cap <= buffer->cap) {
+    return;
+  }
+  size_t newCap = buffer->cap;
+  while (newCap < cap) {
+    newCap *= DOUBLE;
+  }
+  buffer->cap = newCap;
+  buffer->data = (byte *)realloc(buffer->data, buffer->cap * sizeof(byte));
+}
 
 ByteBuffer *createBuffer()
 {
@@ -26,6 +50,13 @@ void addByte(ByteBuffer *buffer, byte b)
   buffer->data[buffer->len++] = b;
 }
 
+void appendBytes(ByteBuffer *buffer, const void *ptr, size_t len)
+{
+  ensureCapacity(buffer, buffer->len + len);
+  memcpy(buffer->data + buffer->len, ptr, len);
+  buffer->len += len;
+}
+
 void freeBuffer(ByteBuffer *buffer)
 {
   free(buffer->data);
@@ -39,11 +70,40 @@ ByteBuffer *readFile(const char *filename)
     return NULL;
   }
 
-  byte current;
   ByteBuffer *buffer = createBuffer();
-  while (fscanf(src, "%c", &current) != EOF) {
-    addByte(buffer, current);
+
+  // If we can tell how big the file is, make room for all of it now.
+  struct stat info;
+  if (fstat(fileno(src), &info) == 0 && S_ISREG(info.st_mode) &&
+      info.st_size > buffer->cap) {
+    buffer->cap = info.st_size;
+    buffer->data = (byte *)realloc(buffer->data, buffer->cap * sizeof(byte));
   }
+
+  // Read as much as will fit, right into the buffer.  When it's full,
+  // check for one more byte before making it bigger, so a buffer that
+  // was sized to fit the file doesn't grow.
+  while (true) {
+    if (buffer->len == buffer->cap) {
+      int ch = fgetc(src);
+      if (ch == EOF) {
+        break;
+      }
+      addByte(buffer, ch);
+    }
+    size_t n = fread(buffer->data + buffer->len, sizeof(byte),
+                     buffer->cap - buffer->len, src);
+    buffer->len += n;
+    if (n == 0) {
+      break;
+    }
+  }
+
+  bool ok = !ferror(src);
   fclose(src);
+  if (!ok) {
+    freeBuffer(buffer);
+    return NULL;
+  }
   return buffer;
 }
@@ -37,10 +37,10 @@ typedef struct
   byte *data;
 
   /** Number of currently used bytes in the data array. */
-  unsigned int len;
+  size_t len;
 
   /** Capacity of the data array (it's typically over-allocated). */
-  unsigned int cap;
+  size_t cap;
 } ByteBuffer;
 
 /**
@@ -58,6 +58,16 @@ ByteBuffer *createBuffer();
 */
 void addByte(ByteBuffer *buffer, byte b);
 
+/**
+  Adds a block of bytes to the end of the given buffer, enlarging the
+  data array if necessary.  The capacity still grows by doubling, just
+  as many times as it takes to fit the new bytes.
+  @param buffer ByteBuffer struct to add the bytes to.
+  @param ptr bytes to add.
+  @param len number of bytes to add.
+*/
+void appendBytes(ByteBuffer *buffer, const void *ptr, size_t len);
+
 /**
   Frees all the memory for the given buffer.
   @param buffer ByteBuffer struct to free all memories to.
@@ -66,8 +76,10 @@ void freeBuffer(ByteBuffer *buffer);
 
 /**
   Creates a new ByteBuffer and initializes the contents of the data
-  array with the contents of the given file. If the file can't be opened,
-  it will just return NULL. The buffer will be padded so that it can be hashed.
+  array with the contents of the given file. If the file can't be opened
+  or read, it will just return NULL. For a regular file, the buffer is
+  sized to fit the file before it's read, then the file is read in large
+  chunks right into the buffer.
   @param filename name of the file to read and store into buffer.
   @return a ByteBuffer which holds a data array of the padded contents of the
   given file.
@@ -0,0 +1,388 @@
+/**
+  @file digestCache.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for the digest cache.  The cache file
+  is a header followed by a power-of-two number of 64-byte slots, used as
+  an open addressing hash table keyed by device and inode.  The file is
+  mapped shared, so every thread and process using it sees the same
+  slots.  Each slot has a sequence number that's odd while it's being
+  written, so a reader that sees it change knows the slot it read might be
+  torn and just treats it as a miss.  The table only grows when it's
+  opened, by building a bigger copy under a lock and renaming it into
+  place.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "digestCache.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+/** Value at the start of every cache file, "RMDCACH1". */
+#define CACHE_MAGIC 0x31484341434D4452ULL
+
+/** Number of slots in a new cache file. */
+#define INITIAL_SLOTS 16384
+
+/** Most slots to look at for a key before giving up. */
+#define MAX_PROBES 16
+
+/** Files modified less than this many nanoseconds ago aren't cached,
+    since they could change again without their time changing. */
+#define RACY_NANOS 1000000000LL
+
+/** Nanoseconds in a second. */
+#define NANOS 1000000000LL
+
+/** Start of the cache file. */
+typedef struct
+{
+  /** Always CACHE_MAGIC. */
+  uint64_t magic;
+
+  /** Number of slots, a power of two. */
+  uint32_t slots;
+
+  /** Number of slots that have ever been used. */
+  uint32_t used;
+} CacheHeader;
+
+/** One slot in the cache. */
+typedef struct
+{
+  /** Zero if the slot has never been used, odd while it's being
+      written, and even otherwise. */
+  uint32_t seq;
+
+  /** Unused, so the fields after it are aligned. */
+  uint32_t unused;
+
+  /** Device the file is on. */
+  uint64_t dev;
+
+  /** Inode number of the file. */
+  uint64_t ino;
+
+  /** Size of the file when it was hashed. */
+  uint64_t size;
+
+  /** Modification time of the file when it was hashed, in nanoseconds. */
+  int64_t mtime;
+
+  /** Hash value of the file. */
+  byte digest[DIGEST_BYTES];
+
+  /** Unused, to make the slot 64 bytes. */
+  byte padding[4];
+} CacheSlot;
+
+/** The open cache, or NULL if there isn't one. */
+static CacheHeader *cache = NULL;
+
+/** Size of the cache mapping, in bytes. */
+static size_t mapSize;
+
+/** True if lookups should miss and stores should check. */
+static bool verifying = false;
+
+/** Number of wrong cached values found while verifying. */
+static int mismatches = 0;
+
+/**
+  Get the slots that follow a cache header.
+  @param header the start of the mapped cache.
+  @return the first slot.
+*/
+static CacheSlot *slotsOf(CacheHeader *header)
+{
+  return (CacheSlot *)(header + 1);
+}
+
+/**
+  Figure out how big a cache file with the given number of slots is.
+  @param slots number of slots.
+  @return size of the file, in bytes.
+*/
+static size_t fileSize(uint32_t slots)
+{
+  return sizeof(CacheHeader) + (size_t)slots * sizeof(CacheSlot);
+}
+
+/**
+  Get a file's modification time in nanoseconds.
+  @param info the file's status.
+  @return the modification time.
+*/
+static int64_t mtimeOf(const struct stat *info)
+{
+  return (int64_t)info->st_mtim.tv_sec * NANOS + info->st_mtim.tv_nsec;
+}
+
+/**
+  Pick the first slot to look at for a file.
+  @param dev device the file is on.
+  @param ino inode number of the file.
+  @param slots number of slots in the table.
+  @return index of the first slot.
+*/
+static uint32_t homeSlot(uint64_t dev, uint64_t ino, uint32_t slots)
+{
+  uint64_t h = (ino ^ (dev * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+  return (h ^ (h >> 31)) & (slots - 1);
+}
+
+/**
+  Map a cache file into memory and check that it looks right.
+  @param fd the cache file.
+  @param size storage for the size of the mapping.
+  @return the mapped header, or NULL if it isn't a cache file.
+*/
+static CacheHeader *mapCache(int fd, size_t *size)
+{
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(CacheHeader)) {
+    return NULL;
+  }
+  void *map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  CacheHeader *header = map;
+  uint32_t slots = header->slots;
+  if (header->magic != CACHE_MAGIC || slots == 0 || (slots & (slots - 1)) ||
+      fileSize(slots) != (size_t)info.st_size) {
+    munmap(map, info.st_size);
+    return NULL;
+  }
+  *size = info.st_size;
+  return header;
+}
+
+/**
+  Write a new, bigger cache file with everything from the old one, then
+  rename it over the old one.  The caller holds the lock on the old file.
+  @param path name of the cache file.
+  @param old the old cache, or NULL to start an empty one.
+  @param slots number of slots in the new cache.
+  @return true if the new file is in place.
+*/
+static bool rebuildCache(const char *path, CacheHeader *old, uint32_t slots)
+{
+  char temp[strlen(path) + 32];
+  snprintf(temp, sizeof(temp), "%s.%ld", path, (long)getpid());
+  int fd = open(temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  size_t size = fileSize(slots);
+  void *map = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    unlink(temp);
+    return false;
+  }
+
+  CacheHeader *header = map;
+  header->magic = CACHE_MAGIC;
+  header->slots = slots;
+  header->used = 0;
+  CacheSlot *to = slotsOf(header);
+  if (old) {
+    CacheSlot *from = slotsOf(old);
+    for (uint32_t i = 0; i < old->slots; i++) {
+      if (from[i].seq == 0 || (from[i].seq & 1)) {
+        continue;
+      }
+      // The new table is twice as big, so there's room for everything,
+      // but anything that won't fit near home is dropped.
+      uint32_t home = homeSlot(from[i].dev, from[i].ino, slots);
+      for (int p = 0; p < MAX_PROBES; p++) {
+        CacheSlot *slot = &to[(home + p) & (slots - 1)];
+        if (slot->seq == 0) {
+          *slot = from[i];
+          slot->seq = 2;
+          header->used++;
+          break;
+        }
+      }
+    }
+  }
+
+  munmap(map, size);
+  if (rename(temp, path) != 0) {
+    unlink(temp);
+    return false;
+  }
+  return true;
+}
+
+bool openDigestCache(const char *path, bool verify)
+{
+  verifying = verify;
+
+  // Only one process at a time gets to create or grow the cache.  If
+  // another one renamed a new cache into place while we were waiting
+  // for the lock, we have the old file, so start over with the new one.
+  int fd;
+  while (true) {
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    flock(fd, LOCK_EX);
+    struct stat held, named;
+    if (fstat(fd, &held) == 0 && stat(path, &named) == 0 &&
+        held.st_dev == named.st_dev && held.st_ino == named.st_ino) {
+      break;
+    }
+    close(fd);
+  }
+
+  cache = mapCache(fd, &mapSize);
+  if (cache == NULL || cache->used >= cache->slots / 4 * 3) {
+    uint32_t slots = cache ? cache->slots * 2 : INITIAL_SLOTS;
+    bool rebuilt = rebuildCache(path, cache, slots);
+    if (cache) {
+      munmap(cache, mapSize);
+      cache = NULL;
+    }
+    close(fd);
+
+    // The new file has everything, so it's safe to use without the lock.
+    fd = rebuilt ? open(path, O_RDWR) : -1;
+    if (fd < 0) {
+      return false;
+    }
+    cache = mapCache(fd, &mapSize);
+  }
+  close(fd);
+  return cache != NULL;
+}
+
+bool cacheLookup(const struct stat *info, byte digest[DIGEST_BYTES])
+{
+  if (cache == NULL || verifying) {
+    return false;
+  }
+
+  CacheSlot *slots = slotsOf(cache);
+  uint32_t count = cache->slots;
+  uint32_t home = homeSlot(info->st_dev, info->st_ino, count);
+  for (int p = 0; p < MAX_PROBES; p++) {
+    CacheSlot *slot = &slots[(home + p) & (count - 1)];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0) {
+      return false;
+    }
+    if (seq & 1) {
+      continue;
+    }
+
+    CacheSlot copy;
+    memcpy(&copy, slot, sizeof(copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+      continue;
+    }
+    if (copy.dev == (uint64_t)info->st_dev && copy.ino == (uint64_t)info->st_ino) {
+      if (copy.size != (uint64_t)info->st_size || copy.mtime != mtimeOf(info)) {
+        return false;
+      }
+      memcpy(digest, copy.digest, DIGEST_BYTES);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+  Find the slot for a file, or a slot to put it in.  If there's no room
+  near its home, the home slot is taken over.
+  @param dev device the file is on.
+  @param ino inode number of the file.
+  @return the slot to use.
+*/
+static CacheSlot *findSlot(uint64_t dev, uint64_t ino)
+{
+  CacheSlot *slots = slotsOf(cache);
+  uint32_t count = cache->slots;
+  uint32_t home = homeSlot(dev, ino, count);
+  for (int p = 0; p < MAX_PROBES; p++) {
+    CacheSlot *slot = &slots[(home + p) & (count - 1)];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0 || (slot->dev == dev && slot->ino == ino)) {
+      return slot;
+    }
+  }
+  return &slots[home];
+}
+
+void cacheStore(const struct stat *info, const byte digest[DIGEST_BYTES])
+{
+  if (cache == NULL) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t mtime = mtimeOf(info);
+  if ((int64_t)now.tv_sec * NANOS + now.tv_nsec - mtime < RACY_NANOS) {
+    return;
+  }
+
+  CacheSlot *slot = findSlot(info->st_dev, info->st_ino);
+  bool same = slot->dev == (uint64_t)info->st_dev &&
+    slot->ino == (uint64_t)info->st_ino &&
+    slot->size == (uint64_t)info->st_size && slot->mtime == mtime;
+  bool match = same && memcmp(slot->digest, digest, DIGEST_BYTES) == 0;
+
+  // Don't write anything if the slot already says the same thing, so
+  // its page isn't dirtied.
+  if (match) {
+    return;
+  }
+
+  // Lock the slot by making its sequence number odd.  If someone else
+  // is writing it, let them.
+  uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  if ((seq & 1) ||
+      !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return;
+  }
+  if (seq == 0) {
+    __atomic_add_fetch(&cache->used, 1, __ATOMIC_RELAXED);
+  }
+
+  if (seq != 0 && same && verifying) {
+    __atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+  }
+
+  slot->dev = info->st_dev;
+  slot->ino = info->st_ino;
+  slot->size = info->st_size;
+  slot->mtime = mtime;
+  memcpy(slot->digest, digest, DIGEST_BYTES);
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int cacheMismatches(void)
+{
+  return __atomic_load_n(&mismatches, __ATOMIC_RELAXED);
+}
+
+void closeDigestCache(void)
+{
+  if (cache) {
+    munmap(cache, mapSize);
+    cache = NULL;
+  }
+}
@@ -0,0 +1,64 @@
+/**
+  @file digestCache.h
+  @author Maggie Lin (mclin)
+  This file contains the function prototypes for the digest cache, which
+  remembers the hash value of each file it's seen, by device, inode, size
+  and modification time, so a file that hasn't changed doesn't need to be
+  read again.  The cache is a hash table in a file that's mapped into
+  memory, so any number of threads and processes can use it at once.
+*/
+
+#ifndef _DIGEST_CACHE_H_
+#define _DIGEST_CACHE_H_
+
+#include "ripeMD.h"
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/** Name of the cache file in the user's cache directory. */
+#define CACHE_NAME "ripemd160-hash.cache"
+
+/**
+  Open the cache file, creating it if it doesn't exist yet, and use it
+  for cacheLookup() and cacheStore() until closeDigestCache().  If the
+  cache is getting full, it's rebuilt bigger first.
+  @param path name of the cache file.
+  @param verify true if lookups should always miss, so every file is
+  hashed again and checked against the cache when it's stored.
+  @return true if the cache could be opened.  If not, lookups miss and
+  stores do nothing.
+*/
+bool openDigestCache(const char *path, bool verify);
+
+/**
+  Look up the hash value for a file.
+  @param info the file's status, from fstat().
+  @param digest storage for the hash value, if it's in the cache.
+  @return true if the file's hash value was in the cache, and the file
+  hasn't changed since then.
+*/
+bool cacheLookup(const struct stat *info, byte digest[DIGEST_BYTES]);
+
+/**
+  Save the hash value for a file in the cache.  Files that were modified
+  too recently to tell whether they're still changing aren't saved.
+  When verifying, a different hash value already in the cache for the
+  same unchanged file is counted as a mismatch.
+  @param info the file's status, from fstat(), from before it was hashed.
+  @param digest the file's hash value.
+*/
+void cacheStore(const struct stat *info, const byte digest[DIGEST_BYTES]);
+
+/**
+  Report how many cached hash values turned out to be wrong, when
+  verifying the cache.
+  @return the number of mismatches.
+*/
+int cacheMismatches(void);
+
+/**
+  Stop using the cache, and unmap the cache file.
+*/
+void closeDigestCache(void);
+
+#endif
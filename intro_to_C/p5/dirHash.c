@@ -0,0 +1,567 @@
+/**
+  @file dirHash.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for hashing every file under a
+  directory.  Each thread has a deque of tasks: directories to read and
+  files to hash.  A thread adds the tasks it finds to the bottom of its
+  own deque and takes work from there too, and a thread that runs out
+  steals from the top of someone else's.  Directories are read with
+  getdents64 and everything is opened relative to the starting directory
+  with openat, so walking and hashing go on at the same time.  Each
+  thread saves up the small files it reads and hashes them side by side
+  in a batch.  A thread that can't find any work sleeps until a task is
+  added or the walk is finished.  The results are collected, then sorted
+  at the end.
+*/
+
+#define _GNU_SOURCE
+
+#include "dirHash.h"
+#include "fileHash.h"
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/** Size of the buffer for reading directory entries, in bytes. */
+#define DENTS_BUFFER 65536
+
+/** Initial capacity of a deque or the list of results. */
+#define INITIAL_TASKS 16
+
+/** Number of times to look for work before starting to sleep. */
+#define SPIN_LIMIT 100
+
+/** A directory entry, the way getdents64 returns it. */
+typedef struct
+{
+  /** Inode number. */
+  uint64_t d_ino;
+
+  /** Offset of the next entry. */
+  int64_t d_off;
+
+  /** Size of this entry, in bytes. */
+  unsigned short d_reclen;
+
+  /** Type of file, or DT_UNKNOWN. */
+  unsigned char d_type;
+
+  /** Name of the file, null terminated. */
+  char d_name[];
+} DirEntry64;
+
+/** Kinds of work a thread can do. */
+typedef enum { WalkTask, HashTask } TaskKind;
+
+/** One piece of work. */
+typedef struct
+{
+  /** What to do. */
+  TaskKind kind;
+
+  /** Path of the directory or file, relative to the starting directory,
+      or the empty string for the starting directory itself. */
+  char *path;
+} Task;
+
+/** A double-ended queue of tasks for one thread.  The tasks still to do
+    are the ones from top up to bottom. */
+typedef struct
+{
+  /** Storage for the tasks. */
+  Task *tasks;
+
+  /** Capacity of the tasks array. */
+  int cap;
+
+  /** Index of the oldest task, where other threads steal from. */
+  int top;
+
+  /** Index just past the newest task, where the owner works. */
+  int bottom;
+
+  /** Lock for everything in the deque. */
+  pthread_mutex_t lock;
+} Deque;
+
+/** Result for one file or directory. */
+typedef struct
+{
+  /** Path, relative to the starting directory. */
+  char *path;
+
+  /** Hash value, if it was a file that could be hashed. */
+  byte digest[DIGEST_BYTES];
+
+  /** Zero if it was hashed, otherwise the errno value saying why not. */
+  int error;
+} Entry;
+
+/** Everything the threads share during a walk. */
+typedef struct
+{
+  /** File descriptor for the starting directory. */
+  int root;
+
+  /** Number of threads, and deques. */
+  int threads;
+
+  /** A deque for each thread. */
+  Deque *deques;
+
+  /** Number of tasks added but not finished yet. */
+  int pending;
+
+  /** Number of tasks waiting in the deques, not taken yet. */
+  int queued;
+
+  /** Number of threads asleep waiting for work. */
+  int sleepers;
+
+  /** Lock for sleeping on changed. */
+  pthread_mutex_t idleLock;
+
+  /** Signaled when a task is added, and broadcast when the walk is
+      finished, if anyone's asleep. */
+  pthread_cond_t changed;
+
+  /** Results so far. */
+  Entry *entries;
+
+  /** Number of results so far. */
+  int count;
+
+  /** Capacity of the entries array. */
+  int cap;
+
+  /** Lock for the results. */
+  pthread_mutex_t lock;
+} Walk;
+
+/** What one thread needs to know. */
+typedef struct
+{
+  /** The walk it's part of. */
+  Walk *walk;
+
+  /** Index of its own deque. */
+  int id;
+
+  /** Small files it's read, but not hashed yet. */
+  FileBatch *batch;
+
+  /** Path of each file in the batch. */
+  char *paths[BATCH_FILES];
+} Walker;
+
+/**
+  Allocate memory, exiting if there isn't any.
+  @param ptr memory to resize, or NULL.
+  @param size number of bytes needed.
+  @return the memory.
+*/
+static void *mustRealloc(void *ptr, size_t size)
+{
+  ptr = realloc(ptr, size);
+  if (ptr == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/**
+  Make room for one more task in a deque.  The caller holds its lock.
+  @param deque the deque to grow.
+*/
+static void makeRoom(Deque *deque)
+{
+  if (deque->bottom < deque->cap) {
+    return;
+  }
+  if (deque->top > 0) {
+    memmove(deque->tasks, deque->tasks + deque->top,
+            (deque->bottom - deque->top) * sizeof(Task));
+    deque->bottom -= deque->top;
+    deque->top = 0;
+  } else {
+    deque->cap *= 2;
+    deque->tasks = mustRealloc(deque->tasks, deque->cap * sizeof(Task));
+  }
+}
+
+/**
+  Wake threads that are asleep in nextTask(), after adding a task or
+  finishing the last one.
+  @param walk the walk that changed.
+  @param all true to wake every thread, false to wake just one.
+*/
+static void wakeIdle(Walk *walk, bool all)
+{
+  // Make sure the change is visible before we check for sleepers.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&walk->sleepers, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock(&walk->idleLock);
+    if (all) {
+      pthread_cond_broadcast(&walk->changed);
+    } else {
+      pthread_cond_signal(&walk->changed);
+    }
+    pthread_mutex_unlock(&walk->idleLock);
+  }
+}
+
+/**
+  Add a task to the walk, at the bottom of a thread's own deque.
+  @param self the thread adding the task.
+  @param kind kind of task.
+  @param path path for the task, which the task takes over.
+*/
+static void pushTask(Walker *self, TaskKind kind, char *path)
+{
+  Deque *deque = &self->walk->deques[self->id];
+  __atomic_add_fetch(&self->walk->pending, 1, __ATOMIC_ACQ_REL);
+
+  pthread_mutex_lock(&deque->lock);
+  makeRoom(deque);
+  deque->tasks[deque->bottom++] = (Task){kind, path};
+  __atomic_add_fetch(&self->walk->queued, 1, __ATOMIC_ACQ_REL);
+  pthread_mutex_unlock(&deque->lock);
+  wakeIdle(self->walk, false);
+}
+
+/**
+  Take a task from one end of a deque.
+  @param walk the walk the deque is part of.
+  @param deque the deque to take from.
+  @param task storage for the task.
+  @param steal true to take the oldest task, from the top, false to take
+  the newest, from the bottom.
+  @return true if there was a task.
+*/
+static bool takeTask(Walk *walk, Deque *deque, Task *task, bool steal)
+{
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->bottom > deque->top;
+  if (found) {
+    *task = steal ? deque->tasks[deque->top++] : deque->tasks[--deque->bottom];
+    if (deque->top == deque->bottom) {
+      deque->top = deque->bottom = 0;
+    }
+    __atomic_sub_fetch(&walk->queued, 1, __ATOMIC_ACQ_REL);
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+/**
+  Check whether a thread looking for work should stop waiting, because
+  there's a task to take or the walk is finished.
+  @param walk the walk to check.
+  @return true if there's no point waiting any longer.
+*/
+static bool hasWork(Walk *walk)
+{
+  return __atomic_load_n(&walk->queued, __ATOMIC_SEQ_CST) > 0 ||
+    __atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST) == 0;
+}
+
+/**
+  Wait for the next task, from this thread's own deque if there's
+  anything in it, or stolen from another thread's.
+  @param self the thread looking for work.
+  @param task storage for the task.
+  @return true if there's a task, false if the whole walk is finished.
+*/
+static bool nextTask(Walker *self, Task *task)
+{
+  Walk *walk = self->walk;
+  int spins = 0;
+  while (true) {
+    if (takeTask(walk, &walk->deques[self->id], task, false)) {
+      return true;
+    }
+    for (int i = 1; i < walk->threads; i++) {
+      if (takeTask(walk, &walk->deques[(self->id + i) % walk->threads],
+                   task, true)) {
+        return true;
+      }
+    }
+
+    // Nothing to do now, but a task that's running may add more.
+    if (__atomic_load_n(&walk->pending, __ATOMIC_ACQUIRE) == 0) {
+      return false;
+    }
+    if (++spins < SPIN_LIMIT) {
+      sched_yield();
+      continue;
+    }
+
+    // Say we're asleep before checking one last time, so a thread adding
+    // a task either sees us and wakes us, or we see the task.
+    pthread_mutex_lock(&walk->idleLock);
+    __atomic_add_fetch(&walk->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (!hasWork(walk)) {
+      pthread_cond_wait(&walk->changed, &walk->idleLock);
+    }
+    __atomic_sub_fetch(&walk->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&walk->idleLock);
+    spins = 0;
+  }
+}
+
+/**
+  Add a result to the walk.
+  @param walk the walk the result is for.
+  @param path path of the file or directory, which the result takes over.
+  @param digest hash value, or NULL if there isn't one.
+  @param error zero, or the errno value saying what went wrong.
+*/
+static void addEntry(Walk *walk, char *path, const byte *digest, int error)
+{
+  pthread_mutex_lock(&walk->lock);
+  if (walk->count >= walk->cap) {
+    walk->cap *= 2;
+    walk->entries = mustRealloc(walk->entries, walk->cap * sizeof(Entry));
+  }
+  Entry *entry = &walk->entries[walk->count++];
+  entry->path = path;
+  entry->error = error;
+  if (digest) {
+    memcpy(entry->digest, digest, DIGEST_BYTES);
+  }
+  pthread_mutex_unlock(&walk->lock);
+}
+
+/**
+  Make the path for an entry in a directory.
+  @param dir path of the directory, or the empty string for the start.
+  @param name name of the entry.
+  @return the new path, in allocated memory.
+*/
+static char *joinPath(const char *dir, const char *name)
+{
+  size_t dlen = strlen(dir);
+  char *path = mustRealloc(NULL, dlen + strlen(name) + 2);
+  if (dlen > 0) {
+    memcpy(path, dir, dlen);
+    path[dlen++] = '/';
+  }
+  strcpy(path + dlen, name);
+  return path;
+}
+
+/**
+  Read a directory, adding a task for every subdirectory and regular
+  file in it.
+  @param self the thread doing the work.
+  @param path path of the directory.
+  @return true if the path is still needed, for a result.
+*/
+static bool walkDir(Walker *self, char *path)
+{
+  int fd = openat(self->walk->root, *path ? path : ".", O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    addEntry(self->walk, path, NULL, errno);
+    return true;
+  }
+
+  char buffer[DENTS_BUFFER];
+  long len;
+  while ((len = syscall(SYS_getdents64, fd, buffer, DENTS_BUFFER)) > 0) {
+    for (long pos = 0; pos < len; ) {
+      DirEntry64 *ent = (DirEntry64 *)(buffer + pos);
+      pos += ent->d_reclen;
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+        continue;
+      }
+
+      // Some file systems don't say what the type is.
+      unsigned char type = ent->d_type;
+      if (type == DT_UNKNOWN) {
+        struct stat info;
+        if (fstatat(fd, ent->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0) {
+          type = S_ISDIR(info.st_mode) ? DT_DIR :
+            S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+      }
+
+      if (type == DT_DIR) {
+        pushTask(self, WalkTask, joinPath(path, ent->d_name));
+      } else if (type == DT_REG) {
+        pushTask(self, HashTask, joinPath(path, ent->d_name));
+      }
+    }
+  }
+
+  if (len < 0) {
+    int err = errno;
+    close(fd);
+    addEntry(self->walk, path, NULL, err);
+    return true;
+  }
+  close(fd);
+  return false;
+}
+
+/**
+  Hash every file in a thread's batch, and add their results.
+  @param self the thread whose batch it is.
+*/
+static void flushBatch(Walker *self)
+{
+  FileBatch *batch = self->batch;
+  if (batch->count == 0) {
+    return;
+  }
+  hashBatch(batch);
+  for (int i = 0; i < batch->count; i++) {
+    addEntry(self->walk, self->paths[i], batch->digests[i], 0);
+  }
+  batch->count = 0;
+}
+
+/**
+  Hash one file, or put it in the thread's batch if it's small.  Large
+  files get their reads overlapped with hashing by hashDescriptor().
+  @param self the thread doing the work.
+  @param path path of the file.
+  @return true if the path is still needed, for a result.
+*/
+static bool hashTask(Walker *self, char *path)
+{
+  int fd = openat(self->walk->root, path, O_RDONLY);
+  if (fd < 0) {
+    addEntry(self->walk, path, NULL, errno);
+    return true;
+  }
+
+  byte digest[DIGEST_BYTES];
+  FileStatus status = batchDescriptor(self->batch, fd, digest);
+  int error = status == FileFailed ? errno : 0;
+  close(fd);
+  if (status == FileBatched) {
+    self->paths[self->batch->count - 1] = path;
+    if (self->batch->count == BATCH_FILES) {
+      flushBatch(self);
+    }
+    return true;
+  }
+  addEntry(self->walk, path, error ? NULL : digest, error);
+  return true;
+}
+
+/**
+  Starting point for a thread in the walk.  It does tasks until there
+  aren't any left anywhere.
+  @param arg the Walker for this thread.
+  @return NULL, always.
+*/
+static void *walker(void *arg)
+{
+  Walker *self = arg;
+  Task task;
+  while (nextTask(self, &task)) {
+    bool kept = false;
+    if (task.kind == WalkTask) {
+      kept = walkDir(self, task.path);
+    } else {
+      kept = hashTask(self, task.path);
+    }
+    if (!kept) {
+      free(task.path);
+    }
+    if (__atomic_sub_fetch(&self->walk->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+      wakeIdle(self->walk, true);
+    }
+  }
+
+  // Whatever's left in the batch still needs to be hashed.
+  flushBatch(self);
+  return NULL;
+}
+
+/**
+  Comparison function for sorting results by path.
+  @param a pointer to the first Entry.
+  @param b pointer to the second Entry.
+  @return negative, zero or positive, like strcmp().
+*/
+static int compareEntries(const void *a, const void *b)
+{
+  return strcmp(((const Entry *)a)->path, ((const Entry *)b)->path);
+}
+
+bool hashDirectory(const char *dir, int threads)
+{
+  Walk walk = {open(dir, O_RDONLY | O_DIRECTORY), threads, NULL, 0, 0, 0,
+               PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+               NULL, 0, INITIAL_TASKS, PTHREAD_MUTEX_INITIALIZER};
+  if (walk.root < 0) {
+    perror(dir);
+    return false;
+  }
+  walk.entries = mustRealloc(NULL, walk.cap * sizeof(Entry));
+  walk.deques = mustRealloc(NULL, threads * sizeof(Deque));
+  Walker walkers[threads];
+  for (int i = 0; i < threads; i++) {
+    walk.deques[i] = (Deque){mustRealloc(NULL, INITIAL_TASKS * sizeof(Task)),
+                             INITIAL_TASKS, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+    walkers[i] = (Walker){&walk, i, createBatch()};
+  }
+
+  // The first thread starts with the directory itself, and the others
+  // steal from there.  This thread is the first one.
+  pushTask(&walkers[0], WalkTask, joinPath("", ""));
+  pthread_t ids[threads];
+  int started = 1;
+  while (started < threads &&
+         pthread_create(&ids[started], NULL, walker, &walkers[started]) == 0) {
+    started++;
+  }
+  walker(&walkers[0]);
+  for (int i = 1; i < started; i++) {
+    pthread_join(ids[i], NULL);
+  }
+
+  // Names are printed starting with the directory, without doubling up
+  // the slash if it already ends with one.
+  size_t dlen = strlen(dir);
+  while (dlen > 1 && dir[dlen - 1] == '/') {
+    dlen--;
+  }
+  const char *sep = dir[dlen - 1] == '/' ? "" : "/";
+
+  qsort(walk.entries, walk.count, sizeof(Entry), compareEntries);
+  bool ok = true;
+  for (int i = 0; i < walk.count; i++) {
+    Entry *entry = &walk.entries[i];
+    const char *name = entry->path;
+    if (entry->error) {
+      fprintf(stderr, "%.*s%s%s: %s\n", (int)dlen, dir, *name ? sep : "",
+              name, strerror(entry->error));
+      ok = false;
+    } else {
+      char hex[DIGEST_HEX + 1];
+      formatDigest(entry->digest, hex);
+      printf("%s  %.*s%s%s\n", hex, (int)dlen, dir, sep, name);
+    }
+    free(entry->path);
+  }
+
+  for (int i = 0; i < threads; i++) {
+    free(walk.deques[i].tasks);
+    freeBatch(walkers[i].batch);
+  }
+  free(walk.deques);
+  free(walk.entries);
+  close(walk.root);
+  return ok;
+}
@@ -0,0 +1,27 @@
+/**
+  @file dirHash.h
+  @author Maggie Lin (mclin)
+  This file contains the function prototype for hashing every file under a
+  directory.  Walking the directories and hashing the files are both split
+  up into tasks, which a pool of threads share by stealing from each other.
+*/
+
+#ifndef _DIR_HASH_H_
+#define _DIR_HASH_H_
+
+#include <stdbool.h>
+
+/**
+  Hash every regular file under the given directory, on the given number
+  of threads, and print a manifest.  Each line of the manifest has a
+  file's hash value and its name, starting with the directory, and the
+  lines are sorted by name.  Symbolic links and special files are skipped.
+  Files and directories that can't be read get a message on standard
+  error instead, in the same order.
+  @param dir the directory to start from.
+  @param threads number of threads to use, at least one.
+  @return true if every file and directory could be read.
+*/
+bool hashDirectory(const char *dir, int threads);
+
+#endif
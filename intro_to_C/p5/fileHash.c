@@ -0,0 +1,384 @@
+/**
+  @file fileHash.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for hashing a whole file.  A regular
+  file whose hash value is in the digest cache isn't read at all.  Very
+  large files and input that isn't a regular file are read on a separate
+  thread into a ring of buffers, so the disk or network keeps working
+  while the buffers already read are hashed.  Everything else is read a
+  chunk at a time, so memory use doesn't depend on the size of the file.
+  Files aren't mapped into memory, since a file that got shorter while
+  it was mapped would kill the whole process with SIGBUS, instead of
+  just failing a read.
+  When there are lots of small files to hash, they can be read into a
+  batch instead, and hashed side by side with the multi-lane engine.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "fileHash.h"
+#include "digestCache.h"
+#include "multiHash.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/** Number of bytes to read from the file at a time. */
+#define READ_CHUNK 65536
+
+/** Size of each buffer in the reader thread's ring, in bytes. */
+#define RING_CHUNK (1 << 20)
+
+/** Number of buffers in the reader thread's ring. */
+#define RING_BUFFERS 4
+
+/** Regular files at least this big get a reader thread. */
+#define OVERLAP_MIN ((off_t)4 << 20)
+
+/** Buffers shared by a reader thread and the thread hashing what it
+    reads.  The reader fills them in order, going around the ring, and
+    waits when all of them are full. */
+typedef struct
+{
+  /** File to read from. */
+  int fd;
+
+  /** RING_BUFFERS buffers of RING_CHUNK bytes, one after another. */
+  byte *buffers;
+
+  /** Number of bytes read into each buffer. */
+  size_t lengths[RING_BUFFERS];
+
+  /** Number of buffers that have been filled but not hashed yet. */
+  int filled;
+
+  /** True once the reader has filled the last buffer it's going to. */
+  bool done;
+
+  /** Zero, or the errno value from a read that failed. */
+  int error;
+
+  /** Lock for filled, done and error. */
+  pthread_mutex_t lock;
+
+  /** Signaled whenever a buffer is filled or emptied. */
+  pthread_cond_t changed;
+} ReadRing;
+
+/**
+  Hash everything that's left in the given file, reading it a chunk at a
+  time.  This works for any kind of input, including pipes.
+  @param fd file descriptor to read from.
+  @param ctx context to add the bytes to.
+  @return true if the whole file was read.
+*/
+static bool hashStream(int fd, RipemdContext *ctx)
+{
+  byte chunk[READ_CHUNK];
+  ssize_t len;
+  while ((len = read(fd, chunk, READ_CHUNK)) != 0) {
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    ripemdUpdate(ctx, chunk, len);
+  }
+  return true;
+}
+
+/**
+  Starting point for the reader thread.  It fills one buffer after
+  another, all the way, until it gets to the end of the file or a read
+  fails.  The last buffer it fills is the first one that isn't full.
+  @param arg the ReadRing to fill.
+  @return NULL, always.
+*/
+static void *reader(void *arg)
+{
+  ReadRing *ring = arg;
+  for (int i = 0; ; i = (i + 1) % RING_BUFFERS) {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->filled == RING_BUFFERS) {
+      pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    byte *buffer = ring->buffers + (size_t)i * RING_CHUNK;
+    size_t got = 0;
+    int error = 0;
+    while (got < RING_CHUNK) {
+      ssize_t len = read(ring->fd, buffer + got, RING_CHUNK - got);
+      if (len < 0 && errno == EINTR) {
+        continue;
+      }
+      if (len < 0) {
+        error = errno;
+      }
+      if (len <= 0) {
+        break;
+      }
+      got += len;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    ring->lengths[i] = got;
+    ring->error = error;
+    ring->done = got < RING_CHUNK;
+    ring->filled++;
+    pthread_cond_signal(&ring->changed);
+    bool done = ring->done;
+    pthread_mutex_unlock(&ring->lock);
+    if (done) {
+      return NULL;
+    }
+  }
+}
+
+/**
+  Hash everything that's left in the given file, with a reader thread
+  filling buffers while this thread hashes the ones that are already
+  full.  On a slow disk or a network file system, this takes about as
+  long as just reading the file.
+  @param fd file descriptor to read from.
+  @param ctx context to add the bytes to.
+  @param ok storage for true if the whole file was read, or false if it
+  couldn't be, with errno saying why.
+  @return true if the reader thread could be started, false if the file
+  has to be read some other way.
+*/
+static bool hashOverlapped(int fd, RipemdContext *ctx, bool *ok)
+{
+  ReadRing ring = {fd, malloc((size_t)RING_BUFFERS * RING_CHUNK), {0}, 0,
+                   false, 0, PTHREAD_MUTEX_INITIALIZER,
+                   PTHREAD_COND_INITIALIZER};
+  pthread_t id;
+  if (ring.buffers == NULL) {
+    return false;
+  }
+  if (pthread_create(&id, NULL, reader, &ring) != 0) {
+    free(ring.buffers);
+    return false;
+  }
+
+  for (int i = 0; ; i = (i + 1) % RING_BUFFERS) {
+    pthread_mutex_lock(&ring.lock);
+    while (ring.filled == 0) {
+      pthread_cond_wait(&ring.changed, &ring.lock);
+    }
+    // Once the reader is done, the only buffer left is its last one.
+    bool last = ring.done && ring.filled == 1;
+    pthread_mutex_unlock(&ring.lock);
+
+    ripemdUpdate(ctx, ring.buffers + (size_t)i * RING_CHUNK, ring.lengths[i]);
+
+    pthread_mutex_lock(&ring.lock);
+    ring.filled--;
+    pthread_cond_signal(&ring.changed);
+    pthread_mutex_unlock(&ring.lock);
+    if (last) {
+      break;
+    }
+  }
+
+  pthread_join(id, NULL);
+  free(ring.buffers);
+  *ok = ring.error == 0;
+  errno = ring.error;
+  return true;
+}
+
+bool hashDescriptor(int fd, byte digest[DIGEST_BYTES])
+{
+  // A regular file that hasn't changed since it was last hashed doesn't
+  // need to be read at all.
+  struct stat info;
+  bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+  if (regular && cacheLookup(&info, digest)) {
+    return true;
+  }
+
+  RipemdContext ctx;
+  ripemdInit(&ctx);
+
+  // For a file big enough that waiting on the disk matters, or input
+  // that isn't a regular file, reading on another thread lets the reads
+  // and the hashing overlap.
+  bool ok;
+  bool overlapped = (!regular || info.st_size >= OVERLAP_MIN) &&
+    hashOverlapped(fd, &ctx, &ok);
+  if (!overlapped) {
+    ok = hashStream(fd, &ctx);
+  }
+
+  if (ok) {
+    ripemdFinal(&ctx, digest);
+    if (regular) {
+      cacheStore(&info, digest);
+    }
+  }
+  return ok;
+}
+
+/**
+  Check whether a file could just have been appended to since a context
+  was saved for it.  It has to be the same regular file, at least as long
+  as before, and still have the same bytes in the last partial block.
+  @param fd file descriptor for the file.
+  @param info the file's status.
+  @param resume the saved resume point.
+  @param ctx storage for the context loaded from the resume point.
+  @return true if hashing can pick up where the context left off.
+*/
+static bool canResume(int fd, const struct stat *info, const byte *resume,
+                      RipemdContext *ctx)
+{
+  // The device and inode only mean anything on this machine, so they're
+  // saved the way it stores them.
+  uint64_t dev, ino;
+  memcpy(&dev, resume + STATE_BYTES, LONG_BYTE);
+  memcpy(&ino, resume + STATE_BYTES + LONG_BYTE, LONG_BYTE);
+  if (!S_ISREG(info->st_mode) || !ripemdLoad(ctx, resume) ||
+      dev != (uint64_t)info->st_dev || ino != (uint64_t)info->st_ino ||
+      ctx->len > (uint64_t)info->st_size) {
+    return false;
+  }
+
+  // A file that was rewritten in place could still be long enough, but
+  // it's not likely to have the same bytes where the context stopped.
+  size_t used = ctx->len % BLOCK_BYTES;
+  byte tail[BLOCK_BYTES];
+  return used == COUNT_START ||
+    (pread(fd, tail, used, ctx->len - used) == (ssize_t)used &&
+     memcmp(tail, ctx->partial, used) == 0);
+}
+
+bool hashAppended(int fd, const byte *resume, byte next[RESUME_BYTES],
+                  byte digest[DIGEST_BYTES])
+{
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    return false;
+  }
+  RipemdContext ctx;
+  if (resume == NULL || !canResume(fd, &info, resume, &ctx)) {
+    ripemdInit(&ctx);
+  } else if (lseek(fd, ctx.len, SEEK_SET) < 0) {
+    return false;
+  }
+
+  bool ok;
+  bool overlapped = (!S_ISREG(info.st_mode) ||
+                     info.st_size - (off_t)ctx.len >= OVERLAP_MIN) &&
+    hashOverlapped(fd, &ctx, &ok);
+  if (!overlapped) {
+    ok = hashStream(fd, &ctx);
+  }
+  if (!ok) {
+    return false;
+  }
+
+  // Save the context before it's finished, since finishing it hashes
+  // the padding.
+  uint64_t dev = info.st_dev, ino = info.st_ino;
+  ripemdSave(&ctx, next);
+  memcpy(next + STATE_BYTES, &dev, LONG_BYTE);
+  memcpy(next + STATE_BYTES + LONG_BYTE, &ino, LONG_BYTE);
+  ripemdFinal(&ctx, digest);
+  return true;
+}
+
+FileBatch *createBatch(void)
+{
+  FileBatch *batch = malloc(sizeof(FileBatch));
+  byte *data = malloc((size_t)BATCH_FILES * BATCH_FILE_BYTES);
+  if (batch == NULL || data == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  batch->count = COUNT_START;
+  batch->data = data;
+  return batch;
+}
+
+void freeBatch(FileBatch *batch)
+{
+  free(batch->data);
+  free(batch);
+}
+
+FileStatus batchDescriptor(FileBatch *batch, int fd, byte digest[DIGEST_BYTES])
+{
+  struct stat info;
+  if (batch->count == BATCH_FILES || fstat(fd, &info) != 0 ||
+      !S_ISREG(info.st_mode) || info.st_size > BATCH_FILE_BYTES) {
+    return hashDescriptor(fd, digest) ? FileHashed : FileFailed;
+  }
+  if (cacheLookup(&info, digest)) {
+    return FileHashed;
+  }
+
+  // Read the whole file, plus a byte more, in case it's grown.
+  byte *data = batch->data + (size_t)batch->count * BATCH_FILE_BYTES;
+  byte extra;
+  size_t len = COUNT_START;
+  while (true) {
+    ssize_t got = len < BATCH_FILE_BYTES ?
+      read(fd, data + len, BATCH_FILE_BYTES - len) : read(fd, &extra, 1);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      return FileFailed;
+    }
+    if (got == 0) {
+      break;
+    }
+    if (len == BATCH_FILE_BYTES) {
+      // It's too big for the batch after all.
+      if (lseek(fd, 0, SEEK_SET) < 0) {
+        return FileFailed;
+      }
+      return hashDescriptor(fd, digest) ? FileHashed : FileFailed;
+    }
+    len += got;
+  }
+
+  batch->lens[batch->count] = len;
+  batch->infos[batch->count] = info;
+  batch->count++;
+  return FileBatched;
+}
+
+void hashBatch(FileBatch *batch)
+{
+  const void *ptrs[BATCH_FILES];
+  for (int i = COUNT_START; i < batch->count; i++) {
+    ptrs[i] = batch->data + (size_t)i * BATCH_FILE_BYTES;
+  }
+  ripemdBatch(ptrs, batch->lens, batch->count, batch->digests);
+  for (int i = COUNT_START; i < batch->count; i++) {
+    cacheStore(&batch->infos[i], batch->digests[i]);
+  }
+}
+
+bool hashFile(const char *filename, byte digest[DIGEST_BYTES])
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool ok = hashDescriptor(fd, digest);
+
+  // Don't let close() change errno, in case the hash failed.
+  int err = errno;
+  close(fd);
+  errno = err;
+  return ok;
+}
@@ -0,0 +1,122 @@
+/**
+  @file fileHash.h
+  @author Maggie Lin (mclin)
+  This file contains the function prototype for hashing a whole file, by
+  name, with the fastest way of reading that works for it.
+*/
+
+#ifndef _FILE_HASH_H_
+#define _FILE_HASH_H_
+
+#include "ripeMD.h"
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/** Regular files this big or smaller can be hashed in a batch, in bytes. */
+#define BATCH_FILE_BYTES 4096
+
+/** Most files in one batch. */
+#define BATCH_FILES 64
+
+/** What happened to a file given to batchDescriptor(). */
+typedef enum { FileFailed, FileHashed, FileBatched } FileStatus;
+
+/** Small files that have been read, waiting to be hashed together with
+    the multi-lane engine.  Client code gets one from createBatch(). */
+typedef struct
+{
+  /** Number of files in the batch. */
+  int count;
+
+  /** Contents of the files, BATCH_FILE_BYTES apiece. */
+  byte *data;
+
+  /** Size of each file. */
+  size_t lens[BATCH_FILES];
+
+  /** Status of each file from when it was read, for the digest cache. */
+  struct stat infos[BATCH_FILES];
+
+  /** Hash value of each file, once hashBatch() has been called. */
+  byte digests[BATCH_FILES][DIGEST_BYTES];
+} FileBatch;
+
+/**
+  Hash everything in a file that's already open.  If it's a regular file
+  that's in the digest cache, the cached hash value is used.  Otherwise,
+  a very large file or input that isn't a regular file is read on a
+  separate thread while it's hashed, and anything else is read a chunk at
+  a time.
+  @param fd file descriptor for the file.
+  @param digest storage for the final hash value.
+  @return true if the whole file was read, false if it couldn't be,
+  with errno saying why.
+*/
+bool hashDescriptor(int fd, byte digest[DIGEST_BYTES]);
+
+/** Number of bytes in a saved resume point: a saved context, then the
+    device and inode number of the file it belongs to. */
+#define RESUME_BYTES (STATE_BYTES + 2 * LONG_BYTE)
+
+/**
+  Hash a file that only gets appended to, picking up from where it was
+  hashed last time, so only the bytes past that point are read.  The
+  whole file is hashed instead if there's no resume point, or if the file
+  can't just have been appended to since then: it's a different file
+  (a different device or inode), it's shorter, its last partial block
+  doesn't match the one saved, or it isn't a regular file.
+  @param fd file descriptor for the file.
+  @param resume the resume point saved by the last call, or NULL if there
+  isn't one.
+  @param next storage for the resume point to save for next time.  It may
+  be the same as resume.
+  @param digest storage for the final hash value.
+  @return true if the file was read, false if it couldn't be, with errno
+  saying why.
+*/
+bool hashAppended(int fd, const byte *resume, byte next[RESUME_BYTES],
+                  byte digest[DIGEST_BYTES]);
+
+/**
+  Make an empty batch.
+  @return the new batch, which has to be freed with freeBatch().
+*/
+FileBatch *createBatch(void);
+
+/**
+  Free a batch, and the memory for its files.
+  @param batch the batch to free.
+*/
+void freeBatch(FileBatch *batch);
+
+/**
+  Hash a file that's already open, or, if it's small, read it into the
+  batch to be hashed later with other small files.  If the batch is full,
+  the file is just hashed the usual way.
+  @param batch the batch to add the file to.
+  @param fd file descriptor for the file.
+  @param digest storage for the final hash value, if it's hashed now.
+  @return FileHashed if digest holds the hash value, FileBatched if the
+  file is the last one in the batch now, or FileFailed if it couldn't be
+  read, with errno saying why.
+*/
+FileStatus batchDescriptor(FileBatch *batch, int fd, byte digest[DIGEST_BYTES]);
+
+/**
+  Hash every file in a batch, side by side, and save the results in the
+  digest cache.  The hash values go in the batch's digests field, and stay
+  there until the batch is emptied by setting its count back to zero.
+  @param batch the batch to hash.
+*/
+void hashBatch(FileBatch *batch);
+
+/**
+  Hash the contents of the given file, the same way as hashDescriptor().
+  @param filename name of the file to hash.
+  @param digest storage for the final hash value.
+  @return true if the whole file was read, false if it couldn't be
+  opened or read, with errno saying why.
+*/
+bool hashFile(const char *filename, byte digest[DIGEST_BYTES]);
+
+#endif
@@ -0,0 +1,210 @@
+/**
+  @file filePool.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for hashing a list of files on a pool
+  of worker threads.  Each worker takes the next file nobody has started
+  on yet, and saves up small files to hash side by side in a batch.  The
+  main thread waits for the results in the order the files were given and
+  writes them out through a large output buffer, so a long list of small
+  files doesn't turn into a write for every line.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "filePool.h"
+#include "fileHash.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/** Size of the buffer for standard output, in bytes. */
+#define OUTPUT_BUFFER 65536
+
+/** What happened when one file was hashed. */
+typedef struct
+{
+  /** Hash value for the file, if it could be hashed. */
+  byte digest[DIGEST_BYTES];
+
+  /** Zero if the file was hashed, otherwise the errno value saying why
+      it couldn't be. */
+  int error;
+
+  /** True once a worker is finished with this file. */
+  bool done;
+} FileResult;
+
+/** Everything the workers share. */
+typedef struct
+{
+  /** Names of the files to hash. */
+  char **names;
+
+  /** Number of files to hash. */
+  int count;
+
+  /** Results for each file, in the same order as the names. */
+  FileResult *results;
+
+  /** Index of the next file nobody has started on. */
+  int next;
+
+  /** Lock for next and for the done flag of each result. */
+  pthread_mutex_t lock;
+
+  /** Signaled whenever a file is finished. */
+  pthread_cond_t finished;
+} FileList;
+
+/**
+  Hash every file in a worker's batch, and mark them finished.
+  @param list the list the files come from.
+  @param batch the worker's batch.
+  @param ids index in the list of each file in the batch.
+*/
+static void flushBatch(FileList *list, FileBatch *batch, const int ids[])
+{
+  if (batch->count == 0) {
+    return;
+  }
+  hashBatch(batch);
+  for (int k = 0; k < batch->count; k++) {
+    memcpy(list->results[ids[k]].digest, batch->digests[k], DIGEST_BYTES);
+  }
+
+  pthread_mutex_lock(&list->lock);
+  for (int k = 0; k < batch->count; k++) {
+    list->results[ids[k]].done = true;
+  }
+  pthread_cond_signal(&list->finished);
+  pthread_mutex_unlock(&list->lock);
+  batch->count = 0;
+}
+
+/**
+  Hash one file, or put it in a worker's batch if it's small.
+  @param list the list the file comes from.
+  @param i index of the file in the list.
+  @param batch the worker's batch.
+  @return true if the file is finished, false if it's in the batch.
+*/
+static bool hashOne(FileList *list, int i, FileBatch *batch)
+{
+  FileResult *result = &list->results[i];
+  int fd = open(list->names[i], O_RDONLY);
+  if (fd < 0) {
+    result->error = errno;
+    return true;
+  }
+  FileStatus status = batchDescriptor(batch, fd, result->digest);
+  result->error = status == FileFailed ? errno : 0;
+  close(fd);
+  return status != FileBatched;
+}
+
+/**
+  Starting point for a worker thread.  It hashes files until there
+  aren't any left to start on, then hashes whatever's left in its batch.
+  @param arg the FileList the worker is hashing.
+  @return NULL, always.
+*/
+static void *worker(void *arg)
+{
+  FileList *list = arg;
+  FileBatch *batch = createBatch();
+  int ids[BATCH_FILES];
+
+  pthread_mutex_lock(&list->lock);
+  while (list->next < list->count) {
+    int i = list->next++;
+    pthread_mutex_unlock(&list->lock);
+
+    bool finished = hashOne(list, i, batch);
+    if (!finished) {
+      ids[batch->count - 1] = i;
+      if (batch->count == BATCH_FILES) {
+        flushBatch(list, batch, ids);
+      }
+    }
+
+    pthread_mutex_lock(&list->lock);
+    if (finished) {
+      list->results[i].done = true;
+      pthread_cond_signal(&list->finished);
+    }
+  }
+  pthread_mutex_unlock(&list->lock);
+
+  flushBatch(list, batch, ids);
+  freeBatch(batch);
+  return NULL;
+}
+
+/**
+  Report the result for one file, a line with its hash value and its
+  name, or an error message.
+  @param name name of the file.
+  @param result what happened when it was hashed.
+*/
+static void report(const char *name, FileResult *result)
+{
+  if (result->error) {
+    fprintf(stderr, "%s: %s\n", name, strerror(result->error));
+    return;
+  }
+  char hex[DIGEST_HEX + 1];
+  formatDigest(result->digest, hex);
+  printf("%s  %s\n", hex, name);
+}
+
+bool hashFileList(char *names[], int count, int threads)
+{
+  FileList list = {names, count, calloc(count, sizeof(FileResult)), 0,
+                   PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+  if (count > 0 && list.results == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+
+  // With just one thread, there's no point starting any workers.
+  if (threads > count) {
+    threads = count;
+  }
+  pthread_t ids[MAX_THREADS];
+  int started = 0;
+  if (threads > 1) {
+    while (started < threads &&
+           pthread_create(&ids[started], NULL, worker, &list) == 0) {
+      started++;
+    }
+  }
+
+  // Without any workers, this thread does all the hashing first.
+  if (started == 0) {
+    worker(&list);
+  }
+
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    pthread_mutex_lock(&list.lock);
+    while (!list.results[i].done) {
+      pthread_cond_wait(&list.finished, &list.lock);
+    }
+    pthread_mutex_unlock(&list.lock);
+
+    if (list.results[i].error) {
+      ok = false;
+    }
+    report(names[i], &list.results[i]);
+  }
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(ids[i], NULL);
+  }
+  fflush(stdout);
+  free(list.results);
+  return ok;
+}
@@ -0,0 +1,31 @@
+/**
+  @file filePool.h
+  @author Maggie Lin (mclin)
+  This file contains the function prototype for hashing a list of files on
+  a pool of worker threads.  The files are hashed in whatever order the
+  workers get to them, but the results are reported in the order the files
+  were given.
+*/
+
+#ifndef _FILE_POOL_H_
+#define _FILE_POOL_H_
+
+#include <stdbool.h>
+
+/** Most worker threads that can be asked for. */
+#define MAX_THREADS 256
+
+/**
+  Hash every file in the given list, using the given number of worker
+  threads.  For each file, a line with its hash value and its name is
+  written to standard output, in the order the files are listed.  If a
+  file can't be hashed, a message is printed to standard error instead,
+  and the rest of the files are still hashed.
+  @param names names of the files to hash.
+  @param count number of files in the list.
+  @param threads number of worker threads to use, at least one.
+  @return true if every file was hashed.
+*/
+bool hashFileList(char *names[], int count, int threads);
+
+#endif
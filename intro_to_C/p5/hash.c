@@ -1,52 +1,299 @@
 /**
   @file hash.c
   @author Maggie Lin (mclin)
-  This file contains the main method for the RIPEMD hash program. It reads a file 
-  and store the information in a buffer. It then create a ByteBuffer from the files, 
-  hash the buffer with RIPEMD algorithm,and prints out the final hash values as 
-  a 160 bit number in hexadecimal.
+  This file contains the main method for the RIPEMD hash program. It hashes 
+  the file named on the command line with the RIPEMD algorithm and prints out 
+  the final hash value as a 160 bit number in hexadecimal. Given a list of 
+  files, it hashes them on a pool of worker threads and prints each hash 
+  value with the name of its file, and given directories, it prints a sorted 
+  manifest of every file under them.  With --tree, it prints a tree hash of
+  each file instead, which isn't plain RIPEMD-160, so it's labeled with the
+  chunk size it used.  With --state-file, it picks up hashing a file
+  where the last run left off, so only bytes appended since then are read.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "byteBuffer.h"
 #include "ripeMD.h"
+#include "fileHash.h"
+#include "filePool.h"
+#include "dirHash.h"
+#include "digestCache.h"
+#include "treeHash.h"
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/** Print a usage message then exit unsuccessfully. */
+static void usage()
+{
+  fprintf(stderr, "usage: hash [--no-cache | --verify-cache] [-j <threads>] "
+          "<input-file>...\n"
+          "       hash [--no-cache | --verify-cache] [-j <threads>] "
+          "-r <directory>...\n"
+          "       hash --tree [chunk=<size>[K|M|G]] [-j <threads>] "
+          "<input-file>...\n"
+          "       hash --state-file <state-file> <input-file>\n");
+  exit(EXIT_FAILURE);
+}
+
+/**
+  Get the number of worker threads from a command-line argument.
+  @param arg the argument after -j.
+  @return the number of threads, exiting with a usage message if the
+  argument isn't a number in the right range.
+*/
+static int parseThreads(const char *arg)
+{
+  char *end;
+  long threads = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || threads < 1 || threads > MAX_THREADS) {
+    usage();
+  }
+  return threads;
+}
+
+/**
+  Get the chunk size for tree hashing from a command-line argument.
+  @param arg the size, after chunk=, with an optional K, M or G suffix.
+  @return the chunk size in bytes, exiting with a usage message if the
+  argument isn't a size in the right range.
+*/
+static size_t parseChunk(const char *arg)
+{
+  if (*arg < '0' || *arg > '9') {
+    usage();
+  }
+  char *end;
+  unsigned long long size = strtoull(arg, &end, 10);
+  int shift = 0;
+  if (*end == 'K') {
+    shift = 10;
+  } else if (*end == 'M') {
+    shift = 20;
+  } else if (*end == 'G') {
+    shift = 30;
+  }
+  if (shift) {
+    end++;
+  }
+  if (*end != '\0' || size > (MAX_CHUNK >> shift) || (size << shift) < MIN_CHUNK) {
+    usage();
+  }
+  return size << shift;
+}
+
+/**
+  Tree hash each file in a list, and print its hash value labeled with
+  the chunk size, so it can't be mistaken for a plain RIPEMD-160 value.
+  @param names names of the files to hash.
+  @param count number of files in the list.
+  @param chunk size of each chunk, in bytes.
+  @param label the chunk size, the way it was given on the command line.
+  @param threads number of threads to use for each file.
+  @return true if every file was hashed.
+*/
+static bool treeHashList(char *names[], int count, size_t chunk,
+                         const char *label, int threads)
+{
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    byte digest[DIGEST_BYTES];
+    if (!treeHashFile(names[i], chunk, threads, digest)) {
+      fprintf(stderr, "%s: %s\n", names[i], strerror(errno));
+      ok = false;
+      continue;
+    }
+    char hex[DIGEST_HEX + 1];
+    formatDigest(digest, hex);
+    printf("RIPEMD160-TREE-%s (%s) = %s\n", label, names[i], hex);
+  }
+  return ok;
+}
+
+/**
+  Hash a file that only ever gets appended to, starting from the resume
+  point saved in a state file by the last run, then save a new one for
+  the next run and print the hash value.  If the state file doesn't exist
+  yet, doesn't hold a resume point, or was saved for some other file,
+  the whole file is hashed.
+  @param filename name of the file to hash.
+  @param path name of the state file.
+*/
+static void hashResumed(const char *filename, const char *path)
+{
+  byte resume[RESUME_BYTES];
+  FILE *fp = fopen(path, "rb");
+  bool saved = fp && fread(resume, 1, RESUME_BYTES, fp) == RESUME_BYTES;
+  if (fp) {
+    fclose(fp);
+  }
+
+  byte digest[DIGEST_BYTES];
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0 || !hashAppended(fd, saved ? resume : NULL, resume, digest)) {
+    perror(filename);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  // The new resume point is written to a new file and renamed into place,
+  // so a run that dies part way doesn't leave half a state file.
+  char temp[strlen(path) + 32];
+  snprintf(temp, sizeof(temp), "%s.%ld", path, (long)getpid());
+  fp = fopen(temp, "wb");
+  bool written = fp && fwrite(resume, 1, RESUME_BYTES, fp) == RESUME_BYTES;
+  if (fp && fclose(fp) != 0) {
+    written = false;
+  }
+  if (!written || rename(temp, path) != 0) {
+    perror(path);
+    remove(temp);
+    exit(EXIT_FAILURE);
+  }
+
+  printDigest(digest);
+}
 
-/** The minimum number of arguments in the command-line. */
-#define ARG_MIN 2
+/**
+  Open the digest cache.  It's named by the HASH_CACHE environment
+  variable, or it's in the user's cache directory.  If it can't be
+  opened, everything is just hashed without it.
+  @param verify true to hash every file again and check the cache.
+*/
+static void openCache(bool verify)
+{
+  const char *path = getenv("HASH_CACHE");
+  if (path) {
+    openDigestCache(path, verify);
+    return;
+  }
 
-/** The argument in the command-line which contains the filename. */
-#define FILENAME_ARG 1
+  const char *dir = getenv("XDG_CACHE_HOME");
+  const char *sub = "";
+  if (dir == NULL || *dir == '\0') {
+    dir = getenv("HOME");
+    sub = "/.cache";
+  }
+  if (dir) {
+    char name[strlen(dir) + strlen(sub) + strlen(CACHE_NAME) + 2];
+    sprintf(name, "%s%s/%s", dir, sub, CACHE_NAME);
+    openDigestCache(name, verify);
+  }
+}
+
+/**
+  Close the digest cache, and report any cached hash values that were
+  wrong.
+  @param status the exit status the program would have otherwise.
+  @return the exit status to use.
+*/
+static int closeCache(int status)
+{
+  closeDigestCache();
+  int wrong = cacheMismatches();
+  if (wrong > 0) {
+    fprintf(stderr, "hash: %d cached hash value%s didn't match\n", wrong,
+            wrong == 1 ? "" : "s");
+    return EXIT_FAILURE;
+  }
+  return status;
+}
 
 /** 
-  Program starting point, reads filename from the command-line arguments.
-  Create a ByteBuffer from the files, hash the buffer with RIPEMD algorithm,
-  and prints out the final hash values as a 160 bit number in hexadecimal.
+  Program starting point, reads options and filenames from the command-line 
+  arguments. Hash each file with RIPEMD algorithm, and prints out the final 
+  hash values as 160 bit numbers in hexadecimal.
   @param argc number of command-line arguments.
   @param argv list of command-line arguments.
   @return program exit status
 */
 int main(int argc, char *argv[])
 {
+  // Handle options, which come before the filenames.
+  int threads = 1;
+  bool listed = false;
+  bool recursive = false;
+  bool cached = true;
+  bool verify = false;
+  bool tree = false;
+  size_t chunk = DEFAULT_CHUNK;
+  const char *label = "4M";
+  const char *state = NULL;
+  int apos = 1;
+  while (apos < argc && argv[apos][0] == '-' && argv[apos][1] != '\0') {
+    if (strcmp(argv[apos], "-j") == 0 && apos + 1 < argc) {
+      threads = parseThreads(argv[++apos]);
+      listed = true;
+    } else if (strcmp(argv[apos], "-r") == 0) {
+      recursive = true;
+    } else if (strcmp(argv[apos], "--no-cache") == 0 && !verify) {
+      cached = false;
+    } else if (strcmp(argv[apos], "--verify-cache") == 0 && cached) {
+      verify = true;
+    } else if (strcmp(argv[apos], "--state-file") == 0 && apos + 1 < argc) {
+      state = argv[++apos];
+    } else if (strcmp(argv[apos], "--tree") == 0) {
+      tree = true;
+      if (apos + 1 < argc && strncmp(argv[apos + 1], "chunk=", 6) == 0) {
+        label = argv[++apos] + 6;
+        chunk = parseChunk(label);
+      }
+    } else {
+      usage();
+    }
+    apos++;
+  }
+  if (apos >= argc || (tree && recursive)) {
+    usage();
+  }
 
-  if (argc < ARG_MIN) {
-    fprintf(stderr, "usage: hash <input-file>\n");
-    exit(EXIT_FAILURE);
+  // A state file goes with just one file, hashed the plain way.
+  if (state) {
+    if (argc - apos != 1 || listed || recursive || tree) {
+      usage();
+    }
+    hashResumed(argv[apos], state);
+    return EXIT_SUCCESS;
   }
-  ByteBuffer *buffer = readFile(argv[FILENAME_ARG]);
-  if (buffer == NULL) {
-    perror(argv[FILENAME_ARG]);
-    exit(EXIT_FAILURE);
+
+  // Tree hash values aren't plain hash values, so they're never cached.
+  if (tree) {
+    bool ok = treeHashList(argv + apos, argc - apos, chunk, label, threads);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (cached) {
+    openCache(verify);
   }
 
-  HashState state;
-  initState(&state);
-  padBuffer(buffer);
+  // Print a manifest for everything under each directory.
+  if (recursive) {
+    bool ok = true;
+    for (int i = apos; i < argc; i++) {
+      if (!hashDirectory(argv[i], threads)) {
+        ok = false;
+      }
+    }
+    return closeCache(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
 
-  for (int i = COUNT_START; i < buffer->len / BLOCK_BYTES; i++) {
-    hashBlock(&state, &buffer->data[i * BLOCK_BYTES]);
+  // With a list of files, or any options, each hash value is printed
+  // with the name of its file.
+  if (listed || argc - apos > 1) {
+    bool ok = hashFileList(argv + apos, argc - apos, threads);
+    return closeCache(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  byte digest[DIGEST_BYTES];
+  if (!hashFile(argv[apos], digest)) {
+    perror(argv[apos]);
+    exit(EXIT_FAILURE);
   }
 
-  printHash(&state);
-  freeBuffer(buffer);
-  return EXIT_SUCCESS;
+  printDigest(digest);
+  return closeCache(EXIT_SUCCESS);
 }
@@ -0,0 +1,164 @@
+/**
+  @file hmacRipemd.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for HMAC-RIPEMD160 and PBKDF2.  The
+  pad blocks for a key are hashed when it's set up.  The outer hash only
+  ever covers a pad block and one hash value, so it's always finished with
+  one more block, which is padded the same way every time.
+*/
+
+#include "hmacRipemd.h"
+#include <string.h>
+
+/** Number of bytes in the block counter PBKDF2 adds to the salt. */
+#define COUNTER_BYTES 4
+
+/**
+  Clear memory that held a key or something derived from it.  The stores
+  go through a volatile pointer, so the compiler can't drop them just
+  because nothing reads the memory afterwards.
+  @param ptr the memory to clear.
+  @param len number of bytes to clear.
+*/
+static void wipe(void *ptr, size_t len)
+{
+  volatile byte *bytes = ptr;
+  for (size_t i = COUNT_START; i < len; i++) {
+    bytes[i] = PAD_ZERO;
+  }
+}
+
+/**
+  Fill in the padding for a block that holds one hash value, after a
+  block that's already been hashed.  Only the first DIGEST_BYTES of the
+  block are left for the hash value.
+  @param block the block to pad.
+*/
+static void padDigestBlock(byte block[BLOCK_BYTES])
+{
+  uint64_t bits = (uint64_t)(BLOCK_BYTES + DIGEST_BYTES) * BBITS;
+  block[DIGEST_BYTES] = PAD_START;
+  memset(block + DIGEST_BYTES + 1, PAD_ZERO,
+         BLOCK_BYTES - LONG_BYTE - DIGEST_BYTES - 1);
+  for (int j = COUNT_START; j < LONG_BYTE; j++) {
+    block[BLOCK_BYTES - LONG_BYTE + j] = (bits >> j * BBITS) & LONG_BYTE_MASK;
+  }
+}
+
+void hmacSetKey(HmacKey *key, const void *secret, size_t len)
+{
+  // Keys longer than a block are replaced by their hash value, and
+  // shorter ones are padded with zeros.
+  byte block[BLOCK_BYTES] = {0};
+  if (len > BLOCK_BYTES) {
+    RipemdContext ctx;
+    ripemdInit(&ctx);
+    ripemdUpdate(&ctx, secret, len);
+    ripemdFinal(&ctx, block);
+    wipe(&ctx, sizeof(ctx));
+  } else {
+    memcpy(block, secret, len);
+  }
+
+  byte pad[BLOCK_BYTES];
+  for (int i = COUNT_START; i < BLOCK_BYTES; i++) {
+    pad[i] = block[i] ^ HMAC_IPAD;
+  }
+  initState(&key->inner);
+  hashBlock(&key->inner, pad);
+
+  for (int i = COUNT_START; i < BLOCK_BYTES; i++) {
+    pad[i] = block[i] ^ HMAC_OPAD;
+  }
+  initState(&key->outer);
+  hashBlock(&key->outer, pad);
+
+  // Don't leave copies of the key lying around on the stack.
+  wipe(block, BLOCK_BYTES);
+  wipe(pad, BLOCK_BYTES);
+}
+
+void hmacInit(const HmacKey *key, RipemdContext *ctx)
+{
+  // Pick up right after the inner pad block.
+  ctx->state = key->inner;
+  ctx->len = BLOCK_BYTES;
+}
+
+void hmacFinal(const HmacKey *key, RipemdContext *ctx, byte mac[DIGEST_BYTES])
+{
+  byte block[BLOCK_BYTES];
+  ripemdFinal(ctx, block);
+  padDigestBlock(block);
+
+  HashState state = key->outer;
+  hashBlock(&state, block);
+  storeDigest(&state, mac);
+}
+
+void hmacRipemd(const HmacKey *key, const void *msg, size_t len,
+                byte mac[DIGEST_BYTES])
+{
+  RipemdContext ctx;
+  hmacInit(key, &ctx);
+  ripemdUpdate(&ctx, msg, len);
+  hmacFinal(key, &ctx, mac);
+}
+
+void pbkdf2Ripemd(const void *password, size_t passLen, const void *salt,
+                  size_t saltLen, unsigned long iterations, byte *out,
+                  size_t outLen)
+{
+  HmacKey key;
+  hmacSetKey(&key, password, passLen);
+
+  // After the first iteration, every message is just the last MAC, so
+  // the inner and outer hashes each finish with one block padded the
+  // same way.  Each one's hash value goes right into the other's block.
+  byte inner[BLOCK_BYTES], outer[BLOCK_BYTES];
+  padDigestBlock(inner);
+  padDigestBlock(outer);
+
+  RipemdContext ctx;
+  HashState state;
+  byte sum[DIGEST_BYTES];
+  for (uint32_t count = 1; outLen > 0; count++) {
+    byte counter[COUNTER_BYTES];
+    for (int j = COUNT_START; j < COUNTER_BYTES; j++) {
+      counter[j] = (count >> (COUNTER_BYTES - 1 - j) * BBITS) & RIGHT_BYTE_MASK;
+    }
+    hmacInit(&key, &ctx);
+    ripemdUpdate(&ctx, salt, saltLen);
+    ripemdUpdate(&ctx, counter, COUNTER_BYTES);
+    hmacFinal(&key, &ctx, inner);
+
+    memcpy(sum, inner, DIGEST_BYTES);
+    for (unsigned long i = 1; i < iterations; i++) {
+      state = key.inner;
+      hashBlock(&state, inner);
+      storeDigest(&state, outer);
+
+      state = key.outer;
+      hashBlock(&state, outer);
+      storeDigest(&state, inner);
+
+      for (int j = COUNT_START; j < DIGEST_BYTES; j++) {
+        sum[j] ^= inner[j];
+      }
+    }
+
+    size_t take = outLen < DIGEST_BYTES ? outLen : DIGEST_BYTES;
+    memcpy(out, sum, take);
+    out += take;
+    outLen -= take;
+  }
+
+  // The pad states stand in for the password, and the sums and blocks
+  // are the derived key, so none of them should outlive this call.
+  wipe(&key, sizeof(key));
+  wipe(&ctx, sizeof(ctx));
+  wipe(&state, sizeof(state));
+  wipe(inner, BLOCK_BYTES);
+  wipe(outer, BLOCK_BYTES);
+  wipe(sum, DIGEST_BYTES);
+}
@@ -0,0 +1,84 @@
+/**
+  @file hmacRipemd.h
+  @author Maggie Lin (mclin)
+  This file contains the function prototypes for HMAC-RIPEMD160 (RFC 2104
+  and RFC 2286), and for PBKDF2 (RFC 8018) built on it.  Setting up a key
+  hashes its inner and outer pad blocks once and keeps the two states, so
+  each message after that only costs its own blocks plus one block for
+  the outer hash.
+*/
+
+#ifndef _HMAC_RIPEMD_H_
+#define _HMAC_RIPEMD_H_
+
+#include "ripeMD.h"
+
+/** Byte the key is XORed with for the inner hash. */
+#define HMAC_IPAD 0x36
+
+/** Byte the key is XORed with for the outer hash. */
+#define HMAC_OPAD 0x5C
+
+/** A key that's ready to use.  It holds the states after the inner and
+    outer pad blocks, so the key itself doesn't need to be kept. */
+typedef struct
+{
+  /** State after hashing the key XORed with HMAC_IPAD. */
+  HashState inner;
+
+  /** State after hashing the key XORed with HMAC_OPAD. */
+  HashState outer;
+} HmacKey;
+
+/**
+  Set up a key.  A key longer than a block is hashed first, as the
+  standard says.
+  @param key the key to fill in.
+  @param secret the bytes of the key.
+  @param len number of bytes in the key.
+*/
+void hmacSetKey(HmacKey *key, const void *secret, size_t len);
+
+/**
+  Start computing a MAC for a message that's given a piece at a time.
+  The pieces are added with ripemdUpdate().
+  @param key the key to use.
+  @param ctx the context to start.
+*/
+void hmacInit(const HmacKey *key, RipemdContext *ctx);
+
+/**
+  Finish computing a MAC started with hmacInit().
+  @param key the same key given to hmacInit().
+  @param ctx the context with the whole message added to it.
+  @param mac storage for the MAC.
+*/
+void hmacFinal(const HmacKey *key, RipemdContext *ctx, byte mac[DIGEST_BYTES]);
+
+/**
+  Compute the MAC for a whole message.
+  @param key the key to use.
+  @param msg the message.
+  @param len number of bytes in the message.
+  @param mac storage for the MAC.
+*/
+void hmacRipemd(const HmacKey *key, const void *msg, size_t len,
+                byte mac[DIGEST_BYTES]);
+
+/**
+  Derive a key from a password with PBKDF2-HMAC-RIPEMD160.  The password's
+  pad states are computed once and used for every iteration, so each
+  iteration is just two blocks.
+  @param password the bytes of the password.
+  @param passLen number of bytes in the password.
+  @param salt the salt.
+  @param saltLen number of bytes in the salt.
+  @param iterations number of iterations, at least one.
+  @param out storage for the derived key.
+  @param outLen number of bytes of key to derive.
+*/
+void pbkdf2Ripemd(const void *password, size_t passLen, const void *salt,
+                  size_t saltLen, unsigned long iterations, byte *out,
+                  size_t outLen);
+
+#endif
@@ -0,0 +1,333 @@
+/**
+  @file multiHash.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for hashing many messages at once.  A
+  kernel hashes one block for each lane, using the same unrolled steps as
+  hashBlock(), but on vectors.  A scheduler gives each lane its next block,
+  and starts a new message in a lane when the old one is finished.
+*/
+
+#include "multiHash.h"
+#include "ripeSteps.h"
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+/** Number of longwords in a hash state. */
+#define STATE_WORDS (DIGEST_BYTES / LONGWORD_BYTE)
+
+/** Most padded blocks there can be at the end of a message. */
+#define TAIL_BLOCKS 2
+
+/** Number of messages ripemdBatch() sorts and hashes at a time. */
+#define BATCH_CHUNK 1024
+
+/** Number of groups ripemdBatch() sorts messages into, by how many
+    blocks they take.  Messages longer than this are all in the last
+    group. */
+#define BATCH_GROUPS 8
+
+/** Type for a kernel, which hashes the next block of each lane.  The
+    state is stored one field per row, with one lane in each column. */
+typedef void (*LaneKernel)(longword state[STATE_WORDS][MAX_LANES],
+                           const byte *blocks[MAX_LANES]);
+
+/** Define a kernel that hashes blocks for the given number of lanes,
+    with the given attributes choosing the instruction set. */
+#define LANE_KERNEL(name, lanes, isa)                                   \
+  isa                                                                   \
+  static void name(longword state[STATE_WORDS][MAX_LANES],              \
+                   const byte *blocks[MAX_LANES])                       \
+  {                                                                     \
+    typedef longword Lanes __attribute__((vector_size(lanes * sizeof(longword)))); \
+                                                                        \
+    /* Gather word i of every lane's block into x[i]. */                \
+    Lanes x[BLOCK_LONGWORDS];                                           \
+    for (int i = COUNT_START; i < BLOCK_LONGWORDS; i++) {               \
+      longword words[lanes];                                            \
+      for (int k = COUNT_START; k < lanes; k++) {                       \
+        words[k] = loadLittle(blocks[k] + i * LONGWORD_BYTE);           \
+      }                                                                 \
+      memcpy(&x[i], words, sizeof(Lanes));                              \
+    }                                                                   \
+                                                                        \
+    Lanes start[STATE_WORDS];                                           \
+    for (int w = COUNT_START; w < STATE_WORDS; w++) {                   \
+      memcpy(&start[w], state[w], sizeof(Lanes));                       \
+    }                                                                   \
+    Lanes al = start[0], bl = start[1], cl = start[2], dl = start[3], el = start[4]; \
+    Lanes ar = start[0], br = start[1], cr = start[2], dr = start[3], er = start[4]; \
+                                                                        \
+    RIPE_STEPS                                                          \
+                                                                        \
+    Lanes result[STATE_WORDS] = {                                       \
+      cl + start[1] + dr, dl + start[2] + er, el + start[3] + ar,       \
+      al + start[4] + br, bl + start[0] + cr };                         \
+    for (int w = COUNT_START; w < STATE_WORDS; w++) {                   \
+      memcpy(state[w], &result[w], sizeof(Lanes));                      \
+    }                                                                   \
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+LANE_KERNEL(hashLanes4, 4, __attribute__((target("sse2"))))
+LANE_KERNEL(hashLanes8, 8, __attribute__((target("avx2"))))
+LANE_KERNEL(hashLanes16, 16, __attribute__((target("avx512f"))))
+#else
+LANE_KERNEL(hashLanes4, 4, )
+#endif
+
+/** What one lane is working on. */
+typedef struct
+{
+  /** Message this lane is hashing, or NULL if the lane is idle. */
+  HashJob *job;
+
+  /** Next complete block in the message itself. */
+  const byte *next;
+
+  /** Number of complete blocks left in the message itself. */
+  size_t full;
+
+  /** Padded copy of the end of the message. */
+  byte tail[TAIL_BLOCKS * BLOCK_BYTES];
+
+  /** Number of blocks in tail. */
+  int tailBlocks;
+
+  /** Number of blocks in tail that have been hashed. */
+  int tailDone;
+} Lane;
+
+/** Kernel to use for hashing, chosen by setLaneLimit(). */
+static LaneKernel laneKernel = NULL;
+
+/** Number of lanes the current kernel hashes. */
+static int laneCount;
+
+/** Makes sure a kernel gets chosen just once, even when the first
+    messages are hashed on several threads at the same time. */
+static pthread_once_t laneOnce = PTHREAD_ONCE_INIT;
+
+/** Block hashed by lanes that don't have a message. */
+static const byte idleBlock[BLOCK_BYTES];
+
+int setLaneLimit(int lanes)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (lanes >= 16 && __builtin_cpu_supports("avx512f")) {
+    laneKernel = hashLanes16;
+    laneCount = 16;
+    return laneCount;
+  }
+  if (lanes >= 8 && __builtin_cpu_supports("avx2")) {
+    laneKernel = hashLanes8;
+    laneCount = 8;
+    return laneCount;
+  }
+#endif
+  laneKernel = hashLanes4;
+  laneCount = MIN_LANES;
+  return laneCount;
+}
+
+/**
+  Choose the widest kernel, if setLaneLimit() hasn't chosen one already.
+*/
+static void chooseKernel(void)
+{
+  if (laneKernel == NULL) {
+    setLaneLimit(MAX_LANES);
+  }
+}
+
+/**
+  Copy the end of a message that doesn't fill a whole block, then add
+  the padding and the message length, the same way ripemdFinal() does.
+  @param tail storage for the padded blocks.
+  @param data start of the message.
+  @param len number of bytes in the message.
+  @return the number of blocks in tail, one or two.
+*/
+static int padTail(byte tail[TAIL_BLOCKS * BLOCK_BYTES], const byte *data, size_t len)
+{
+  size_t used = len % BLOCK_BYTES;
+  if (used > COUNT_START) {
+    memcpy(tail, data + len - used, used);
+  }
+  tail[used++] = PAD_START;
+
+  int blocks = used > BLOCK_BYTES - LONG_BYTE ? TAIL_BLOCKS : 1;
+  size_t end = blocks * BLOCK_BYTES - LONG_BYTE;
+  memset(tail + used, PAD_ZERO, end - used);
+
+  uint64_t bits = (uint64_t)len * BBITS;
+  for (int j = COUNT_START; j < LONG_BYTE; j++) {
+    tail[end + j] = (bits >> j * BBITS) & LONG_BYTE_MASK;
+  }
+  return blocks;
+}
+
+/**
+  Start hashing a message in the given lane.
+  @param lane the lane to use.
+  @param job the message to hash.
+  @param state the state for all the lanes.
+  @param k index of the lane.
+*/
+static void startLane(Lane *lane, HashJob *job,
+                      longword state[STATE_WORDS][MAX_LANES], int k)
+{
+  lane->job = job;
+  lane->next = job->data;
+  lane->full = job->len / BLOCK_BYTES;
+  lane->tailBlocks = padTail(lane->tail, job->data, job->len);
+  lane->tailDone = COUNT_START;
+
+  HashState init;
+  initState(&init);
+  state[0][k] = init.A;
+  state[1][k] = init.B;
+  state[2][k] = init.C;
+  state[3][k] = init.D;
+  state[4][k] = init.E;
+}
+
+/**
+  Get the next block for a lane to hash, first from the message, then
+  from its padded tail.
+  @param lane the lane to get a block for.
+  @return the block to hash.
+*/
+static const byte *nextBlock(Lane *lane)
+{
+  if (lane->full > COUNT_START) {
+    const byte *block = lane->next;
+    lane->next += BLOCK_BYTES;
+    lane->full--;
+    return block;
+  }
+  return lane->tail + lane->tailDone++ * BLOCK_BYTES;
+}
+
+/**
+  Report whether a lane has hashed every block of its message.
+  @param lane the lane to check.
+  @return true if the message is finished.
+*/
+static bool laneFinished(Lane *lane)
+{
+  return lane->full == COUNT_START && lane->tailDone == lane->tailBlocks;
+}
+
+/**
+  Copy one lane's column of the state out into a HashState.
+  @param state the state for all the lanes.
+  @param k index of the lane.
+  @param out the HashState to fill in.
+*/
+static void laneState(longword state[STATE_WORDS][MAX_LANES], int k, HashState *out)
+{
+  out->A = state[0][k];
+  out->B = state[1][k];
+  out->C = state[2][k];
+  out->D = state[3][k];
+  out->E = state[4][k];
+}
+
+void hashJobs(HashJob *jobs, size_t n)
+{
+  pthread_once(&laneOnce, chooseKernel);
+
+  Lane lanes[MAX_LANES];
+  longword state[STATE_WORDS][MAX_LANES];
+  const byte *blocks[MAX_LANES];
+
+  // Give every lane a message, if there are enough.
+  size_t pending = COUNT_START;
+  int active = COUNT_START;
+  for (int k = COUNT_START; k < laneCount; k++) {
+    lanes[k].job = NULL;
+    if (pending < n) {
+      startLane(&lanes[k], &jobs[pending++], state, k);
+      active++;
+    }
+  }
+
+  while (active > COUNT_START) {
+    // With just one message left, it's quicker to finish it on its own.
+    if (active == 1 && pending == n) {
+      for (int k = COUNT_START; k < laneCount; k++) {
+        if (lanes[k].job) {
+          HashState single;
+          laneState(state, k, &single);
+          while (!laneFinished(&lanes[k])) {
+            hashBlock(&single, (byte *)nextBlock(&lanes[k]));
+          }
+          storeDigest(&single, lanes[k].job->digest);
+        }
+      }
+      return;
+    }
+
+    for (int k = COUNT_START; k < laneCount; k++) {
+      blocks[k] = lanes[k].job ? nextBlock(&lanes[k]) : idleBlock;
+    }
+    laneKernel(state, blocks);
+
+    // Collect finished messages, and start new ones in their lanes.
+    for (int k = COUNT_START; k < laneCount; k++) {
+      if (lanes[k].job && laneFinished(&lanes[k])) {
+        HashState done;
+        laneState(state, k, &done);
+        storeDigest(&done, lanes[k].job->digest);
+        lanes[k].job = NULL;
+        active--;
+        if (pending < n) {
+          startLane(&lanes[k], &jobs[pending++], state, k);
+          active++;
+        }
+      }
+    }
+  }
+}
+
+/**
+  Figure out which group a message goes in for ripemdBatch(), based on
+  how many blocks it takes once it's padded.
+  @param len number of bytes in the message.
+  @return the group for the message.
+*/
+static int batchGroup(size_t len)
+{
+  size_t blocks = (len + LONG_BYTE) / BLOCK_BYTES + 1;
+  return blocks < BATCH_GROUPS ? blocks - 1 : BATCH_GROUPS - 1;
+}
+
+void ripemdBatch(const void **ptrs, const size_t *lens, size_t n,
+                 uint8_t (*out)[DIGEST_BYTES])
+{
+  HashJob jobs[BATCH_CHUNK];
+  for (size_t first = COUNT_START; first < n; first += BATCH_CHUNK) {
+    size_t count = n - first < BATCH_CHUNK ? n - first : BATCH_CHUNK;
+
+    // Count the messages in each group, then find where each group
+    // starts in the list of jobs.
+    size_t start[BATCH_GROUPS] = {COUNT_START};
+    for (size_t i = COUNT_START; i < count; i++) {
+      start[batchGroup(lens[first + i])]++;
+    }
+    size_t pos = COUNT_START;
+    for (int g = COUNT_START; g < BATCH_GROUPS; g++) {
+      size_t size = start[g];
+      start[g] = pos;
+      pos += size;
+    }
+
+    for (size_t i = COUNT_START; i < count; i++) {
+      size_t len = lens[first + i];
+      jobs[start[batchGroup(len)]++] =
+        (HashJob){ptrs[first + i], len, out[first + i]};
+    }
+    hashJobs(jobs, count);
+  }
+}
@@ -0,0 +1,68 @@
+/**
+  @file multiHash.h
+  @author Maggie Lin (mclin)
+  This file contains the struct for a HashJob, one of many messages to be
+  hashed together, and the function prototypes for hashing a list of them.
+  The messages are hashed side by side, one in each lane of a vector, so
+  several blocks are hashed by the same instructions. The number of lanes
+  is picked when the program runs, based on what the CPU supports.
+*/
+
+#ifndef _MULTI_HASH_H_
+#define _MULTI_HASH_H_
+
+#include "ripeMD.h"
+
+/** Most messages that can be hashed side by side, with AVX-512. */
+#define MAX_LANES 16
+
+/** Fewest messages hashed side by side, with SSE2 or plain C. */
+#define MIN_LANES 4
+
+/** One message to be hashed along with others. */
+typedef struct
+{
+  /** Bytes of the message. */
+  const byte *data;
+
+  /** Number of bytes in the message. */
+  size_t len;
+
+  /** Storage for the message's hash value, DIGEST_BYTES long. */
+  byte *digest;
+} HashJob;
+
+/**
+  Limit the number of lanes used to hash messages side by side.  The
+  widest kernel the CPU supports within that limit is used from then on,
+  but never fewer than MIN_LANES.
+  @param lanes the most lanes to use, or MAX_LANES for no limit.
+  @return the number of lanes that will actually be used.
+*/
+int setLaneLimit(int lanes);
+
+/**
+  Hash every message in the given list, storing each one's hash value
+  in its digest field.  Each lane starts on the next message as soon as
+  it's done with the one before, so messages of different lengths keep
+  the lanes busy.
+  @param jobs the list of messages to hash.
+  @param n number of messages in the list.
+*/
+void hashJobs(HashJob *jobs, size_t n);
+
+/**
+  Hash a list of messages that are each given by a pointer and a length,
+  storing their hash values in the same order.  This is meant for lots
+  of short messages.  Nothing is allocated, the padding is done in
+  scratch space, and messages that take the same number of blocks are
+  hashed side by side, so their lanes finish together.
+  @param ptrs the start of each message.
+  @param lens the number of bytes in each message.
+  @param n number of messages.
+  @param out storage for each message's hash value.
+*/
+void ripemdBatch(const void **ptrs, const size_t *lens, size_t n,
+                 uint8_t (*out)[DIGEST_BYTES]);
+
+#endif
@@ -11,6 +11,8 @@
 */
 
 #include "ripeMD.h"
+#include "ripeSteps.h"
+#include <string.h>
 
 void initState(HashState *state)
 {
@@ -126,8 +128,10 @@ void padBuffer(ByteBuffer *buffer)
   unsigned long originalLen = BBITS * buffer->len;
   byte current;
   int space = BLOCK_BYTES - (buffer->len % BLOCK_BYTES);
-  if (space == COUNT_START) {
-    space = BLOCK_BYTES;
+  // If there's no room for the padding byte and the length, they go
+  // in another block.
+  if (space < PAD_NOT_ZERO) {
+    space += BLOCK_BYTES;
   }
   space = space - PAD_NOT_ZERO;
   addByte(buffer, padStart);
@@ -188,65 +192,22 @@ static void hashRound(HashState *state, longword data[BLOCK_LONGWORDS], int perm
 
 void hashBlock(HashState *state, byte block[BLOCK_BYTES])
 {
-
-  HashState left;
-  HashState right;
-  left.A = state->A;
-  right.A = state->A;
-  left.B = state->B;
-  right.B = state->B;
-  left.C = state->C;
-  right.C = state->C;
-  left.D = state->D;
-  right.D = state->D;
-  left.E = state->E;
-  right.E = state->E;
-
-  int leftPerm[RIPE_ROUNDS][RIPE_ITERATIONS] = {
-    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
-    {7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8},
-    {3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12},
-    {1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2},
-    {4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13}};
-
-  int rightPerm[RIPE_ROUNDS][RIPE_ITERATIONS] = {
-    {5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12},
-    {6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2},
-    {15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13},
-    {8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14},
-    {12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11}};
-
-  int leftShift[RIPE_ROUNDS][RIPE_ITERATIONS] = {
-    {11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8},
-    {7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12},
-    {11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5},
-    {11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12},
-    {9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6}};
-
-  int rightShift[RIPE_ROUNDS][RIPE_ITERATIONS] = {
-    {8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6},
-    {9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11},
-    {9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5},
-    {15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8},
-    {8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11}};
-
-  longword leftNoise[RIPE_ROUNDS] = {0x00000000, 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xA953FD4E};
-
-  longword rightNoise[RIPE_ROUNDS] = {0x50A28BE6, 0x5C4DD124, 0x6D703EF3, 0x7A6D76E9, 0x00000000};
-
-  BitwiseFunction leftFunc[RIPE_ROUNDS] = {&bitwiseF0, &bitwiseF1, &bitwiseF2, &bitwiseF3, &bitwiseF4};
-  BitwiseFunction rightFunc[RIPE_ROUNDS] = {&bitwiseF4, &bitwiseF3, &bitwiseF2, &bitwiseF1, &bitwiseF0};
-
-  for (int k = COUNT_START; k < RIPE_ROUNDS; k++) {
-    hashRound(&left, (longword *)block, leftPerm[k], leftShift[k], leftNoise[k], leftFunc[k]);
-    hashRound(&right, (longword *)block, rightPerm[k], rightShift[k], rightNoise[k], rightFunc[k]);
+  longword x[BLOCK_LONGWORDS];
+  for (int i = COUNT_START; i < BLOCK_LONGWORDS; i++) {
+    x[i] = loadLittle(block + i * LONGWORD_BYTE);
   }
 
-  longword resultA = left.C + state->B + right.D;
-  longword resultB = left.D + state->C + right.E;
-  longword resultC = left.E + state->D + right.A;
-  longword resultD = left.A + state->E + right.B;
-  longword resultE = left.B + state->A + right.C;
+  longword al = state->A, bl = state->B, cl = state->C, dl = state->D, el = state->E;
+  longword ar = state->A, br = state->B, cr = state->C, dr = state->D, er = state->E;
+
+  RIPE_STEPS
+
+  // After 80 steps, each line's values are back under their own names.
+  longword resultA = cl + state->B + dr;
+  longword resultB = dl + state->C + er;
+  longword resultC = el + state->D + ar;
+  longword resultD = al + state->E + br;
+  longword resultE = bl + state->A + cr;
 
   state->A = resultA;
   state->B = resultB;
@@ -255,6 +216,155 @@ void hashBlock(HashState *state, byte block[BLOCK_BYTES])
   state->E = resultE;
 }
 
+void ripemdInit(RipemdContext *ctx)
+{
+  initState(&ctx->state);
+  ctx->len = COUNT_START;
+}
+
+void ripemdUpdate(RipemdContext *ctx, const void *ptr, size_t len)
+{
+  const byte *data = (const byte *)ptr;
+  size_t used = ctx->len % BLOCK_BYTES;
+  ctx->len += len;
+
+  // Finish off the partial block first, if there is one.
+  if (used > COUNT_START) {
+    size_t take = BLOCK_BYTES - used;
+    if (take > len) {
+      take = len;
+    }
+    memcpy(ctx->partial + used, data, take);
+    data += take;
+    len -= take;
+    if (used + take < BLOCK_BYTES) {
+      return;
+    }
+    hashBlock(&ctx->state, ctx->partial);
+  }
+
+  // Hash whole blocks right from the caller's memory.
+  while (len >= BLOCK_BYTES) {
+    hashBlock(&ctx->state, (byte *)data);
+    data += BLOCK_BYTES;
+    len -= BLOCK_BYTES;
+  }
+
+  // Keep whatever's left for next time.
+  memcpy(ctx->partial, data, len);
+}
+
+void ripemdFinal(RipemdContext *ctx, byte digest[DIGEST_BYTES])
+{
+  uint64_t bits = ctx->len * BBITS;
+  size_t used = ctx->len % BLOCK_BYTES;
+
+  // Padding starts with one bit, then zeros up to the last 8 bytes of
+  // a block.  If there's no room for the length, it takes another block.
+  ctx->partial[used++] = PAD_START;
+  if (used > BLOCK_BYTES - LONG_BYTE) {
+    memset(ctx->partial + used, PAD_ZERO, BLOCK_BYTES - used);
+    hashBlock(&ctx->state, ctx->partial);
+    used = COUNT_START;
+  }
+  memset(ctx->partial + used, PAD_ZERO, BLOCK_BYTES - LONG_BYTE - used);
+
+  // Then the message length in bits, least significant byte first.
+  for (int j = COUNT_START; j < LONG_BYTE; j++) {
+    ctx->partial[BLOCK_BYTES - LONG_BYTE + j] = (bits >> j * BBITS) & LONG_BYTE_MASK;
+  }
+  hashBlock(&ctx->state, ctx->partial);
+  storeDigest(&ctx->state, digest);
+}
+
+/**
+  Store a number in the given bytes, least significant byte first.
+  @param value the number to store.
+  @param count number of bytes to store it in.
+  @param dest storage for the bytes.
+*/
+static void storeLittle(uint64_t value, int count, byte *dest)
+{
+  for (int j = COUNT_START; j < count; j++) {
+    dest[j] = (value >> j * BBITS) & RIGHT_BYTE_MASK;
+  }
+}
+
+/**
+  Get a number that's stored least significant byte first.
+  @param src the bytes to read.
+  @param count number of bytes in the number.
+  @return the number.
+*/
+static uint64_t fetchLittle(const byte *src, int count)
+{
+  uint64_t value = COUNT_START;
+  for (int j = count - 1; j >= COUNT_START; j--) {
+    value = value << BBITS | src[j];
+  }
+  return value;
+}
+
+void ripemdSave(const RipemdContext *ctx, byte saved[STATE_BYTES])
+{
+  memcpy(saved, STATE_MAGIC, STATE_MAGIC_BYTES);
+  storeDigest(&ctx->state, saved + STATE_MAGIC_BYTES);
+  storeLittle(ctx->len, LONG_BYTE, saved + STATE_MAGIC_BYTES + DIGEST_BYTES);
+
+  // Only the bytes of the partial block that are in use mean anything,
+  // so the rest are saved as zeros.
+  byte *partial = saved + STATE_MAGIC_BYTES + DIGEST_BYTES + LONG_BYTE;
+  size_t used = ctx->len % BLOCK_BYTES;
+  memcpy(partial, ctx->partial, used);
+  memset(partial + used, PAD_ZERO, BLOCK_BYTES - used);
+}
+
+bool ripemdLoad(RipemdContext *ctx, const byte saved[STATE_BYTES])
+{
+  if (memcmp(saved, STATE_MAGIC, STATE_MAGIC_BYTES) != 0) {
+    return false;
+  }
+
+  const byte *words = saved + STATE_MAGIC_BYTES;
+  ctx->state.A = fetchLittle(words, LONGWORD_BYTE);
+  ctx->state.B = fetchLittle(words + LONGWORD_BYTE, LONGWORD_BYTE);
+  ctx->state.C = fetchLittle(words + 2 * LONGWORD_BYTE, LONGWORD_BYTE);
+  ctx->state.D = fetchLittle(words + 3 * LONGWORD_BYTE, LONGWORD_BYTE);
+  ctx->state.E = fetchLittle(words + 4 * LONGWORD_BYTE, LONGWORD_BYTE);
+  ctx->len = fetchLittle(saved + STATE_MAGIC_BYTES + DIGEST_BYTES, LONG_BYTE);
+  memcpy(ctx->partial, saved + STATE_MAGIC_BYTES + DIGEST_BYTES + LONG_BYTE,
+         BLOCK_BYTES);
+  return true;
+}
+
+void storeDigest(const HashState *state, byte digest[DIGEST_BYTES])
+{
+  // Store the five state words, least significant byte first.
+  longword words[] = {state->A, state->B, state->C, state->D, state->E};
+  for (int i = COUNT_START; i < DIGEST_BYTES / LONGWORD_BYTE; i++) {
+    for (int j = COUNT_START; j < LONGWORD_BYTE; j++) {
+      digest[i * LONGWORD_BYTE + j] = (words[i] >> j * BBITS) & RIGHT_BYTE_MASK;
+    }
+  }
+}
+
+void formatDigest(const byte digest[DIGEST_BYTES], char hex[DIGEST_HEX + 1])
+{
+  static const char digits[] = "0123456789abcdef";
+  for (int i = COUNT_START; i < DIGEST_BYTES; i++) {
+    hex[2 * i] = digits[digest[i] >> HEX_BITS];
+    hex[2 * i + 1] = digits[digest[i] & HEX_MASK];
+  }
+  hex[DIGEST_HEX] = '\0';
+}
+
+void printDigest(const byte digest[DIGEST_BYTES])
+{
+  char hex[DIGEST_HEX + 1];
+  formatDigest(digest, hex);
+  printf("%s\n", hex);
+}
+
 void printHash(HashState *state)
 {
   longword mask = RIGHT_BYTE_MASK;
@@ -14,6 +14,9 @@
 #ifndef _RIPEMD_H_
 #define _RIPEMD_H_
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "byteBuffer.h"
 
 /** Name for an unsigned 32-bit integer. */
@@ -64,6 +67,28 @@ typedef unsigned int longword;
 /** Number of bytes in an longword */
 #define LONGWORD_BYTE 4
 
+/** Number of bytes in a finished hash value, five longwords. */
+#define DIGEST_BYTES 20
+
+/** Number of hexadecimal digits in a finished hash value. */
+#define DIGEST_HEX (2 * DIGEST_BYTES)
+
+/** Number of bits in one hexadecimal digit. */
+#define HEX_BITS 4
+
+/** Mask for the low hexadecimal digit of a byte. */
+#define HEX_MASK 0x0F
+
+/** Bytes at the start of a saved context. */
+#define STATE_MAGIC "RMD160S1"
+
+/** Number of bytes in STATE_MAGIC, not counting its null terminator. */
+#define STATE_MAGIC_BYTES 8
+
+/** Number of bytes in a saved context: the magic bytes, the five state
+    longwords, the message length and the partial block. */
+#define STATE_BYTES (STATE_MAGIC_BYTES + DIGEST_BYTES + LONG_BYTE + BLOCK_BYTES)
+
 
 
 /** Type for a pointer to the bitwise f function used in each round. */
@@ -92,6 +117,24 @@ typedef struct
 
 } HashState;
 
+/** Context for hashing a message that's given a piece at a time, so
+    the whole message never has to be in memory.  It holds the state
+    for all the complete blocks so far, the bytes of the block that
+    isn't complete yet, and the total length of the message.  Client
+    code can create an instance anywhere, but ripemdInit() needs to
+    initialize it before it can be used. */
+typedef struct
+{
+  /** State after all the complete blocks seen so far. */
+  HashState state;
+
+  /** Bytes of the current block that isn't complete yet. */
+  byte partial[BLOCK_BYTES];
+
+  /** Total number of bytes in the message so far. */
+  uint64_t len;
+} RipemdContext;
+
 /**
   Initialize the fields of an HashState instance with five constant values
   for the RIPEMD algorithm.
@@ -106,6 +149,73 @@ void initState(HashState *state);
 */
 void padBuffer(ByteBuffer *buffer);
 
+/**
+  Start hashing a new message.
+  @param ctx the context to initialize.
+*/
+void ripemdInit(RipemdContext *ctx);
+
+/**
+  Add more bytes to the end of the message being hashed.  Every block
+  that's complete gets hashed right away, and the rest are kept in the
+  context until more bytes arrive.
+  @param ctx the context for the message.
+  @param ptr the bytes to add.
+  @param len number of bytes to add.
+*/
+void ripemdUpdate(RipemdContext *ctx, const void *ptr, size_t len);
+
+/**
+  Finish hashing a message.  The padding is added here, then the final
+  hash value is stored as 20 bytes, in the same order printHash() would
+  print them.  The context has to be initialized again before it's used
+  for another message.
+  @param ctx the context for the message.
+  @param digest storage for the final hash value.
+*/
+void ripemdFinal(RipemdContext *ctx, byte digest[DIGEST_BYTES]);
+
+/**
+  Save a context that's part way through a message, so hashing can pick
+  up where it left off later, even in another process or on another
+  machine.  Numbers are saved least significant byte first.
+  @param ctx the context to save.  It's not changed.
+  @param saved storage for the saved context.
+*/
+void ripemdSave(const RipemdContext *ctx, byte saved[STATE_BYTES]);
+
+/**
+  Load a context that was saved with ripemdSave(), so more bytes can be
+  added to the message.
+  @param ctx the context to fill in.
+  @param saved the saved context.
+  @return true if it was a saved context, false if it doesn't look like
+  one, in which case ctx isn't changed.
+*/
+bool ripemdLoad(RipemdContext *ctx, const byte saved[STATE_BYTES]);
+
+/**
+  Store the hash value in the given state as 20 bytes, in the same order
+  printHash() would print them.
+  @param state the HashState which contains the final hash values.
+  @param digest storage for the hash value.
+*/
+void storeDigest(const HashState *state, byte digest[DIGEST_BYTES]);
+
+/**
+  Write a finished hash value as a 160 bit number in hexadecimal, the
+  same way printDigest() prints it.
+  @param digest the hash value from ripemdFinal().
+  @param hex storage for the digits, and a null terminator.
+*/
+void formatDigest(const byte digest[DIGEST_BYTES], char hex[DIGEST_HEX + 1]);
+
+/**
+  Prints out a finished hash value as a 160 bit number in hexadecimal.
+  @param digest the hash value from ripemdFinal().
+*/
+void printDigest(const byte digest[DIGEST_BYTES]);
+
 /**
   Prints out the final hash value stored in the given state as a 160 bit number 
   in hexadecimal.
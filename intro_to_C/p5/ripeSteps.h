@@ -0,0 +1,247 @@
+/**
+  @file ripeSteps.h
+  @author Maggie Lin (mclin)
+  This file contains the macros for the fully unrolled RIPEMD compression
+  function.  They're written with operators only, so the same steps work
+  on a longword, or on a vector with one message in each lane.  The code
+  that uses RIPE_STEPS needs to declare the message words, x, and the
+  state values for each line, al through el and ar through er.
+*/
+
+#ifndef _RIPE_STEPS_H_
+#define _RIPE_STEPS_H_
+
+#include "ripeMD.h"
+
+/** Rotate a longword left by a constant number of bits. */
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/** Bitwise function for the first round of the left line. */
+#define F0(x, y, z) ((x) ^ (y) ^ (z))
+
+/** Bitwise function for the second round of the left line. */
+#define F1(x, y, z) (((x) & (y)) | (~(x) & (z)))
+
+/** Bitwise function for the third round of either line. */
+#define F2(x, y, z) (((x) | ~(y)) ^ (z))
+
+/** Bitwise function for the fourth round of the left line. */
+#define F3(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+
+/** Bitwise function for the fifth round of the left line. */
+#define F4(x, y, z) ((x) ^ ((y) | ~(z)))
+
+/** Noise values for each round of the left line. */
+#define LEFT_NOISE_0 0x00000000
+#define LEFT_NOISE_1 0x5A827999
+#define LEFT_NOISE_2 0x6ED9EBA1
+#define LEFT_NOISE_3 0x8F1BBCDC
+#define LEFT_NOISE_4 0xA953FD4E
+
+/** Noise values for each round of the right line. */
+#define RIGHT_NOISE_0 0x50A28BE6
+#define RIGHT_NOISE_1 0x5C4DD124
+#define RIGHT_NOISE_2 0x6D703EF3
+#define RIGHT_NOISE_3 0x7A6D76E9
+#define RIGHT_NOISE_4 0x00000000
+
+/** One step of the hash, the same as hashIteration(), but with the
+    state values given in the order they have at this step. */
+#define STEP(f, a, b, c, d, e, x, s, k) {    \
+    a += f(b, c, d) + (x) + (k);             \
+    a = ROTL(a, s) + e;                      \
+    c = ROTL(c, HASH_SHIFT);                 \
+  }
+
+/** All 160 steps of the compression function, 80 for each line.  Every
+    step's message word, rotate amount and bitwise function are
+    constants, and the five state values of each line are renamed from
+    one step to the next instead of being moved, so they can all stay in
+    registers.  After the last step, each value is back under its own
+    name. */
+#define RIPE_STEPS                                                      \
+  /* Left line, round 1 */                                 \
+  STEP(F0, al, bl, cl, dl, el, x[0], 11, LEFT_NOISE_0);    \
+  STEP(F0, el, al, bl, cl, dl, x[1], 14, LEFT_NOISE_0);    \
+  STEP(F0, dl, el, al, bl, cl, x[2], 15, LEFT_NOISE_0);    \
+  STEP(F0, cl, dl, el, al, bl, x[3], 12, LEFT_NOISE_0);    \
+  STEP(F0, bl, cl, dl, el, al, x[4], 5, LEFT_NOISE_0);     \
+  STEP(F0, al, bl, cl, dl, el, x[5], 8, LEFT_NOISE_0);     \
+  STEP(F0, el, al, bl, cl, dl, x[6], 7, LEFT_NOISE_0);     \
+  STEP(F0, dl, el, al, bl, cl, x[7], 9, LEFT_NOISE_0);     \
+  STEP(F0, cl, dl, el, al, bl, x[8], 11, LEFT_NOISE_0);    \
+  STEP(F0, bl, cl, dl, el, al, x[9], 13, LEFT_NOISE_0);    \
+  STEP(F0, al, bl, cl, dl, el, x[10], 14, LEFT_NOISE_0);   \
+  STEP(F0, el, al, bl, cl, dl, x[11], 15, LEFT_NOISE_0);   \
+  STEP(F0, dl, el, al, bl, cl, x[12], 6, LEFT_NOISE_0);    \
+  STEP(F0, cl, dl, el, al, bl, x[13], 7, LEFT_NOISE_0);    \
+  STEP(F0, bl, cl, dl, el, al, x[14], 9, LEFT_NOISE_0);    \
+  STEP(F0, al, bl, cl, dl, el, x[15], 8, LEFT_NOISE_0);    \
+  /* Left line, round 2 */                                 \
+  STEP(F1, el, al, bl, cl, dl, x[7], 7, LEFT_NOISE_1);     \
+  STEP(F1, dl, el, al, bl, cl, x[4], 6, LEFT_NOISE_1);     \
+  STEP(F1, cl, dl, el, al, bl, x[13], 8, LEFT_NOISE_1);    \
+  STEP(F1, bl, cl, dl, el, al, x[1], 13, LEFT_NOISE_1);    \
+  STEP(F1, al, bl, cl, dl, el, x[10], 11, LEFT_NOISE_1);   \
+  STEP(F1, el, al, bl, cl, dl, x[6], 9, LEFT_NOISE_1);     \
+  STEP(F1, dl, el, al, bl, cl, x[15], 7, LEFT_NOISE_1);    \
+  STEP(F1, cl, dl, el, al, bl, x[3], 15, LEFT_NOISE_1);    \
+  STEP(F1, bl, cl, dl, el, al, x[12], 7, LEFT_NOISE_1);    \
+  STEP(F1, al, bl, cl, dl, el, x[0], 12, LEFT_NOISE_1);    \
+  STEP(F1, el, al, bl, cl, dl, x[9], 15, LEFT_NOISE_1);    \
+  STEP(F1, dl, el, al, bl, cl, x[5], 9, LEFT_NOISE_1);     \
+  STEP(F1, cl, dl, el, al, bl, x[2], 11, LEFT_NOISE_1);    \
+  STEP(F1, bl, cl, dl, el, al, x[14], 7, LEFT_NOISE_1);    \
+  STEP(F1, al, bl, cl, dl, el, x[11], 13, LEFT_NOISE_1);   \
+  STEP(F1, el, al, bl, cl, dl, x[8], 12, LEFT_NOISE_1);    \
+  /* Left line, round 3 */                                 \
+  STEP(F2, dl, el, al, bl, cl, x[3], 11, LEFT_NOISE_2);    \
+  STEP(F2, cl, dl, el, al, bl, x[10], 13, LEFT_NOISE_2);   \
+  STEP(F2, bl, cl, dl, el, al, x[14], 6, LEFT_NOISE_2);    \
+  STEP(F2, al, bl, cl, dl, el, x[4], 7, LEFT_NOISE_2);     \
+  STEP(F2, el, al, bl, cl, dl, x[9], 14, LEFT_NOISE_2);    \
+  STEP(F2, dl, el, al, bl, cl, x[15], 9, LEFT_NOISE_2);    \
+  STEP(F2, cl, dl, el, al, bl, x[8], 13, LEFT_NOISE_2);    \
+  STEP(F2, bl, cl, dl, el, al, x[1], 15, LEFT_NOISE_2);    \
+  STEP(F2, al, bl, cl, dl, el, x[2], 14, LEFT_NOISE_2);    \
+  STEP(F2, el, al, bl, cl, dl, x[7], 8, LEFT_NOISE_2);     \
+  STEP(F2, dl, el, al, bl, cl, x[0], 13, LEFT_NOISE_2);    \
+  STEP(F2, cl, dl, el, al, bl, x[6], 6, LEFT_NOISE_2);     \
+  STEP(F2, bl, cl, dl, el, al, x[13], 5, LEFT_NOISE_2);    \
+  STEP(F2, al, bl, cl, dl, el, x[11], 12, LEFT_NOISE_2);   \
+  STEP(F2, el, al, bl, cl, dl, x[5], 7, LEFT_NOISE_2);     \
+  STEP(F2, dl, el, al, bl, cl, x[12], 5, LEFT_NOISE_2);    \
+  /* Left line, round 4 */                                 \
+  STEP(F3, cl, dl, el, al, bl, x[1], 11, LEFT_NOISE_3);    \
+  STEP(F3, bl, cl, dl, el, al, x[9], 12, LEFT_NOISE_3);    \
+  STEP(F3, al, bl, cl, dl, el, x[11], 14, LEFT_NOISE_3);   \
+  STEP(F3, el, al, bl, cl, dl, x[10], 15, LEFT_NOISE_3);   \
+  STEP(F3, dl, el, al, bl, cl, x[0], 14, LEFT_NOISE_3);    \
+  STEP(F3, cl, dl, el, al, bl, x[8], 15, LEFT_NOISE_3);    \
+  STEP(F3, bl, cl, dl, el, al, x[12], 9, LEFT_NOISE_3);    \
+  STEP(F3, al, bl, cl, dl, el, x[4], 8, LEFT_NOISE_3);     \
+  STEP(F3, el, al, bl, cl, dl, x[13], 9, LEFT_NOISE_3);    \
+  STEP(F3, dl, el, al, bl, cl, x[3], 14, LEFT_NOISE_3);    \
+  STEP(F3, cl, dl, el, al, bl, x[7], 5, LEFT_NOISE_3);     \
+  STEP(F3, bl, cl, dl, el, al, x[15], 6, LEFT_NOISE_3);    \
+  STEP(F3, al, bl, cl, dl, el, x[14], 8, LEFT_NOISE_3);    \
+  STEP(F3, el, al, bl, cl, dl, x[5], 6, LEFT_NOISE_3);     \
+  STEP(F3, dl, el, al, bl, cl, x[6], 5, LEFT_NOISE_3);     \
+  STEP(F3, cl, dl, el, al, bl, x[2], 12, LEFT_NOISE_3);    \
+  /* Left line, round 5 */                                 \
+  STEP(F4, bl, cl, dl, el, al, x[4], 9, LEFT_NOISE_4);     \
+  STEP(F4, al, bl, cl, dl, el, x[0], 15, LEFT_NOISE_4);    \
+  STEP(F4, el, al, bl, cl, dl, x[5], 5, LEFT_NOISE_4);     \
+  STEP(F4, dl, el, al, bl, cl, x[9], 11, LEFT_NOISE_4);    \
+  STEP(F4, cl, dl, el, al, bl, x[7], 6, LEFT_NOISE_4);     \
+  STEP(F4, bl, cl, dl, el, al, x[12], 8, LEFT_NOISE_4);    \
+  STEP(F4, al, bl, cl, dl, el, x[2], 13, LEFT_NOISE_4);    \
+  STEP(F4, el, al, bl, cl, dl, x[10], 12, LEFT_NOISE_4);   \
+  STEP(F4, dl, el, al, bl, cl, x[14], 5, LEFT_NOISE_4);    \
+  STEP(F4, cl, dl, el, al, bl, x[1], 12, LEFT_NOISE_4);    \
+  STEP(F4, bl, cl, dl, el, al, x[3], 13, LEFT_NOISE_4);    \
+  STEP(F4, al, bl, cl, dl, el, x[8], 14, LEFT_NOISE_4);    \
+  STEP(F4, el, al, bl, cl, dl, x[11], 11, LEFT_NOISE_4);   \
+  STEP(F4, dl, el, al, bl, cl, x[6], 8, LEFT_NOISE_4);     \
+  STEP(F4, cl, dl, el, al, bl, x[15], 5, LEFT_NOISE_4);    \
+  STEP(F4, bl, cl, dl, el, al, x[13], 6, LEFT_NOISE_4);    \
+                                                           \
+  /* Right line, round 1 */                                \
+  STEP(F4, ar, br, cr, dr, er, x[5], 8, RIGHT_NOISE_0);    \
+  STEP(F4, er, ar, br, cr, dr, x[14], 9, RIGHT_NOISE_0);   \
+  STEP(F4, dr, er, ar, br, cr, x[7], 9, RIGHT_NOISE_0);    \
+  STEP(F4, cr, dr, er, ar, br, x[0], 11, RIGHT_NOISE_0);   \
+  STEP(F4, br, cr, dr, er, ar, x[9], 13, RIGHT_NOISE_0);   \
+  STEP(F4, ar, br, cr, dr, er, x[2], 15, RIGHT_NOISE_0);   \
+  STEP(F4, er, ar, br, cr, dr, x[11], 15, RIGHT_NOISE_0);  \
+  STEP(F4, dr, er, ar, br, cr, x[4], 5, RIGHT_NOISE_0);    \
+  STEP(F4, cr, dr, er, ar, br, x[13], 7, RIGHT_NOISE_0);   \
+  STEP(F4, br, cr, dr, er, ar, x[6], 7, RIGHT_NOISE_0);    \
+  STEP(F4, ar, br, cr, dr, er, x[15], 8, RIGHT_NOISE_0);   \
+  STEP(F4, er, ar, br, cr, dr, x[8], 11, RIGHT_NOISE_0);   \
+  STEP(F4, dr, er, ar, br, cr, x[1], 14, RIGHT_NOISE_0);   \
+  STEP(F4, cr, dr, er, ar, br, x[10], 14, RIGHT_NOISE_0);  \
+  STEP(F4, br, cr, dr, er, ar, x[3], 12, RIGHT_NOISE_0);   \
+  STEP(F4, ar, br, cr, dr, er, x[12], 6, RIGHT_NOISE_0);   \
+  /* Right line, round 2 */                                \
+  STEP(F3, er, ar, br, cr, dr, x[6], 9, RIGHT_NOISE_1);    \
+  STEP(F3, dr, er, ar, br, cr, x[11], 13, RIGHT_NOISE_1);  \
+  STEP(F3, cr, dr, er, ar, br, x[3], 15, RIGHT_NOISE_1);   \
+  STEP(F3, br, cr, dr, er, ar, x[7], 7, RIGHT_NOISE_1);    \
+  STEP(F3, ar, br, cr, dr, er, x[0], 12, RIGHT_NOISE_1);   \
+  STEP(F3, er, ar, br, cr, dr, x[13], 8, RIGHT_NOISE_1);   \
+  STEP(F3, dr, er, ar, br, cr, x[5], 9, RIGHT_NOISE_1);    \
+  STEP(F3, cr, dr, er, ar, br, x[10], 11, RIGHT_NOISE_1);  \
+  STEP(F3, br, cr, dr, er, ar, x[14], 7, RIGHT_NOISE_1);   \
+  STEP(F3, ar, br, cr, dr, er, x[15], 7, RIGHT_NOISE_1);   \
+  STEP(F3, er, ar, br, cr, dr, x[8], 12, RIGHT_NOISE_1);   \
+  STEP(F3, dr, er, ar, br, cr, x[12], 7, RIGHT_NOISE_1);   \
+  STEP(F3, cr, dr, er, ar, br, x[4], 6, RIGHT_NOISE_1);    \
+  STEP(F3, br, cr, dr, er, ar, x[9], 15, RIGHT_NOISE_1);   \
+  STEP(F3, ar, br, cr, dr, er, x[1], 13, RIGHT_NOISE_1);   \
+  STEP(F3, er, ar, br, cr, dr, x[2], 11, RIGHT_NOISE_1);   \
+  /* Right line, round 3 */                                \
+  STEP(F2, dr, er, ar, br, cr, x[15], 9, RIGHT_NOISE_2);   \
+  STEP(F2, cr, dr, er, ar, br, x[5], 7, RIGHT_NOISE_2);    \
+  STEP(F2, br, cr, dr, er, ar, x[1], 15, RIGHT_NOISE_2);   \
+  STEP(F2, ar, br, cr, dr, er, x[3], 11, RIGHT_NOISE_2);   \
+  STEP(F2, er, ar, br, cr, dr, x[7], 8, RIGHT_NOISE_2);    \
+  STEP(F2, dr, er, ar, br, cr, x[14], 6, RIGHT_NOISE_2);   \
+  STEP(F2, cr, dr, er, ar, br, x[6], 6, RIGHT_NOISE_2);    \
+  STEP(F2, br, cr, dr, er, ar, x[9], 14, RIGHT_NOISE_2);   \
+  STEP(F2, ar, br, cr, dr, er, x[11], 12, RIGHT_NOISE_2);  \
+  STEP(F2, er, ar, br, cr, dr, x[8], 13, RIGHT_NOISE_2);   \
+  STEP(F2, dr, er, ar, br, cr, x[12], 5, RIGHT_NOISE_2);   \
+  STEP(F2, cr, dr, er, ar, br, x[2], 14, RIGHT_NOISE_2);   \
+  STEP(F2, br, cr, dr, er, ar, x[10], 13, RIGHT_NOISE_2);  \
+  STEP(F2, ar, br, cr, dr, er, x[0], 13, RIGHT_NOISE_2);   \
+  STEP(F2, er, ar, br, cr, dr, x[4], 7, RIGHT_NOISE_2);    \
+  STEP(F2, dr, er, ar, br, cr, x[13], 5, RIGHT_NOISE_2);   \
+  /* Right line, round 4 */                                \
+  STEP(F1, cr, dr, er, ar, br, x[8], 15, RIGHT_NOISE_3);   \
+  STEP(F1, br, cr, dr, er, ar, x[6], 5, RIGHT_NOISE_3);    \
+  STEP(F1, ar, br, cr, dr, er, x[4], 8, RIGHT_NOISE_3);    \
+  STEP(F1, er, ar, br, cr, dr, x[1], 11, RIGHT_NOISE_3);   \
+  STEP(F1, dr, er, ar, br, cr, x[3], 14, RIGHT_NOISE_3);   \
+  STEP(F1, cr, dr, er, ar, br, x[11], 14, RIGHT_NOISE_3);  \
+  STEP(F1, br, cr, dr, er, ar, x[15], 6, RIGHT_NOISE_3);   \
+  STEP(F1, ar, br, cr, dr, er, x[0], 14, RIGHT_NOISE_3);   \
+  STEP(F1, er, ar, br, cr, dr, x[5], 6, RIGHT_NOISE_3);    \
+  STEP(F1, dr, er, ar, br, cr, x[12], 9, RIGHT_NOISE_3);   \
+  STEP(F1, cr, dr, er, ar, br, x[2], 12, RIGHT_NOISE_3);   \
+  STEP(F1, br, cr, dr, er, ar, x[13], 9, RIGHT_NOISE_3);   \
+  STEP(F1, ar, br, cr, dr, er, x[9], 12, RIGHT_NOISE_3);   \
+  STEP(F1, er, ar, br, cr, dr, x[7], 5, RIGHT_NOISE_3);    \
+  STEP(F1, dr, er, ar, br, cr, x[10], 15, RIGHT_NOISE_3);  \
+  STEP(F1, cr, dr, er, ar, br, x[14], 8, RIGHT_NOISE_3);   \
+  /* Right line, round 5 */                                \
+  STEP(F0, br, cr, dr, er, ar, x[12], 8, RIGHT_NOISE_4);   \
+  STEP(F0, ar, br, cr, dr, er, x[15], 5, RIGHT_NOISE_4);   \
+  STEP(F0, er, ar, br, cr, dr, x[10], 12, RIGHT_NOISE_4);  \
+  STEP(F0, dr, er, ar, br, cr, x[4], 9, RIGHT_NOISE_4);    \
+  STEP(F0, cr, dr, er, ar, br, x[1], 12, RIGHT_NOISE_4);   \
+  STEP(F0, br, cr, dr, er, ar, x[5], 5, RIGHT_NOISE_4);    \
+  STEP(F0, ar, br, cr, dr, er, x[8], 14, RIGHT_NOISE_4);   \
+  STEP(F0, er, ar, br, cr, dr, x[7], 6, RIGHT_NOISE_4);    \
+  STEP(F0, dr, er, ar, br, cr, x[6], 8, RIGHT_NOISE_4);    \
+  STEP(F0, cr, dr, er, ar, br, x[2], 13, RIGHT_NOISE_4);   \
+  STEP(F0, br, cr, dr, er, ar, x[13], 6, RIGHT_NOISE_4);   \
+  STEP(F0, ar, br, cr, dr, er, x[14], 5, RIGHT_NOISE_4);   \
+  STEP(F0, er, ar, br, cr, dr, x[0], 15, RIGHT_NOISE_4);   \
+  STEP(F0, dr, er, ar, br, cr, x[3], 13, RIGHT_NOISE_4);   \
+  STEP(F0, cr, dr, er, ar, br, x[9], 11, RIGHT_NOISE_4);   \
+  STEP(F0, br, cr, dr, er, ar, x[11], 11, RIGHT_NOISE_4);
+
+/**
+  Read a longword stored least significant byte first, whatever the
+  byte order and alignment requirements of this machine.
+  @param p the four bytes to read.
+  @return the longword they hold.
+*/
+static inline longword loadLittle(const byte *p)
+{
+  return (longword)p[0] | (longword)p[1] << BBITS |
+    (longword)p[2] << (2 * BBITS) | (longword)p[3] << (3 * BBITS);
+}
+
+#endif
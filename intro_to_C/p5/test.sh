@@ -118,6 +118,9 @@ testHash() {
   return 0
 }
 
+# Keep the digest cache with the tests, instead of the user's own.
+export HASH_CACHE=cache-test.bin
+
 # Get a clean build of the project.
 make clean
 
@@ -162,6 +165,40 @@ if [ -x hash ]; then
     
     args=(bad-filename.txt)
     testHash 07 1
+
+    args=(-j 2 input-01.txt bad-filename.txt input-03.txt input-05.bin)
+    testHash 08 1
+
+    args=(-j 3 -r input-09)
+    testHash 09 0
+
+    args=(--verify-cache input-01.txt input-03.txt)
+    testHash 10 0
+
+    args=(--tree chunk=1K -j 2 input-04.txt input-05.bin)
+    testHash 11 0
+
+    # The first run hashes the whole file, and the second picks up from
+    # the end of it.
+    args=(--state-file state-test.bin input-04.txt)
+    testHash 12 0
+    testHash 13 0
+
+    # A chunk as big as the largest file offset is fine, but one past
+    # that is too big.
+    args=(--tree chunk=8589934591G input-04.txt)
+    testHash 14 0
+
+    args=(--tree chunk=18446744073709551615 input-04.txt)
+    testHash 15 1
+
+    # A state file saved for one file doesn't get used for another one,
+    # even when the other one is longer, like a log that's been rotated.
+    args=(--state-file state-test.bin input-01.txt)
+    testHash 16 0
+
+    args=(--state-file state-test.bin input-03.txt)
+    testHash 17 0
 else
     fail "Since your program didn't compile, we couldn't test it"
 fi
@@ -1,14 +1,25 @@
 /** 
     @file testdriver.c
     @author Dr. Strurgill 
-    This is a test driver for code in the byteBuffer and ripeMD components.
+    This is a test driver for code in the byteBuffer, ripeMD, multiHash,
+    digestCache, treeHash and hmacRipemd components.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "byteBuffer.h"
 #include "ripeMD.h"
+#include "multiHash.h"
+#include "digestCache.h"
+#include "treeHash.h"
+#include "hmacRipemd.h"
 
 /** Total number or tests we tried. */
 static int totalTests = 0;
@@ -17,7 +28,7 @@ static int totalTests = 0;
 static int passedTests = 0;
 
 /** Number of tests we should have, if they're all turned on. */
-#define EXPECTED_TOTAL 97
+#define EXPECTED_TOTAL 144
 
 /** Macro to check the condition on a test case, keep counts of
     passed/failed tests and report a message if the test fails. */
@@ -30,6 +41,26 @@ static int passedTests = 0;
   } \
 }
 
+/** Name of the FIFO the readFile() test reads from. */
+#define TEST_FIFO "testdriver-fifo"
+
+/**
+  Write the given bytes into the test FIFO, so readFile() has something
+  that isn't a regular file to read.
+  @param arg pointer to a ByteBuffer with the bytes to write.
+  @return NULL, always.
+*/
+static void *writeFifo( void *arg )
+{
+  ByteBuffer *src = arg;
+  FILE *fp = fopen( TEST_FIFO, "wb" );
+  if ( fp ) {
+    fwrite( src->data, 1, src->len, fp );
+    fclose( fp );
+  }
+  return NULL;
+}
+
 int main()
 {
   // As you finish parts of your implementation, move this directive
@@ -103,6 +134,37 @@ int main()
     freeBuffer( buffer );
   }
   
+  ////////////////////////////////////////////////////////////////////////
+  // Test appendBytes()
+  
+  {
+    ByteBuffer *buffer = createBuffer();
+
+    // This fits in the initial capacity.
+    appendBytes( buffer, "abc", 3 );
+    TestCase( buffer->len == 3 );
+    TestCase( buffer->cap == 5 );
+
+    // This needs the capacity doubled twice.
+    appendBytes( buffer, "0123456789", 10 );
+    TestCase( buffer->len == 13 );
+    TestCase( buffer->cap == 20 );
+
+    // And this needs two more doublings.
+    byte more[ 50 ];
+    for ( int i = 0; i < 50; i++ )
+      more[ i ] = 'A' + i % 26;
+    appendBytes( buffer, more, 50 );
+    TestCase( buffer->len == 63 );
+    TestCase( buffer->cap == 80 );
+
+    // Everything should still be there, in order.
+    TestCase( memcmp( buffer->data, "abc0123456789", 13 ) == 0 &&
+              memcmp( buffer->data + 13, more, 50 ) == 0 );
+
+    freeBuffer( buffer );
+  }
+  
   ////////////////////////////////////////////////////////////////////////
   // Test readFile()
   
@@ -150,11 +212,47 @@ int main()
     freeBuffer( buffer );
   }
   
+  {
+    // A regular file gets a buffer just big enough for it, and reading
+    // it all shouldn't make the buffer grow.
+    ByteBuffer *buffer = readFile( "input-05.bin" );
+    TestCase( buffer->len == 11328 );
+    TestCase( buffer->cap == 11328 );
+    
+    freeBuffer( buffer );
+  }
+  
   {
     // Try a file that doesn't exist.
     ByteBuffer *buffer = readFile( "no-input-file.txt" );
     TestCase( buffer == NULL );
   }
+
+  {
+    // Try input that isn't a regular file, so its size isn't known
+    // ahead of time.  It should still match the regular file.
+    ByteBuffer *expected = readFile( "input-03.txt" );
+    remove( TEST_FIFO );
+    bool made = mkfifo( TEST_FIFO, 0600 ) == 0;
+    TestCase( made );
+
+    ByteBuffer *buffer = NULL;
+    if ( made ) {
+      pthread_t writer;
+      pthread_create( &writer, NULL, writeFifo, expected );
+      buffer = readFile( TEST_FIFO );
+      pthread_join( writer, NULL );
+      remove( TEST_FIFO );
+    }
+
+    TestCase( buffer != NULL && buffer->len == 909 );
+    TestCase( buffer != NULL &&
+              memcmp( buffer->data, expected->data, 909 ) == 0 );
+
+    if ( buffer )
+      freeBuffer( buffer );
+    freeBuffer( expected );
+  }
  
   ////////////////////////////////////////////////////////////////////////
   // Tests for the ripeMD component
@@ -553,6 +651,376 @@ int main()
     TestCase( state.E == 0x639BEE89 );
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Test padBuffer() when there's no room left for the length
+  
+  {
+    ByteBuffer *buffer = createBuffer();
+    for ( int i = 0; i < 60; i++ )
+      addByte( buffer, 'x' );
+    padBuffer( buffer );
+
+    // The length has to go in another block.
+    TestCase( buffer->len == 128 );
+    freeBuffer( buffer );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the streaming functions, ripemdInit(), ripemdUpdate() and
+  // ripemdFinal()
+  
+  {
+    // The empty message.
+    RipemdContext ctx;
+    byte digest[ DIGEST_BYTES ];
+    ripemdInit( &ctx );
+    ripemdFinal( &ctx, digest );
+
+    byte expected[ DIGEST_BYTES ] =
+      { 0x9C, 0x11, 0x85, 0xA5, 0xC5, 0xE9, 0xFC, 0x54,
+        0x61, 0x28, 0x08, 0x97, 0x7E, 0xE8, 0xF5, 0x48,
+        0xB2, 0x25, 0x8D, 0x31 };
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+  }
+
+  {
+    // A short message, given all at once.
+    RipemdContext ctx;
+    byte digest[ DIGEST_BYTES ];
+    ripemdInit( &ctx );
+    ripemdUpdate( &ctx, "abc", 3 );
+    ripemdFinal( &ctx, digest );
+
+    byte expected[ DIGEST_BYTES ] =
+      { 0x8E, 0xB2, 0x08, 0xF7, 0xE0, 0x5D, 0x98, 0x7A,
+        0x9B, 0x04, 0x4A, 0x8E, 0x98, 0xC6, 0xB0, 0x87,
+        0xF1, 0x5A, 0x0B, 0xFC };
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+  }
+
+  {
+    // A 56-byte message, where the padding needs a second block.  Give
+    // it one byte at a time, then in uneven pieces.
+    char *str = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    byte expected[ DIGEST_BYTES ] =
+      { 0x12, 0xA0, 0x53, 0x38, 0x4A, 0x9C, 0x0C, 0x88,
+        0xE4, 0x05, 0xA0, 0x6C, 0x27, 0xDC, 0xF4, 0x9A,
+        0xDA, 0x62, 0xEB, 0x2B };
+    RipemdContext ctx;
+    byte digest[ DIGEST_BYTES ];
+
+    ripemdInit( &ctx );
+    for ( int i = 0; str[ i ]; i++ )
+      ripemdUpdate( &ctx, str + i, 1 );
+    ripemdFinal( &ctx, digest );
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    ripemdInit( &ctx );
+    ripemdUpdate( &ctx, str, 13 );
+    ripemdUpdate( &ctx, str + 13, 0 );
+    ripemdUpdate( &ctx, str + 13, 43 );
+    ripemdFinal( &ctx, digest );
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test hashJobs(), at each lane width, against the streaming functions.
+
+  {
+    // Messages of every length up to a few blocks, so lanes finish at
+    // different times and padding goes both ways.
+    byte data[ 300 ];
+    for ( int i = 0; i < 300; i++ )
+      data[ i ] = i * 7 + 3;
+
+    HashJob jobs[ 150 ];
+    byte digests[ 150 ][ DIGEST_BYTES ];
+    byte expected[ 150 ][ DIGEST_BYTES ];
+    for ( int i = 0; i < 150; i++ ) {
+      RipemdContext ctx;
+      ripemdInit( &ctx );
+      ripemdUpdate( &ctx, data, i * 2 );
+      ripemdFinal( &ctx, expected[ i ] );
+      jobs[ i ] = (HashJob){ data, i * 2, digests[ i ] };
+    }
+
+    int widths[] = { MIN_LANES, 8, MAX_LANES };
+    for ( int w = 0; w < 3; w++ ) {
+      setLaneLimit( widths[ w ] );
+      memset( digests, 0, sizeof( digests ) );
+      hashJobs( jobs, 150 );
+      TestCase( memcmp( digests, expected, sizeof( expected ) ) == 0 );
+    }
+  }
+
+  {
+    // Just two messages, so one finishes with the lanes mostly idle.
+    byte digests[ 2 ][ DIGEST_BYTES ];
+    HashJob jobs[] = { { (byte *)"abc", 3, digests[ 0 ] },
+                       { (byte *)"", 0, digests[ 1 ] } };
+    setLaneLimit( MAX_LANES );
+    hashJobs( jobs, 2 );
+
+    byte expected[ 2 ][ DIGEST_BYTES ] =
+      { { 0x8E, 0xB2, 0x08, 0xF7, 0xE0, 0x5D, 0x98, 0x7A,
+          0x9B, 0x04, 0x4A, 0x8E, 0x98, 0xC6, 0xB0, 0x87,
+          0xF1, 0x5A, 0x0B, 0xFC },
+        { 0x9C, 0x11, 0x85, 0xA5, 0xC5, 0xE9, 0xFC, 0x54,
+          0x61, 0x28, 0x08, 0x97, 0x7E, 0xE8, 0xF5, 0x48,
+          0xB2, 0x25, 0x8D, 0x31 } };
+    TestCase( memcmp( digests, expected, sizeof( expected ) ) == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test ripemdBatch() against the streaming functions.
+
+  {
+    // More messages than it hashes at once, of mixed lengths and in no
+    // particular order, so it has to sort and put them back.
+    static byte data[ 256 ];
+    for ( int i = 0; i < 256; i++ )
+      data[ i ] = i * 13 + 5;
+
+    static const void *ptrs[ 1500 ];
+    static size_t lens[ 1500 ];
+    static byte digests[ 1500 ][ DIGEST_BYTES ];
+    static byte expected[ 1500 ][ DIGEST_BYTES ];
+    for ( int i = 0; i < 1500; i++ ) {
+      ptrs[ i ] = data + i % 50;
+      lens[ i ] = ( i * 37 ) % 200;
+
+      RipemdContext ctx;
+      ripemdInit( &ctx );
+      ripemdUpdate( &ctx, ptrs[ i ], lens[ i ] );
+      ripemdFinal( &ctx, expected[ i ] );
+    }
+
+    ripemdBatch( ptrs, lens, 1500, digests );
+    TestCase( memcmp( digests, expected, sizeof( expected ) ) == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the digest cache.
+
+  {
+    remove( "testdriver-cache.bin" );
+    TestCase( openDigestCache( "testdriver-cache.bin", false ) );
+
+    // A file that was last changed long ago.
+    struct stat info;
+    memset( &info, 0, sizeof( info ) );
+    info.st_dev = 7;
+    info.st_ino = 12345;
+    info.st_size = 3;
+    info.st_mtime = 1000000;
+
+    byte digest[ DIGEST_BYTES ] = { 0x8E, 0xB2, 0x08, 0xF7 };
+    byte found[ DIGEST_BYTES ];
+    cacheStore( &info, digest );
+    TestCase( cacheLookup( &info, found ) &&
+              memcmp( found, digest, DIGEST_BYTES ) == 0 );
+
+    // If its size changes, the cached value doesn't count.
+    info.st_size = 4;
+    TestCase( !cacheLookup( &info, found ) );
+
+    // A file that was just changed doesn't get cached.
+    info.st_ino = 54321;
+    info.st_mtime = time( NULL );
+    cacheStore( &info, digest );
+    TestCase( !cacheLookup( &info, found ) );
+    closeDigestCache();
+
+    // When verifying, everything is hashed again, and a different hash
+    // value for an unchanged file is a mismatch.
+    TestCase( openDigestCache( "testdriver-cache.bin", true ) );
+    info.st_ino = 12345;
+    info.st_size = 3;
+    info.st_mtime = 1000000;
+    TestCase( !cacheLookup( &info, found ) );
+    digest[ 0 ] = 0x00;
+    cacheStore( &info, digest );
+    TestCase( cacheMismatches() == 1 );
+    closeDigestCache();
+    remove( "testdriver-cache.bin" );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test tree hashing, treeLeaf(), treeNode() and treeRoot().
+
+  {
+    // A leaf is the plain hash value of the chunk, with a byte in front.
+    byte data[ 1 + 100 ];
+    for ( int i = 0; i < 101; i++ )
+      data[ i ] = i * 7 + 3;
+    data[ 0 ] = TREE_LEAF;
+
+    byte leaf[ DIGEST_BYTES ], expected[ DIGEST_BYTES ];
+    treeLeaf( data + 1, 100, leaf );
+    RipemdContext ctx;
+    ripemdInit( &ctx );
+    ripemdUpdate( &ctx, data, sizeof( data ) );
+    ripemdFinal( &ctx, expected );
+    TestCase( memcmp( leaf, expected, DIGEST_BYTES ) == 0 );
+
+    // With one leaf, the root is just the leaf.
+    byte leaves[ 3 ][ DIGEST_BYTES ];
+    byte root[ DIGEST_BYTES ];
+    memcpy( leaves[ 0 ], leaf, DIGEST_BYTES );
+    treeRoot( leaves, 1, root );
+    TestCase( memcmp( root, leaf, DIGEST_BYTES ) == 0 );
+
+    // With three, the last one moves up a level before it's combined.
+    treeLeaf( data + 1, 10, leaves[ 0 ] );
+    treeLeaf( data + 11, 20, leaves[ 1 ] );
+    treeLeaf( data + 31, 30, leaves[ 2 ] );
+    byte left[ DIGEST_BYTES ];
+    treeNode( leaves[ 0 ], leaves[ 1 ], left );
+    treeNode( left, leaves[ 2 ], expected );
+    treeRoot( leaves, 3, root );
+    TestCase( memcmp( root, expected, DIGEST_BYTES ) == 0 );
+
+    // A node and a leaf over the same bytes don't hash the same.
+    treeLeaf( data + 1, 2 * DIGEST_BYTES, leaf );
+    treeNode( data + 1, data + 1 + DIGEST_BYTES, root );
+    TestCase( memcmp( root, leaf, DIGEST_BYTES ) != 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test ripemdSave() and ripemdLoad(), by saving and loading the context
+  // between pieces of a message.
+
+  {
+    byte data[ 300 ];
+    for ( int i = 0; i < 300; i++ )
+      data[ i ] = i * 11 + 1;
+
+    RipemdContext ctx;
+    byte expected[ DIGEST_BYTES ];
+    ripemdInit( &ctx );
+    ripemdUpdate( &ctx, data, sizeof( data ) );
+    ripemdFinal( &ctx, expected );
+
+    // Stop part way through a block, and at the end of one.
+    byte saved[ STATE_BYTES ];
+    byte digest[ DIGEST_BYTES ];
+    ripemdInit( &ctx );
+    ripemdUpdate( &ctx, data, 100 );
+    ripemdSave( &ctx, saved );
+    RipemdContext loaded;
+    TestCase( ripemdLoad( &loaded, saved ) && loaded.len == 100 );
+    ripemdUpdate( &loaded, data + 100, 92 );
+    ripemdSave( &loaded, saved );
+    TestCase( ripemdLoad( &ctx, saved ) && ctx.len == 192 );
+    ripemdUpdate( &ctx, data + 192, 108 );
+    ripemdFinal( &ctx, digest );
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // Something that isn't a saved context doesn't load.
+    saved[ 0 ] = 'X';
+    TestCase( !ripemdLoad( &ctx, saved ) );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test HMAC-RIPEMD160 with the test cases from RFC 2286, and PBKDF2.
+
+  {
+    byte key[ 80 ];
+    byte msg[ 80 ];
+    byte mac[ DIGEST_BYTES ];
+    HmacKey hkey;
+
+    // Test case 1.
+    memset( key, 0x0B, 20 );
+    hmacSetKey( &hkey, key, 20 );
+    hmacRipemd( &hkey, "Hi There", 8, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0x24, 0xCB, 0x4B, 0xD6, 0x7D, 0x20, 0xFC, 0x1A,
+          0x5D, 0x2E, 0xD7, 0x73, 0x2D, 0xCC, 0x39, 0x37,
+          0x7F, 0x0A, 0x56, 0x68 }, DIGEST_BYTES ) == 0 );
+
+    // Test case 2, a key shorter than the hash value.
+    hmacSetKey( &hkey, "Jefe", 4 );
+    hmacRipemd( &hkey, "what do ya want for nothing?", 28, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0xDD, 0xA6, 0xC0, 0x21, 0x3A, 0x48, 0x5A, 0x9E,
+          0x24, 0xF4, 0x74, 0x20, 0x64, 0xA7, 0xF0, 0x33,
+          0xB4, 0x3C, 0x40, 0x69 }, DIGEST_BYTES ) == 0 );
+
+    // Test case 3.
+    memset( key, 0xAA, 20 );
+    memset( msg, 0xDD, 50 );
+    hmacSetKey( &hkey, key, 20 );
+    hmacRipemd( &hkey, msg, 50, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0xB0, 0xB1, 0x05, 0x36, 0x0D, 0xE7, 0x59, 0x96,
+          0x0A, 0xB4, 0xF3, 0x52, 0x98, 0xE1, 0x16, 0xE2,
+          0x95, 0xD8, 0xE7, 0xC1 }, DIGEST_BYTES ) == 0 );
+
+    // Test case 4.
+    for ( int i = 0; i < 25; i++ )
+      key[ i ] = i + 1;
+    memset( msg, 0xCD, 50 );
+    hmacSetKey( &hkey, key, 25 );
+    hmacRipemd( &hkey, msg, 50, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0xD5, 0xCA, 0x86, 0x2F, 0x4D, 0x21, 0xD5, 0xE6,
+          0x10, 0xE1, 0x8B, 0x4C, 0xF1, 0xBE, 0xB9, 0x7A,
+          0x43, 0x65, 0xEC, 0xF4 }, DIGEST_BYTES ) == 0 );
+
+    // Test case 5.
+    memset( key, 0x0C, 20 );
+    hmacSetKey( &hkey, key, 20 );
+    hmacRipemd( &hkey, "Test With Truncation", 20, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0x76, 0x19, 0x69, 0x39, 0x78, 0xF9, 0x1D, 0x90,
+          0x53, 0x9A, 0xE7, 0x86, 0x50, 0x0F, 0xF3, 0xD8,
+          0xE0, 0x51, 0x8E, 0x39 }, DIGEST_BYTES ) == 0 );
+
+    // Test cases 6 and 7, a key longer than a block.
+    memset( key, 0xAA, 80 );
+    hmacSetKey( &hkey, key, 80 );
+    hmacRipemd( &hkey, "Test Using Larger Than Block-Size Key - Hash Key First",
+                54, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0x64, 0x66, 0xCA, 0x07, 0xAC, 0x5E, 0xAC, 0x29,
+          0xE1, 0xBD, 0x52, 0x3E, 0x5A, 0xDA, 0x76, 0x05,
+          0xB7, 0x91, 0xFD, 0x8B }, DIGEST_BYTES ) == 0 );
+
+    const char *longer = "Test Using Larger Than Block-Size Key and Larger "
+      "Than One Block-Size Data";
+    hmacRipemd( &hkey, longer, 73, mac );
+    TestCase( memcmp( mac, (byte []) {
+          0x69, 0xEA, 0x60, 0x79, 0x8D, 0x71, 0x61, 0x6C,
+          0xCE, 0x5F, 0xD0, 0x87, 0x1E, 0x23, 0x75, 0x4C,
+          0xD7, 0x5D, 0x5A, 0x0A }, DIGEST_BYTES ) == 0 );
+
+    // The same message given a piece at a time.
+    RipemdContext ctx;
+    byte pieces[ DIGEST_BYTES ];
+    hmacInit( &hkey, &ctx );
+    ripemdUpdate( &ctx, longer, 30 );
+    ripemdUpdate( &ctx, longer + 30, 43 );
+    hmacFinal( &hkey, &ctx, pieces );
+    TestCase( memcmp( mac, pieces, DIGEST_BYTES ) == 0 );
+
+    // PBKDF2, with one iteration and more than one hash value of output,
+    // and with lots of iterations.
+    byte derived[ 32 ];
+    pbkdf2Ripemd( "password", 8, "salt", 4, 1, derived, 32 );
+    TestCase( memcmp( derived, (byte []) {
+          0xB7, 0x25, 0x25, 0x8B, 0x12, 0x5E, 0x0B, 0xAC,
+          0xB0, 0xE2, 0x30, 0x7E, 0x34, 0xFE, 0xB1, 0x6A,
+          0x4D, 0x0D, 0x6A, 0xED, 0x6C, 0xB4, 0xB0, 0xEE,
+          0xE4, 0x58, 0xFC, 0x18, 0x29, 0x02, 0x04, 0x28 }, 32 ) == 0 );
+
+    pbkdf2Ripemd( "password", 8, "salt", 4, 4096, derived, DIGEST_BYTES );
+    TestCase( memcmp( derived, (byte []) {
+          0x99, 0xA4, 0x0D, 0x3F, 0xE4, 0xEE, 0x95, 0x86,
+          0x97, 0x91, 0xD9, 0xFA, 0xA2, 0x48, 0x64, 0x56,
+          0x27, 0x82, 0x76, 0x21 }, DIGEST_BYTES ) == 0 );
+  }
+
 #ifdef NEVER
 #endif
 
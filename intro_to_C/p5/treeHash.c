@@ -0,0 +1,221 @@
+/**
+  @file treeHash.c
+  @author Maggie Lin (mclin)
+  This file contains the functions for tree hashing.  To hash a file,
+  each thread takes the next chunk nobody has started on, reads it a piece
+  at a time at its own offset, and saves the leaf hash value in its place
+  in a list.  Once every chunk is done, the list is combined into the root.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "treeHash.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/** Most bytes of a chunk to read at a time. */
+#define TREE_READ ((size_t)1 << 20)
+
+/** Most threads to use for one file. */
+#define MAX_TREE_THREADS 256
+
+/** Everything the threads hashing one file share. */
+typedef struct
+{
+  /** File to read from. */
+  int fd;
+
+  /** Size of the file, in bytes. */
+  off_t size;
+
+  /** Size of each chunk, in bytes. */
+  size_t chunk;
+
+  /** Number of chunks. */
+  size_t count;
+
+  /** Hash value of each chunk. */
+  byte (*leaves)[DIGEST_BYTES];
+
+  /** Index of the next chunk nobody has started on. */
+  size_t next;
+
+  /** Zero, or the errno value from a read that failed. */
+  int error;
+} TreeJob;
+
+void treeLeaf(const void *data, size_t len, byte digest[DIGEST_BYTES])
+{
+  RipemdContext ctx;
+  ripemdInit(&ctx);
+  byte mark = TREE_LEAF;
+  ripemdUpdate(&ctx, &mark, 1);
+  ripemdUpdate(&ctx, data, len);
+  ripemdFinal(&ctx, digest);
+}
+
+void treeNode(const byte left[DIGEST_BYTES], const byte right[DIGEST_BYTES],
+              byte digest[DIGEST_BYTES])
+{
+  byte node[1 + 2 * DIGEST_BYTES];
+  node[0] = TREE_NODE;
+  memcpy(node + 1, left, DIGEST_BYTES);
+  memcpy(node + 1 + DIGEST_BYTES, right, DIGEST_BYTES);
+
+  RipemdContext ctx;
+  ripemdInit(&ctx);
+  ripemdUpdate(&ctx, node, sizeof(node));
+  ripemdFinal(&ctx, digest);
+}
+
+void treeRoot(byte leaves[][DIGEST_BYTES], size_t count,
+              byte root[DIGEST_BYTES])
+{
+  // Each level goes in the front of the same list, since a node never
+  // lands past either of its children.
+  while (count > 1) {
+    for (size_t i = 0; i < count / 2; i++) {
+      treeNode(leaves[2 * i], leaves[2 * i + 1], leaves[i]);
+    }
+    if (count % 2) {
+      memcpy(leaves[count / 2], leaves[count - 1], DIGEST_BYTES);
+    }
+    count = (count + 1) / 2;
+  }
+  memcpy(root, leaves[0], DIGEST_BYTES);
+}
+
+/**
+  Hash one chunk of the file, a piece at a time.
+  @param job the file being hashed.
+  @param i index of the chunk.
+  @param buffer storage for one piece of the chunk.
+  @param len size of the buffer.
+  @return zero if the chunk was read, or the errno value if it wasn't.
+*/
+static int hashChunk(TreeJob *job, size_t i, byte *buffer, size_t len)
+{
+  // The chunk size is never bigger than the largest offset, and the chunk
+  // starts inside the file, so this can't overflow.
+  off_t start = (off_t)i * job->chunk;
+  off_t end = job->size - start > (off_t)job->chunk ?
+    start + (off_t)job->chunk : job->size;
+
+  RipemdContext ctx;
+  ripemdInit(&ctx);
+  byte mark = TREE_LEAF;
+  ripemdUpdate(&ctx, &mark, 1);
+  for (off_t pos = start; pos < end; ) {
+    size_t want = end - pos < (off_t)len ? (size_t)(end - pos) : len;
+    ssize_t got = pread(job->fd, buffer, want, pos);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      return errno;
+    }
+    // The file got shorter while we were reading it, so there's no hash
+    // value for the size it had when we started.
+    if (got == 0) {
+      return EIO;
+    }
+    ripemdUpdate(&ctx, buffer, got);
+    pos += got;
+  }
+  ripemdFinal(&ctx, job->leaves[i]);
+  return 0;
+}
+
+/**
+  Starting point for a thread hashing chunks.  It takes chunks until
+  there aren't any left, or until some read fails.
+  @param arg the TreeJob being hashed.
+  @return NULL, always.
+*/
+static void *chunkWorker(void *arg)
+{
+  TreeJob *job = arg;
+  size_t len = job->chunk < TREE_READ ? job->chunk : TREE_READ;
+  byte *buffer = malloc(len);
+  if (buffer == NULL) {
+    __atomic_store_n(&job->error, ENOMEM, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  size_t i;
+  while (__atomic_load_n(&job->error, __ATOMIC_RELAXED) == 0 &&
+         (i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+    int error = hashChunk(job, i, buffer, len);
+    if (error) {
+      __atomic_store_n(&job->error, error, __ATOMIC_RELAXED);
+    }
+  }
+  free(buffer);
+  return NULL;
+}
+
+bool treeHashFile(const char *filename, size_t chunk, int threads,
+                  byte digest[DIGEST_BYTES])
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+  if (S_ISDIR(info.st_mode)) {
+    close(fd);
+    errno = EISDIR;
+    return false;
+  }
+  if (!S_ISREG(info.st_mode)) {
+    close(fd);
+    errno = ESPIPE;
+    return false;
+  }
+
+  TreeJob job = {fd, info.st_size, chunk, 1, NULL, 0, 0};
+  if (info.st_size > 0) {
+    job.count = info.st_size / chunk + (info.st_size % chunk != 0);
+  }
+  job.leaves = malloc(job.count * DIGEST_BYTES);
+  if (job.leaves == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // This thread works on chunks too, along with the ones it starts.
+  if ((size_t)threads > job.count) {
+    threads = job.count;
+  }
+  if (threads > MAX_TREE_THREADS) {
+    threads = MAX_TREE_THREADS;
+  }
+  pthread_t ids[MAX_TREE_THREADS];
+  int started = 0;
+  while (started < threads - 1 &&
+         pthread_create(&ids[started], NULL, chunkWorker, &job) == 0) {
+    started++;
+  }
+  chunkWorker(&job);
+  for (int i = 0; i < started; i++) {
+    pthread_join(ids[i], NULL);
+  }
+  close(fd);
+
+  if (job.error == 0) {
+    treeRoot(job.leaves, job.count, digest);
+  }
+  free(job.leaves);
+  errno = job.error;
+  return job.error == 0;
+}
@@ -0,0 +1,84 @@
+/**
+  @file treeHash.h
+  @author Maggie Lin (mclin)
+  This file contains the function prototypes for tree hashing.  A file is
+  cut into chunks of a fixed size, each chunk is hashed on its own, and the
+  chunk hash values are combined in pairs, level by level, until there's
+  just one.  This isn't plain RIPEMD-160, and it gives a different hash
+  value for the same file, but the chunks can be hashed in parallel, and a
+  single chunk can be checked against the final value using just the hash
+  values next to it on the way up the tree.
+
+  Leaves and inner nodes are hashed with a different first byte, so a node
+  can never be passed off as a chunk of data.  When a level has an odd
+  number of values, the last one moves up to the next level unchanged.
+*/
+
+#ifndef _TREE_HASH_H_
+#define _TREE_HASH_H_
+
+#include "ripeMD.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Byte hashed in front of the data in each chunk. */
+#define TREE_LEAF 0x00
+
+/** Byte hashed in front of the two hash values in each inner node. */
+#define TREE_NODE 0x01
+
+/** Chunk size to use if none is given, in bytes. */
+#define DEFAULT_CHUNK ((size_t)4 << 20)
+
+/** Smallest chunk size that can be asked for, in bytes. */
+#define MIN_CHUNK ((size_t)1 << 10)
+
+/** Largest chunk size that can be asked for, in bytes.  It's the largest
+    file offset, so a chunk's end can always be figured as an offset. */
+#define MAX_CHUNK ((size_t)(((uint64_t)1 << (sizeof(off_t) * 8 - 1)) - 1))
+
+/**
+  Hash one chunk of data as a leaf of the tree.
+  @param data the bytes in the chunk.
+  @param len number of bytes in the chunk.
+  @param digest storage for the leaf's hash value.
+*/
+void treeLeaf(const void *data, size_t len, byte digest[DIGEST_BYTES]);
+
+/**
+  Combine the hash values of two neighboring subtrees.
+  @param left hash value of the subtree on the left.
+  @param right hash value of the subtree on the right.
+  @param digest storage for the hash value of the node above them.  It
+  may be the same as left or right.
+*/
+void treeNode(const byte left[DIGEST_BYTES], const byte right[DIGEST_BYTES],
+              byte digest[DIGEST_BYTES]);
+
+/**
+  Combine the hash values of all the leaves, in order, into the hash value
+  at the root of the tree.  The leaves are overwritten along the way.
+  @param leaves hash values of the leaves.
+  @param count number of leaves, at least one.
+  @param root storage for the hash value at the root.
+*/
+void treeRoot(byte leaves[][DIGEST_BYTES], size_t count,
+              byte root[DIGEST_BYTES]);
+
+/**
+  Tree hash a file, hashing its chunks on the given number of threads.
+  An empty file has one empty chunk.
+  @param filename name of the file to hash.  It has to be a file that
+  can be read at any offset.
+  @param chunk size of each chunk, in bytes.
+  @param threads number of threads to use, at least one.
+  @param digest storage for the hash value at the root of the tree.
+  @return true if the whole file was read, false if it couldn't be
+  opened or read, with errno saying why.  If the file gets shorter while
+  it's being read, that's an error too, EIO.
+*/
+bool treeHashFile(const char *filename, size_t chunk, int threads,
+                  byte digest[DIGEST_BYTES]);
+
+#endif
@@ -0,0 +1,189 @@
+/**
+  @file gen.c
+  @author Maggie Lin
+
+  Generator for benchmark workloads.  Given a workload family and a
+  size, it writes a program in the interpreter's language to standard
+  output.  Each family stresses a different part of the interpreter.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of iterations of the outer loop in the many-variable workload. */
+#define VAR_ROUNDS 50
+
+/** Number of values in each literal sequence in the literal workload. */
+#define LITERAL_WIDTH 500
+
+/** Print a usage message then exit unsuccessfully. */
+static void usage()
+{
+  fprintf(stderr, "usage: gen <loops|strings|sort|vars|literals> <size>\n");
+  exit(EXIT_FAILURE);
+}
+
+/**
+  Three loops nested inside each other, each running size times, with
+  some arithmetic in the innermost body.
+  @param size iterations of each loop.
+*/
+static void genLoops(int size)
+{
+  printf("# Nested loops, %d iterations at each level.\n", size);
+  printf("n = %d;\n", size);
+  printf("total = 0;\n");
+  printf("i = 0;\n");
+  printf("while ( i < n ) {\n");
+  printf("  j = 0;\n");
+  printf("  while ( j < n ) {\n");
+  printf("    k = 0;\n");
+  printf("    while ( k < n ) {\n");
+  printf("      total = total + ( i * j ) + k;\n");
+  printf("      k = k + 1;\n");
+  printf("    }\n");
+  printf("    j = j + 1;\n");
+  printf("  }\n");
+  printf("  i = i + 1;\n");
+  printf("}\n");
+  printf("print total;\n");
+  printf("print \"\\n\";\n");
+}
+
+/**
+  Build a long string one character at a time, then build a copy of
+  it in reverse.
+  @param size length of the string.
+*/
+static void genStrings(int size)
+{
+  printf("# Build a %d-character string, then reverse it.\n", size);
+  printf("s = [];\n");
+  printf("c = 0;\n");
+  printf("i = 0;\n");
+  printf("while ( i < %d ) {\n", size);
+  printf("  push s, 'a' + c;\n");
+  printf("  c = c + 1;\n");
+  printf("  if ( c == 26 )\n");
+  printf("    c = 0;\n");
+  printf("  i = i + 1;\n");
+  printf("}\n");
+  printf("r = [];\n");
+  printf("i = len s;\n");
+  printf("while ( 0 < i ) {\n");
+  printf("  i = i - 1;\n");
+  printf("  push r, s[ i ];\n");
+  printf("}\n");
+  printf("print len r;\n");
+  printf("print \"\\n\";\n");
+  printf("print r[ 0 ];\n");
+  printf("print \"\\n\";\n");
+}
+
+/**
+  Fill a sequence with pseudo-random values, then insertion sort it
+  with code written in the language.
+  @param size number of values to sort.
+*/
+static void genSort(int size)
+{
+  printf("# Insertion sort of %d pseudo-random values.\n", size);
+  printf("a = [];\n");
+  printf("x = 12345;\n");
+  printf("i = 0;\n");
+  printf("while ( i < %d ) {\n", size);
+  printf("  x = x * 1103 + 12345;\n");
+  printf("  x = x - ( ( x / 65536 ) * 65536 );\n");
+  printf("  push a, x;\n");
+  printf("  i = i + 1;\n");
+  printf("}\n");
+  printf("i = 1;\n");
+  printf("while ( i < len a ) {\n");
+  printf("  v = a[ i ];\n");
+  printf("  j = i - 1;\n");
+  printf("  while ( ( -1 < j ) && ( v < ( a[ j ] ) ) ) {\n");
+  printf("    a[ j + 1 ] = a[ j ];\n");
+  printf("    j = j - 1;\n");
+  printf("  }\n");
+  printf("  a[ j + 1 ] = v;\n");
+  printf("  i = i + 1;\n");
+  printf("}\n");
+  printf("print a[ 0 ];\n");
+  printf("print \"\\n\";\n");
+  printf("print a[ ( ( len a ) - 1 ) ];\n");
+  printf("print \"\\n\";\n");
+}
+
+/**
+  A program with lots of different variables, all updated over and
+  over in a loop.
+  @param size number of variables.
+*/
+static void genVars(int size)
+{
+  printf("# Update %d variables, %d times.\n", size, VAR_ROUNDS);
+  for (int i = 0; i < size; i++)
+    printf("v%d = %d;\n", i, i);
+  printf("r = 0;\n");
+  printf("while ( r < %d ) {\n", VAR_ROUNDS);
+  for (int i = 0; i < size; i++)
+    printf("  v%d = v%d + r;\n", i, i);
+  printf("  r = r + 1;\n");
+  printf("}\n");
+  printf("sum = 0;\n");
+  for (int i = 0; i < size; i++)
+    printf("sum = sum + v%d;\n", i);
+  printf("print sum;\n");
+  printf("print \"\\n\";\n");
+}
+
+/**
+  A long list of assignments from large literal sequences.
+  @param size total number of values in all the literals.
+*/
+static void genLiterals(int size)
+{
+  printf("# %d values in literal sequences.\n", size);
+  printf("total = 0;\n");
+  for (int done = 0; done < size; done += LITERAL_WIDTH) {
+    printf("a = [ ");
+    for (int i = 0; i < LITERAL_WIDTH; i++)
+      printf("%s%d", i ? ", " : "", (done + i) % 1000);
+    printf(" ];\n");
+    printf("total = total + len a;\n");
+  }
+  printf("print total;\n");
+  printf("print \"\\n\";\n");
+}
+
+/**
+  Program starting point, generates the requested workload.
+  @param argc number of command-line arguments.
+  @param argv list of command-line arguments.
+  @return program exit status
+*/
+int main(int argc, char *argv[])
+{
+  if (argc != 3)
+    usage();
+
+  int size;
+  if (sscanf(argv[2], "%d", &size) != 1 || size < 1)
+    usage();
+
+  if (strcmp(argv[1], "loops") == 0)
+    genLoops(size);
+  else if (strcmp(argv[1], "strings") == 0)
+    genStrings(size);
+  else if (strcmp(argv[1], "sort") == 0)
+    genSort(size);
+  else if (strcmp(argv[1], "vars") == 0)
+    genVars(size);
+  else if (strcmp(argv[1], "literals") == 0)
+    genLiterals(size);
+  else
+    usage();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/**
+  @file runner.c
+  @author Maggie Lin
+
+  Benchmark runner for the interpreter.  It runs each workload program
+  a few times, and reports statements per second, wall-clock time and
+  peak resident set size for the fastest run.  Results are printed as
+  a table, and also written as JSON so they can be compared between
+  versions of the interpreter.
+*/
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/** Number of times each workload is run, unless -r says otherwise. */
+#define DEFAULT_RUNS 3
+
+/** Capacity for the interpreter's standard error output. */
+#define REPORT_SIZE 4096
+
+/** Measurements for one run of a workload. */
+typedef struct {
+  /** Number of statements the interpreter executed. */
+  unsigned long statements;
+
+  /** Elapsed wall-clock time, in seconds. */
+  double seconds;
+
+  /** Peak resident set size, in kilobytes. */
+  long peakKB;
+} Result;
+
+/** Print a usage message then exit unsuccessfully. */
+static void usage()
+{
+  fprintf(stderr, "usage: runner [-r runs] [-o results.json] "
+          "<interpreter> <workload>...\n");
+  exit(EXIT_FAILURE);
+}
+
+/**
+  Return the current time from a monotonic clock, in seconds.
+  @return current time.
+*/
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+  Run the interpreter once on the given workload.  Its output is
+  discarded, except for the statement count it reports on standard
+  error.
+  @param interp path to the interpreter.
+  @param workload path to the workload program.
+  @param res storage for the measurements.
+  @return true if the interpreter ran successfully.
+*/
+static bool runOnce(char const *interp, char const *workload, Result *res)
+{
+  int pfd[2];
+  if (pipe(pfd) != 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    // Child, send stdout to /dev/null and stderr back to the parent.
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(pfd[1], STDERR_FILENO);
+    close(pfd[0]);
+    close(pfd[1]);
+    close(devnull);
+    execl(interp, interp, "--stmt-count", workload, (char *)NULL);
+    perror(interp);
+    _exit(EXIT_FAILURE);
+  }
+
+  // Collect everything the interpreter writes to stderr.
+  close(pfd[1]);
+  char report[REPORT_SIZE + 1];
+  int len = 0;
+  int n;
+  while ((n = read(pfd[0], report + len, REPORT_SIZE - len)) > 0)
+    len += n;
+  report[len] = '\0';
+  close(pfd[0]);
+
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  res->seconds = now() - start;
+  res->peakKB = usage.ru_maxrss;
+
+  char const *count = strstr(report, "statements executed: ");
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !count) {
+    fprintf(stderr, "%s failed:\n%s", workload, report);
+    return false;
+  }
+  sscanf(count, "statements executed: %lu", &res->statements);
+  return true;
+}
+
+/**
+  Return the name of a workload, its filename without any directory
+  or extension.
+  @param path path to the workload.
+  @param name storage for the name.
+  @param cap capacity of name.
+*/
+static void workloadName(char const *path, char *name, size_t cap)
+{
+  char const *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  snprintf(name, cap, "%s", base);
+  char *dot = strrchr(name, '.');
+  if (dot)
+    *dot = '\0';
+}
+
+/**
+  Program starting point, runs each workload and reports the results.
+  @param argc number of command-line arguments.
+  @param argv list of command-line arguments.
+  @return program exit status
+*/
+int main(int argc, char *argv[])
+{
+  int runs = DEFAULT_RUNS;
+  char const *jsonPath = NULL;
+
+  int apos = 1;
+  while (apos < argc && argv[apos][0] == '-') {
+    if (strcmp(argv[apos], "-r") == 0 && apos + 1 < argc) {
+      if (sscanf(argv[apos + 1], "%d", &runs) != 1 || runs < 1)
+        usage();
+    } else if (strcmp(argv[apos], "-o") == 0 && apos + 1 < argc) {
+      jsonPath = argv[apos + 1];
+    } else {
+      usage();
+    }
+    apos += 2;
+  }
+  if (argc - apos < 2)
+    usage();
+  char const *interp = argv[apos++];
+
+  FILE *json = NULL;
+  if (jsonPath) {
+    json = fopen(jsonPath, "w");
+    if (!json) {
+      perror(jsonPath);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(json, "{\n  \"interpreter\": \"%s\",\n  \"runs\": %d,\n"
+            "  \"workloads\": [", interp, runs);
+  }
+
+  printf("%-16s %12s %10s %14s %10s\n", "workload", "statements",
+         "seconds", "stmts/sec", "peak KB");
+
+  bool failed = false;
+  int reported = 0;
+  for (int i = apos; i < argc; i++) {
+    char name[FILENAME_MAX];
+    workloadName(argv[i], name, sizeof(name));
+
+    // Keep the fastest of several runs, to cut down on noise.
+    Result best;
+    bool ok = true;
+    for (int r = 0; ok && r < runs; r++) {
+      Result res;
+      ok = runOnce(interp, argv[i], &res);
+      if (ok && (r == 0 || res.seconds < best.seconds))
+        best = res;
+    }
+    if (!ok) {
+      failed = true;
+      continue;
+    }
+
+    double rate = best.seconds > 0 ? best.statements / best.seconds : 0;
+    printf("%-16s %12lu %10.4f %14.0f %10ld\n", name, best.statements,
+           best.seconds, rate, best.peakKB);
+
+    if (json) {
+      fprintf(json, "%s\n    {\"name\": \"%s\", \"statements\": %lu, "
+              "\"wall_seconds\": %.6f, \"statements_per_second\": %.0f, "
+              "\"peak_rss_kb\": %ld}", reported ? "," : "", name,
+              best.statements, best.seconds, rate, best.peakKB);
+    }
+    reported++;
+  }
+
+  if (json) {
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
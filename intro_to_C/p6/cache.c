@@ -0,0 +1,168 @@
+/**
+  @file cache.c
+  @author Maggie Lin
+
+  Cache of compiled programs.  A cache file is a small header followed
+  by the flattened top-level statements of the program.  Nothing in the
+  file depends on where it's loaded, so it can be mapped read-only and
+  used in place.
+*/
+
+#define _XOPEN_SOURCE 700
+
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Starting value for the FNV-1a hash. */
+#define FNV_OFFSET 14695981039346656037ULL
+
+/** Multiplier for the FNV-1a hash. */
+#define FNV_PRIME 1099511628211ULL
+
+/** Size of the blocks we read while hashing the source. */
+#define HASH_BLOCK 65536
+
+/** Header at the start of every cache file. */
+typedef struct {
+  /** Always CACHE_MAGIC. */
+  uint32_t magic;
+
+  /** Always CACHE_VERSION. */
+  uint32_t version;
+
+  /** Hash of the source the program was compiled from. */
+  uint64_t hash;
+
+  /** Number of words of flattened code after the header. */
+  uint64_t words;
+
+  /** Hash of the flattened code, to catch damaged cache files. */
+  uint64_t check;
+} CacheHeader;
+
+/** Hidden implementation of a mapped cache file. */
+struct ProgramCacheStruct {
+  /** Start of the mapped file. */
+  void *map;
+
+  /** Size of the mapped file. */
+  size_t size;
+
+  /** Position of the next statement to rebuild. */
+  int const *pos;
+
+  /** End of the flattened code. */
+  int const *end;
+};
+
+/**
+  Continue an FNV-1a hash over a block of bytes.
+  @param hash hash of everything before this block.
+  @param data block of bytes to add to the hash.
+  @param len number of bytes in the block.
+  @return the updated hash.
+*/
+static uint64_t hashBytes(uint64_t hash, void const *data, size_t len)
+{
+  unsigned char const *bytes = data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t hashSource(FILE *fp)
+{
+  uint64_t hash = FNV_OFFSET;
+  char block[HASH_BLOCK];
+  size_t len;
+  while ((len = fread(block, 1, sizeof(block), fp)) > 0)
+    hash = hashBytes(hash, block, len);
+
+  rewind(fp);
+  return hash;
+}
+
+ProgramCache *openCache(char const *filename, uint64_t hash)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  // Make sure this cache matches our source and hasn't been damaged.
+  CacheHeader const *head = map;
+  int const *code = (int const *)(head + 1);
+  if (head->magic != CACHE_MAGIC || head->version != CACHE_VERSION ||
+      head->hash != hash ||
+      head->words != (st.st_size - sizeof(CacheHeader)) / sizeof(int) ||
+      hashBytes(FNV_OFFSET, code, head->words * sizeof(int)) != head->check) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  ProgramCache *cache = (ProgramCache *) malloc(sizeof(ProgramCache));
+  cache->map = map;
+  cache->size = st.st_size;
+  cache->pos = code;
+  cache->end = code + head->words;
+  return cache;
+}
+
+Stmt *nextCachedStmt(ProgramCache *cache)
+{
+  if (cache->pos >= cache->end)
+    return NULL;
+  return unflattenStmt(&cache->pos);
+}
+
+void closeCache(ProgramCache *cache)
+{
+  munmap(cache->map, cache->size);
+  free(cache);
+}
+
+bool saveCache(char const *filename, uint64_t hash, FlatCode *code)
+{
+  CacheHeader head;
+  memset(&head, 0, sizeof(head));
+  head.magic = CACHE_MAGIC;
+  head.version = CACHE_VERSION;
+  head.hash = hash;
+  head.words = code->len;
+  head.check = hashBytes(FNV_OFFSET, code->words, code->len * sizeof(int));
+
+  // Write to a temporary file, then move it into place.
+  char tmpname[FILENAME_MAX];
+  snprintf(tmpname, sizeof(tmpname), "%s.%ld.tmp", filename, (long)getpid());
+  FILE *fp = fopen(tmpname, "wb");
+  if (!fp)
+    return false;
+
+  bool ok = fwrite(&head, sizeof(head), 1, fp) == 1 &&
+    fwrite(code->words, sizeof(int), code->len, fp) == code->len;
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok || rename(tmpname, filename) != 0) {
+    remove(tmpname);
+    return false;
+  }
+  return true;
+}
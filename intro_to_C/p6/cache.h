@@ -0,0 +1,75 @@
+/**
+  @file cache.h
+  @author Maggie Lin
+
+  Cache of compiled programs.  After a program has been parsed once,
+  its statements are saved to a cache file in flattened form, along
+  with a hash of the source.  Later runs of the same source can map
+  the cache file into memory and rebuild the statements from it, without
+  having to tokenize and parse the source again.
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "syntax.h"
+
+/** Value identifying a file as a compiled-program cache. */
+#define CACHE_MAGIC 0x31435049
+
+/** Version of the flattened code format, changed whenever it changes. */
+#define CACHE_VERSION 4
+
+/**
+  Short name for a cache file that's been mapped into memory.  Its
+  definition is an implementation detail of the cache component.
+*/
+typedef struct ProgramCacheStruct ProgramCache;
+
+/**
+  Compute a hash of the contents of the given source file.  The file is
+  rewound to the beginning afterward, so it can still be parsed.
+  @param fp file to hash.
+  @return 64-bit hash of the file's contents.
+*/
+uint64_t hashSource(FILE *fp);
+
+/**
+  Open and map the given cache file, if it exists and it was made from
+  source with the given hash.
+  @param filename name of the cache file.
+  @param hash hash of the program source.
+  @return the mapped cache, or null if there's no usable cache.
+*/
+ProgramCache *openCache(char const *filename, uint64_t hash);
+
+/**
+  Rebuild the next top-level statement from the cache.
+  @param cache cache to read from.
+  @return the next statement, or null at the end of the program.
+*/
+Stmt *nextCachedStmt(ProgramCache *cache);
+
+/**
+  Unmap and free the given cache.  Any statements rebuilt from it must
+  already have been destroyed.
+  @param cache cache to close.
+*/
+void closeCache(ProgramCache *cache);
+
+/**
+  Write the given flattened program to a cache file.  The file is
+  written under a temporary name and renamed into place, so a reader
+  never sees a partial cache.
+  @param filename name of the cache file.
+  @param hash hash of the program source.
+  @param code flattened top-level statements of the program.
+  @return true if the cache was written successfully.
+*/
+bool saveCache(char const *filename, uint64_t hash, FlatCode *code);
+
+#endif
@@ -12,17 +12,132 @@
 #include "value.h"
 #include "syntax.h"
 #include "parse.h"
-
-/** Require 2 arguments. */
-#define REQ_ARG 2
+#include "profile.h"
+#include "memstats.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "repl.h"
 
 /** Print a usage message then exit unsuccessfully. */
 void usage()
 {
-  fprintf(stderr, "usage: interpret <program-file>\n");
+  fprintf(stderr, "usage: interpret [--sample-profile] [--mem-stats] "
+          "[--stmt-count] [--cache <cache-file>] [--pipeline] "
+          "[--load-env <env-file>] [--save-env <env-file>] "
+          "<program-file>\n"
+          "       interpret [--sample-profile] [--mem-stats] "
+          "[--stmt-count] [--load-env <env-file>] [--save-env <env-file>] "
+          "--repl\n");
   exit(EXIT_FAILURE);
 }
 
+/** Report how many statements were executed, registered with atexit(). */
+static void reportStmtCount()
+{
+  fprintf(stderr, "statements executed: %lu\n", stmtCount);
+}
+
+/** 
+  Run one top-level statement, then delete it.
+  @param stmt statement to run.
+  @param env environment to run it in.
+  @param code if non-null, the statement is also added to this in
+  flattened form, so it can be saved to a cache.  If the statement
+  can't be flattened, code is freed and this is set to null.
+*/
+static void runStmt(Stmt *stmt, Environment *env, FlatCode **code)
+{
+  // Save a copy for the cache, if we're making one.
+  if (*code && !flattenStmt(stmt, *code)) {
+    freeFlatCode(*code);
+    *code = NULL;
+  }
+
+  // Run the statement.
+  executeStmt(stmt, env);
+
+  // Delete the statement.
+  stmt->destroy(stmt);
+}
+
+/** 
+  Get the next statement by parsing it from a source file.
+  @param source the file to parse from.
+  @return the next statement, or null at the end of the file.
+*/
+static Stmt *parseNext(void *source)
+{
+  char tok[MAX_TOKEN + 1];
+  if (!parseToken(tok, source))
+    return NULL;
+  return parseStmt(tok, source);
+}
+
+/** 
+  Get the next statement from a parser running on another thread.
+  @param source the pipeline to read from.
+  @return the next statement, or null at the end of the program.
+*/
+static Stmt *pipelineNext(void *source)
+{
+  return nextPipelineStmt(source);
+}
+
+/** 
+  Get one statement at a time from the given source, then run each
+  statement using the same Environment.  A push of literal values onto
+  a variable that already holds a sequence can't fail, so it's held
+  back until the next statement is available, and consecutive pushes
+  like this are merged into one.
+  @param next function to get the next statement from the source,
+  returning null at the end of the program.
+  @param source where the statements come from, passed to next.
+  @param env environment to run the program in.
+  @param code if non-null, each statement is also added to this in
+  flattened form, so it can be saved to a cache.  If a statement can't
+  be flattened, code is freed and this is set to null.
+*/
+static void runSource(Stmt *(*next)(void *source), void *source,
+                      Environment *env, FlatCode **code)
+{
+  Stmt *stmt;
+  Stmt *pending = NULL;
+  while ((stmt = next(source))) {
+    // Fold it into the pending push, or run the pending push first.
+    if (pending) {
+      if (mergeStmts(pending, stmt))
+        continue;
+      runStmt(pending, env, code);
+      pending = NULL;
+    }
+
+    char const *target = constPushTarget(stmt);
+    if (target && lookupVariable(env, target).vtype == SeqType)
+      pending = stmt;
+    else
+      runStmt(stmt, env, code);
+  }
+
+  if (pending)
+    runStmt(pending, env, code);
+}
+
+/** 
+  Rebuild one statement at a time from the given cache, then run each
+  statement using the same Environment.
+  @param cache cache to read the program from.
+  @param env environment to run the program in.
+*/
+static void runCache(ProgramCache *cache, Environment *env)
+{
+  Stmt *stmt;
+  while ((stmt = nextCachedStmt(cache))) {
+    executeStmt(stmt, env);
+    stmt->destroy(stmt);
+  }
+}
+
 /** 
   Program starting point, reads filename from the command-line arguments.
   Parse through a psuedo-code and interpret the psuedo-code to commands in C. 
@@ -32,36 +147,109 @@ void usage()
 */
 int main(int argc, char *argv[])
 {
-  // Open the program's source.
-  if (argc != REQ_ARG)
-    usage();
+  // Handle options, which come before the program's filename.
+  char const *cacheFile = NULL;
+  bool pipelined = false;
+  bool repl = false;
+  char const *loadFile = NULL;
+  char const *saveFile = NULL;
+  int apos = 1;
+  while (apos < argc && strncmp(argv[apos], "--", 2) == 0) {
+    if (strcmp(argv[apos], "--sample-profile") == 0)
+      startProfile();
+    else if (strcmp(argv[apos], "--mem-stats") == 0)
+      enableMemStats();
+    else if (strcmp(argv[apos], "--stmt-count") == 0)
+      atexit(reportStmtCount);
+    else if (strcmp(argv[apos], "--cache") == 0 && apos + 1 < argc)
+      cacheFile = argv[++apos];
+    else if (strcmp(argv[apos], "--pipeline") == 0)
+      pipelined = true;
+    else if (strcmp(argv[apos], "--repl") == 0)
+      repl = true;
+    else if (strcmp(argv[apos], "--load-env") == 0 && apos + 1 < argc)
+      loadFile = argv[++apos];
+    else if (strcmp(argv[apos], "--save-env") == 0 && apos + 1 < argc)
+      saveFile = argv[++apos];
+    else
+      usage();
+    apos++;
+  }
+
+  // Open the program's source.  In interactive mode, statements come
+  // from standard input instead, so there's no filename.
+  FILE *fp = NULL;
+  if (repl) {
+    if (apos != argc || cacheFile || pipelined)
+      usage();
+  } else {
+    if (apos != argc - 1)
+      usage();
   
-  FILE *fp = fopen(argv[1], "r");
-  if (!fp) {
-    perror(argv[1]);
-    exit(EXIT_FAILURE);
+    fp = fopen(argv[apos], "r");
+    if (!fp) {
+      perror(argv[apos]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // If we're using a cache, see if there's one that matches our source.
+  // If not, we'll make one while we parse.
+  uint64_t hash = 0;
+  ProgramCache *cache = NULL;
+  FlatCode *code = NULL;
+  if (cacheFile) {
+    hash = hashSource(fp);
+    cache = openCache(cacheFile, hash);
+    if (!cache)
+      code = makeFlatCode();
   }
 
-  // Environment, for storing variable values.
+  // Environment, for storing variable values.  It can start out with
+  // the variables from a snapshot.
   Environment *env = makeEnvironment();
-  
-  // Parse one statement at a time, then run each statement
-  // using the same Environment.
-  char tok[MAX_TOKEN + 1];
-  while (parseToken(tok, fp)) {
-    // Parse the next input statement.
-    Stmt *stmt = parseStmt(tok, fp);
+  Snapshot *snap = NULL;
+  if (loadFile) {
+    snap = loadSnapshot(loadFile, env);
+    if (!snap) {
+      fprintf(stderr, "Can't load environment from %s\n", loadFile);
+      exit(EXIT_FAILURE);
+    }
+  }
 
-    // Run the statement.
-    stmt->execute(stmt, env);
+  if (repl) {
+    runRepl(stdin, env);
+  } else if (cache) {
+    runCache(cache, env);
+    closeCache(cache);
+  } else if (pipelined) {
+    // Parse on another thread while we run the statements.
+    Pipeline *pipe = startPipeline(fp);
+    runSource(pipelineNext, pipe, env, &code);
+    finishPipeline(pipe);
+  } else {
+    runSource(parseNext, fp, env, &code);
+  }
 
-    // Delete the statement.
-    stmt->destroy(stmt);
+  // The whole program parsed and ran, so it's safe to cache it.
+  if (code) {
+    if (!saveCache(cacheFile, hash, code))
+      perror(cacheFile);
+    freeFlatCode(code);
   }
   
-  // We're done, close the input file and free the environment.
-  fclose(fp);
+  // Save the variables the program left behind, if we're asked to.
+  if (saveFile && !saveSnapshot(saveFile, env))
+    perror(saveFile);
+
+  // We're done, close the input file and free the environment and
+  // any functions the program defined.
+  if (fp)
+    fclose(fp);
   freeEnvironment(env);
+  freeFunctions();
+  if (snap)
+    closeSnapshot(snap);
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,41 @@
+/**
+  @file memstats.c
+  @author Maggie Lin
+
+  Counters for the memory the interpreter allocates, and a report of
+  them for the --mem-stats option.
+*/
+
+#include "memstats.h"
+#include <stdlib.h>
+
+MemStats memStats;
+
+/** Print the counters to standard error, registered with atexit(). */
+static void reportAtExit()
+{
+  reportMemStats(stderr);
+}
+
+void enableMemStats()
+{
+  atexit(reportAtExit);
+}
+
+void reportMemStats(FILE *fp)
+{
+  fprintf(fp, "memory stats:\n");
+  fprintf(fp, "  %-22s%zu\n", "bytes allocated:",
+          memStats.bytesAllocated + memStats.nodeBytes);
+  fprintf(fp, "  %-22s%lu\n", "sequences created:", memStats.seqCreated);
+  fprintf(fp, "  %-22s%lu\n", "sequences live:", memStats.seqLive);
+  fprintf(fp, "  %-22s%zu\n", "sequence bytes:", memStats.seqBytes);
+  fprintf(fp, "  %-22s%zu\n", "sequence peak bytes:", memStats.seqPeakBytes);
+  fprintf(fp, "  %-22s%lu\n", "sequence reallocs:", memStats.seqReallocs);
+  fprintf(fp, "  %-22s%lu\n", "maps created:", memStats.mapCreated);
+  fprintf(fp, "  %-22s%lu\n", "maps live:", memStats.mapLive);
+  fprintf(fp, "  %-22s%zu\n", "environment bytes:", memStats.envBytes);
+  fprintf(fp, "  %-22s%lu\n", "environment reallocs:", memStats.envReallocs);
+  fprintf(fp, "  %-22s%lu\n", "syntax nodes:", memStats.nodeCount);
+  fprintf(fp, "  %-22s%zu\n", "syntax node bytes:", memStats.nodeBytes);
+}
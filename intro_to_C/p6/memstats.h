@@ -0,0 +1,71 @@
+/**
+  @file memstats.h
+  @author Maggie Lin
+
+  Counters for the memory the interpreter allocates for sequences, maps,
+  the environment and the parse tree.  They're always kept up to date,
+  and the --mem-stats option prints them when the program exits.
+*/
+
+#ifndef _MEMSTATS_H_
+#define _MEMSTATS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/** Running totals for allocations made by the interpreter. */
+typedef struct {
+  /** Bytes requested from malloc() or realloc(), over the whole run,
+      not counting syntax nodes, which are in nodeBytes. */
+  size_t bytesAllocated;
+
+  /** Number of sequences created. */
+  unsigned long seqCreated;
+
+  /** Number of sequences that are currently allocated. */
+  unsigned long seqLive;
+
+  /** Bytes currently used by sequences, including their lists. */
+  size_t seqBytes;
+
+  /** Largest value seqBytes has reached. */
+  size_t seqPeakBytes;
+
+  /** Number of times a sequence list had to be reallocated. */
+  unsigned long seqReallocs;
+
+  /** Number of maps created. */
+  unsigned long mapCreated;
+
+  /** Number of maps that are currently allocated. */
+  unsigned long mapLive;
+
+  /** Bytes currently used by environment variable lists. */
+  size_t envBytes;
+
+  /** Number of times an environment's variable list had to grow. */
+  unsigned long envReallocs;
+
+  /** Number of expression and statement objects allocated. */
+  unsigned long nodeCount;
+
+  /** Bytes used by those expression and statement objects. */
+  size_t nodeBytes;
+} MemStats;
+
+/** Global allocation counters for the interpreter. */
+extern MemStats memStats;
+
+/**
+  Arrange for the allocation counters to be printed to standard
+  error when the program exits.
+*/
+void enableMemStats();
+
+/**
+  Print the current allocation counters.
+  @param fp stream to print them to.
+*/
+void reportMemStats(FILE *fp);
+
+#endif
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
 
 // Prototype so we can use this function before defining it.
 static Expr *parseExpr(char *tok, FILE *fp);
@@ -22,11 +23,56 @@ static Expr *parseExpr(char *tok, FILE *fp);
 // Current line we're parsing, starting from 1 like most editors.
 static int lineCount = 1;
 
+// A token that was read and then put back, to be returned by the next
+// call to parseToken().
+static char savedToken[MAX_TOKEN + 1];
+
+// True if there's a token in savedToken.
+static bool haveSavedToken = false;
+
+/** 
+  Default handler for syntax errors, prints the message and exits.
+  @param msg complete error message.
+*/
+static void exitOnSyntaxError(char const *msg)
+{
+  fputs(msg, stderr);
+  exit(EXIT_FAILURE);
+}
+
+// Function that reports syntax errors.
+static void (*errorHandler)(char const *msg) = exitOnSyntaxError;
+
+void setSyntaxErrorHandler(void (*handler)(char const *msg))
+{
+  errorHandler = handler ? handler : exitOnSyntaxError;
+}
+
+/** 
+  Report an error in the input, with the current line number, using
+  the error handler.  This function doesn't return.
+  @param fmt printf-style format for the message, after the line number.
+*/
+static void parseError(char const *fmt, ...)
+{
+  char msg[MAX_TOKEN + 1];
+  int len = snprintf(msg, sizeof(msg), "line %d: ", lineCount);
+
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(msg + len, sizeof(msg) - len, fmt, ap);
+  va_end(ap);
+
+  errorHandler(msg);
+
+  // The handler isn't supposed to return, but just in case.
+  exit(EXIT_FAILURE);
+}
+
 /** Print a syntax error message, with a line number and exit. */
 static void syntaxError()
 {
-  fprintf(stderr, "line %d: syntax error\n", lineCount);
-  exit(EXIT_FAILURE);
+  parseError("syntax error\n");
 }
 
 /** 
@@ -40,8 +86,7 @@ static void addToToken(char ch, char *token, int *len)
 {
   // Complain if the token is too long.
   if (*len >= MAX_TOKEN) {
-    fprintf(stderr, "line %d: token too long\n", lineCount);
-    exit(EXIT_FAILURE);
+    parseError("token too long\n");
   }
 
   // Add the given character.
@@ -51,6 +96,13 @@ static void addToToken(char ch, char *token, int *len)
 
 bool parseToken(char *token, FILE *fp)
 {
+  // Return the token that was put back, if there is one.
+  if (haveSavedToken) {
+    strcpy(token, savedToken);
+    haveSavedToken = false;
+    return true;
+  }
+
   int ch;
 
   // Skip whitespace and comments.
@@ -100,10 +152,12 @@ bool parseToken(char *token, FILE *fp)
 
     // Keep reading until we hit the matching close quote.
     while ((ch = fgetc(fp)) != quote || escape) {
-      // Error conditions
+      // Error conditions.  A newline is left for the next token, so
+      // the line count stays right if we keep parsing after the error.
       if (ch == EOF || ch == '\n') {
-        fprintf(stderr, "line %d: invalid string literal.\n", lineCount);
-        exit(EXIT_FAILURE);
+        if (ch == '\n')
+          ungetc(ch, fp);
+        parseError("invalid string literal.\n");
       }
       
       // On a backslash, we just enable escape mode.
@@ -126,9 +180,7 @@ bool parseToken(char *token, FILE *fp)
             ch = '\\';
             break;
           default:
-            fprintf(stderr, "line %d: Invalid escape sequence \"\\%c\"\n",
-                     lineCount, ch);
-            exit(EXIT_FAILURE);
+            parseError("Invalid escape sequence \"\\%c\"\n", ch);
           }
           escape = false;
         }
@@ -140,8 +192,7 @@ bool parseToken(char *token, FILE *fp)
 
     // Single-quoted strings must be exactly one character long.
     if (quote == '\'' && len != SINGLE_QUOTE_LENGTH  + 1 + 1) {
-      fprintf(stderr, "line %d: Invalid single-quoted string\n", lineCount);
-      exit(EXIT_FAILURE);
+      parseError("Invalid single-quoted string\n");
     }
   } else {
     // Is this a multi-character token?
@@ -161,6 +212,39 @@ bool parseToken(char *token, FILE *fp)
   return token;
 }
 
+bool parseRestOfLine(char line[], FILE *fp)
+{
+  // Put back a saved token, since it came before the rest of the line.
+  int len = 0;
+  if (haveSavedToken) {
+    strcpy(line, savedToken);
+    len = strlen(line);
+    haveSavedToken = false;
+  }
+
+  // Read up to the newline, dropping anything that doesn't fit.
+  int ch;
+  while ((ch = fgetc(fp)) != EOF && ch != '\n')
+    if (len < MAX_TOKEN)
+      line[len++] = ch;
+  line[len] = '\0';
+
+  if (ch == '\n')
+    lineCount++;
+  return ch != EOF || len > 0;
+}
+
+/** 
+  Put back a token, so the next call to parseToken() returns it again.
+  Only one token can be put back at a time.
+  @param tok token to put back.
+*/
+static void ungetToken(char const *tok)
+{
+  strcpy(savedToken, tok);
+  haveSavedToken = true;
+}
+
 /** 
   Called when we expect another token on the input.  This function
   parses the token and exits with an error if there isn't one.
@@ -216,12 +300,86 @@ static bool isIdentifier(char const *tok)
       strcmp(tok, "while") == 0 ||
       strcmp(tok, "print") == 0 ||
       strcmp(tok, "push") == 0 ||
-      strcmp(tok, "len") == 0)
+      strcmp(tok, "extend") == 0 ||
+      strcmp(tok, "len") == 0 ||
+      strcmp(tok, "keys") == 0 ||
+      strcmp(tok, "def") == 0 ||
+      strcmp(tok, "return") == 0)
     return false;
 
   return true;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Function scope
+
+// True while we're parsing the body of a function.
+static bool inFunction = false;
+
+// Names of the parameters and local variables of the function we're
+// parsing, in slot order.
+static char (*localNames)[MAX_VAR_NAME + 1] = NULL;
+
+// Number of local variables in the function.
+static int localCount = 0;
+
+// Capacity of localNames.
+static int localCap = 0;
+
+/** 
+  Return the slot for a local variable in the function we're parsing,
+  giving it a new slot if this is the first time we've seen it.
+  @param name name of the variable.
+  @return index of the variable's slot in the function's frame.
+*/
+static int localSlot(char const *name)
+{
+  for (int i = 0; i < localCount; i++)
+    if (strcmp(localNames[i], name) == 0)
+      return i;
+
+  if (localCount >= localCap) {
+    localCap = localCap ? localCap * DOUBLE : INITIAL_CAPACITY;
+    localNames = realloc(localNames, localCap * sizeof(localNames[0]));
+  }
+  strcpy(localNames[localCount], name);
+  return localCount++;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Expressions and statements
+
+/** 
+  Parse the arguments for a function call, after the opening
+  parenthesis, and make the call expression.
+  @param name name of the function being called.
+  @param fp file subsequent tokens are being read from.
+  @return the call expression.
+*/
+static Expr *parseCall(char const *name, FILE *fp)
+{
+  char tok[MAX_TOKEN + 1];
+  int len = 0;
+  int cap = INITIAL_CAPACITY;
+  Expr **args = (Expr **) malloc(cap * sizeof(Expr *));
+
+  // Parse a comma-separated list of arguments, up to the close paren.
+  while (strcmp(expectToken(tok, fp), ")") != 0) {
+    if (len > 0) {
+      if (strcmp(tok, ",") != 0)
+        syntaxError();
+      expectToken(tok, fp);
+    }
+    if (len >= cap) {
+      cap *= DOUBLE;
+      args = (Expr **) realloc(args, cap * sizeof(Expr *));
+    }
+    args[len++] = parseExpr(tok, fp);
+  }
+
+  return makeCall(name, len, args);
+}
+
 /** 
   Return true if the given string is an operator that can come between
   two operands (e.g., typical infix operator or '[')
@@ -256,8 +414,8 @@ static Expr *parseTerm(char tok[MAX_TOKEN + 1], FILE *fp)
     return expr;
   }
 
-   // if it is len operator, go ahead and parse the following expression
-  if (strcmp(tok, "len") == 0) {
+   // if it is len or keys, go ahead and parse the following expression
+  if (strcmp(tok, "len") == 0 || strcmp(tok, "keys") == 0) {
     Expr *expr = parseExpr( tok, fp );
     return expr;
   } else if (tok[0] == '-' || isdigit( tok[0])) {
@@ -271,7 +429,17 @@ static Expr *parseTerm(char tok[MAX_TOKEN + 1], FILE *fp)
     // A literal (single-quoted) character is just another int.
     return makeLiteralInt(tok[1]);
   } else if (isIdentifier(tok)) {
-    return makeVariable(tok);
+    // A name followed by an open paren is a function call.
+    char name[MAX_VAR_NAME + 1];
+    strcpy(name, tok);
+    if (strcmp(expectToken(tok, fp), "(") == 0)
+      return parseCall(name, fp);
+    ungetToken(tok);
+
+    // Inside a function, every variable is local.
+    if (inFunction)
+      return makeLocal(localSlot(name));
+    return makeVariable(name);
   } else if (strcmp(tok, "[") == 0) {
     expectToken(tok, fp);
     if (strcmp(tok, "]") == 0) {
@@ -293,6 +461,27 @@ static Expr *parseTerm(char tok[MAX_TOKEN + 1], FILE *fp)
       }
       return makeSequenceInitializer(len, exprs);
     }
+  } else if (strcmp(tok, "{") == 0) {
+    // A map literal, a comma-separated list of key: value pairs.
+    int len = 0;
+    int cap = INITIAL_CAPACITY;
+    Expr **exprs = (Expr **) malloc(cap * sizeof(Expr *));
+    while (strcmp(expectToken(tok, fp), "}") != 0) {
+      if (len > 0) {
+        if (strcmp(tok, ",") != 0)
+          syntaxError();
+        expectToken(tok, fp);
+      }
+      if (2 * len + 2 > cap) {
+        cap *= DOUBLE;
+        exprs = (Expr **) realloc(exprs, cap * sizeof(Expr *));
+      }
+      exprs[2 * len] = parseExpr(tok, fp);
+      requireToken(":", fp);
+      exprs[2 * len + 1] = parseExpr(expectToken(tok, fp), fp);
+      len++;
+    }
+    return makeMapInitializer(len, exprs);
   } else if (tok[0] == '"') {
     int len = 1;
     int cap = INITIAL_CAPACITY;
@@ -330,6 +519,12 @@ static Expr *parseExpr(char *tok, FILE *fp)
     return makeLenExpr(expr);
   }
 
+  // The keys operator works the same way.
+  if (strcmp(tok, "keys") == 0) {
+    Expr *expr = parseExpr(expectToken(tok, fp), fp);
+    return makeKeysExpr(expr);
+  }
+
   // Parse the expression, or just the left-hand operatnd of a longer
   // expression.
   Expr *left = parseTerm(tok, fp);
@@ -364,9 +559,10 @@ static Expr *parseExpr(char *tok, FILE *fp)
     }
   }
 
-  // To end an expression, the next token must be ;, ), ] or a comma.
+  // To end an expression, the next token must be ;, ), ], }, : or a comma.
   if (strcmp(op, ";") != 0 && strcmp(op, ")") != 0 &&
-      strcmp(op, "]") != 0 && strcmp(op, ",") != 0)
+      strcmp(op, "]") != 0 && strcmp(op, ",") != 0 &&
+      strcmp(op, "}") != 0 && strcmp(op, ":") != 0)
     syntaxError();
 
   // Code that called us is going to expect to see this token.
@@ -374,7 +570,15 @@ static Expr *parseExpr(char *tok, FILE *fp)
   return left;
 }
 
-Stmt *parseStmt(char *tok, FILE *fp)
+/** 
+  Parse the statement starting with the given token.  This does the
+  work for parseStmt(), which records the statement's line afterward.
+  @param tok next token from the input, already read before
+  calling this function.
+  @param fp file subsequent tokens are being read from.
+  @return the Stmt object constructed from the input.
+*/
+static Stmt *parseStmtBody(char *tok, FILE *fp)
 {
   // Handle compound statements
   if (strcmp( tok, "{" ) == 0) {
@@ -388,7 +592,10 @@ Stmt *parseStmt(char *tok, FILE *fp)
         cap *= DOUBLE;
         stmtList = (Stmt **) realloc(stmtList, cap * sizeof(Stmt *));
       }
-      stmtList[len++] = parseStmt(tok, fp);
+      Stmt *stmt = parseStmt(tok, fp);
+      if (len > 0 && mergeStmts(stmtList[len - 1], stmt))
+        continue;
+      stmtList[len++] = stmt;
     }
 
     return makeCompound(len, stmtList);
@@ -424,9 +631,73 @@ Stmt *parseStmt(char *tok, FILE *fp)
   if (strcmp(tok, "push") == 0) {
     Expr *seqArg = parseExpr(expectToken(tok, fp), fp);
     requireToken(",", fp);
-    Expr *valArg = parseExpr(expectToken(tok, fp ), fp);
+
+    // Parse a comma-separated list of values to push.
+    int len = 0;
+    int cap = INITIAL_CAPACITY;
+    Expr **valList = (Expr **) malloc(cap * sizeof(Expr *));
+    do {
+      if (len >= cap) {
+        cap *= DOUBLE;
+        valList = (Expr **) realloc(valList, cap * sizeof(Expr *));
+      }
+      valList[len++] = parseExpr(expectToken(tok, fp), fp);
+    } while (strcmp(expectToken(tok, fp), ",") == 0);
+
+    if (strcmp(tok, ";") != 0)
+      syntaxError();
+    return makePushStmt(seqArg, len, valList);
+  }
+
+  // Handle a function definition.
+  if (strcmp(tok, "def") == 0) {
+    // Functions can't be defined inside other functions.
+    if (inFunction)
+      syntaxError();
+
+    char name[MAX_VAR_NAME + 1];
+    if (!isIdentifier(expectToken(tok, fp)))
+      syntaxError();
+    strcpy(name, tok);
+    requireToken("(", fp);
+
+    // The parameters are the first local variables.
+    inFunction = true;
+    localCount = 0;
+    while (strcmp(expectToken(tok, fp), ")") != 0) {
+      if (localCount > 0) {
+        if (strcmp(tok, ",") != 0)
+          syntaxError();
+        expectToken(tok, fp);
+      }
+      if (!isIdentifier(tok) || localSlot(tok) != localCount - 1)
+        syntaxError();
+    }
+    int params = localCount;
+
+    Stmt *body = parseStmt(expectToken(tok, fp), fp);
+    inFunction = false;
+    return makeDef(name, params, localCount, body);
+  }
+
+  // Handle a return statement, only allowed inside a function.
+  if (strcmp(tok, "return") == 0) {
+    if (!inFunction)
+      syntaxError();
+    if (strcmp(expectToken(tok, fp), ";") == 0)
+      return makeReturn(NULL);
+    Expr *expr = parseExpr(tok, fp);
+    requireToken(";", fp);
+    return makeReturn(expr);
+  }
+
+  // Handle an extend statement.
+  if (strcmp(tok, "extend") == 0) {
+    Expr *seqArg = parseExpr(expectToken(tok, fp), fp);
+    requireToken(",", fp);
+    Expr *srcArg = parseExpr(expectToken(tok, fp), fp);
     requireToken(";", fp);
-    return makePushStmt(seqArg, valArg);
+    return makeExtendStmt(seqArg, srcArg);
   }
 
   // Handle an assignment statement.
@@ -437,11 +708,22 @@ Stmt *parseStmt(char *tok, FILE *fp)
     strcpy(vname, tok);
     
     expectToken(tok, fp);
+    if (strcmp(tok, "(") == 0) {
+      // It's a function call, made just for what it does.
+      Expr *call = parseCall(vname, fp);
+      requireToken(";", fp);
+      return makeCallStmt(call);
+    }
+
+    // Inside a function, every variable is local.
+    int slot = inFunction ? localSlot(vname) : -1;
     if (strcmp(tok, "=") == 0) {
       // It's a plain-old assignment. 
       Expr *expr = parseExpr(expectToken(tok, fp), fp);
       requireToken(";", fp);
       // Make the assignment statement.
+      if (inFunction)
+        return makeLocalAssignment(slot, NULL, expr);
       return makeAssignment(vname, NULL, expr);
     }
     if (strcmp(tok, "[") == 0) {
@@ -450,6 +732,8 @@ Stmt *parseStmt(char *tok, FILE *fp)
       requireToken("=", fp);
       Expr *expr = parseExpr(expectToken(tok, fp), fp);
       requireToken(";", fp);
+      if (inFunction)
+        return makeLocalAssignment(slot, iexpr, expr);
       return makeAssignment(vname, iexpr, expr);
     }
   }
@@ -459,3 +743,24 @@ Stmt *parseStmt(char *tok, FILE *fp)
   // Never reached.
   return NULL;
 }
+
+Stmt *parseStmt(char *tok, FILE *fp)
+{
+  // The first token has already been read, so we're on its line now.
+  int line = lineCount;
+
+  Stmt *stmt = parseStmtBody(tok, fp);
+  stmt->line = line;
+  return stmt;
+}
+
+void resetParser(FILE *fp)
+{
+  // Forget about any function we were in the middle of.
+  inFunction = false;
+  localCount = 0;
+
+  // Throw away the rest of the line, along with any saved token.
+  char line[MAX_TOKEN + 1];
+  parseRestOfLine(line, fp);
+}
@@ -38,6 +38,25 @@
 */
 bool parseToken(char token[], FILE *fp);
 
+/** Read the rest of the current line from the given file, without
+    breaking it into tokens.  A token that was read ahead by the parser
+    is included at the start of the line.  Anything past MAX_TOKEN
+    characters is discarded.
+    @param line storage for the line, with room for a string of up to
+     MAX_TOKEN characters.  The newline isn't included.
+    @param fp file to read from.
+    @return true if there was anything left to read.
+*/
+bool parseRestOfLine(char line[], FILE *fp);
+
+/** Replace the function that reports syntax errors.  The handler is
+    given the complete message, including the line number and a
+    newline, and it must not return.  By default, the message is
+    printed to standard error and the program exits.
+    @param handler new error handler, or null for the default one.
+*/
+void setSyntaxErrorHandler(void (*handler)(char const *msg));
+
 /** Parse with one token worth of look-ahead, return the Stmt
     object representing the next legal statement from the input.
     @param tok next token from the input, already read before
@@ -47,4 +66,12 @@ bool parseToken(char token[], FILE *fp);
 */
 Stmt *parseStmt(char *tok, FILE *fp);
 
+/** Get the parser ready to continue after a syntax error, from an
+    error handler that didn't exit.  Parser state left over from the
+    statement with the error is cleared, and the rest of the line the
+    error was found on is skipped.
+    @param fp file subsequent tokens will be read from.
+*/
+void resetParser(FILE *fp);
+
 #endif
@@ -0,0 +1,256 @@
+/**
+  @file pipeline.c
+  @author Maggie Lin
+
+  Pipelined parsing.  The ring buffer has one writer, the parser
+  thread, and one reader, the executing thread.  Each side owns one
+  index and only reads the other's, so no locks are needed, just
+  acquire and release ordering on the indices.  A side that has to wait
+  spins for a little while, then yields for a little while, then goes
+  to sleep on a condition variable until the other side moves its
+  index, so a long-running statement or a slow parse doesn't keep a
+  whole core busy waiting.
+*/
+
+#define _XOPEN_SOURCE 700
+
+#include "pipeline.h"
+#include "parse.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+
+/** Number of times to check the ring before giving up the CPU. */
+#define SPIN_LIMIT 100
+
+/** Number of times to give up the CPU before going to sleep. */
+#define YIELD_LIMIT 10
+
+/** Hidden implementation of a pipeline. */
+struct PipelineStruct {
+  /** File the parser reads from. */
+  FILE *fp;
+
+  /** The parser thread. */
+  pthread_t thread;
+
+  /** Statements parsed but not taken yet. */
+  Stmt *ring[PIPELINE_SLOTS];
+
+  /** Count of statements added to the ring, only changed by the parser. */
+  unsigned head;
+
+  /** Count of statements taken from the ring, only changed by the reader. */
+  unsigned tail;
+
+  /** Set by the parser after it adds the last statement. */
+  bool done;
+
+  /** True if the parser stopped with a syntax error. */
+  bool failed;
+
+  /** Message for the syntax error, if there was one. */
+  char error[MAX_TOKEN + 1];
+
+  /** Number of threads asleep waiting on the ring. */
+  int sleepers;
+
+  /** Lock for sleeping on changed. */
+  pthread_mutex_t lock;
+
+  /** Broadcast when either index moves, or the parser is done, if
+      anyone's asleep. */
+  pthread_cond_t changed;
+};
+
+/** The running pipeline, for the syntax error handler. */
+static Pipeline *active = NULL;
+
+/**
+  Check whether there's room in the ring for the parser to add a
+  statement.
+  @param pipe pipeline to check.
+  @return true if the ring isn't full.
+*/
+static bool hasRoom(Pipeline *pipe)
+{
+  return pipe->head - __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) <
+    PIPELINE_SLOTS;
+}
+
+/**
+  Check whether the reader has something to do, a statement to take or
+  the end of the program.
+  @param pipe pipeline to check.
+  @return true if the reader doesn't need to wait.
+*/
+static bool hasStmt(Pipeline *pipe)
+{
+  return __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) != pipe->tail ||
+    __atomic_load_n(&pipe->done, __ATOMIC_ACQUIRE);
+}
+
+/**
+  Wait a little while for the other thread to catch up.  Usually it's
+  quick, so this just spins at first, then it yields the CPU, and after
+  that it sleeps until the other thread changes something and ready()
+  is true.
+  @param pipe pipeline we're waiting on.
+  @param spins number of times we've waited so far, incremented here.
+  @param ready check for whether we can stop waiting.
+*/
+static void backoff(Pipeline *pipe, int *spins, bool (*ready)(Pipeline *))
+{
+  if (++*spins < SPIN_LIMIT)
+    return;
+  if (*spins < SPIN_LIMIT + YIELD_LIMIT) {
+    sched_yield();
+    return;
+  }
+
+  // Say we're asleep before checking one last time, so the other side
+  // either sees us and wakes us, or we see what it did.
+  pthread_mutex_lock(&pipe->lock);
+  __atomic_add_fetch(&pipe->sleepers, 1, __ATOMIC_SEQ_CST);
+  while (!ready(pipe))
+    pthread_cond_wait(&pipe->changed, &pipe->lock);
+  __atomic_sub_fetch(&pipe->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pipe->lock);
+  *spins = 0;
+}
+
+/**
+  Wake the other thread if it's asleep in backoff(), after changing an
+  index or the done flag.
+  @param pipe pipeline that changed.
+*/
+static void wakeOther(Pipeline *pipe)
+{
+  // Make sure the change is visible before we check for sleepers.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pipe->sleepers, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock(&pipe->lock);
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+  }
+}
+
+/**
+  Tell the reader there won't be any more statements.
+  @param pipe pipeline that's finished.
+*/
+static void markDone(Pipeline *pipe)
+{
+  __atomic_store_n(&pipe->done, true, __ATOMIC_RELEASE);
+  wakeOther(pipe);
+}
+
+/**
+  Syntax error handler for the parser thread.  It saves the message
+  for the reader to report, then ends the thread.
+  @param msg complete error message.
+*/
+static void stopOnSyntaxError(char const *msg)
+{
+  snprintf(active->error, sizeof(active->error), "%s", msg);
+  active->failed = true;
+  markDone(active);
+  pthread_exit(NULL);
+}
+
+/**
+  Add a statement to the ring, waiting if it's full.
+  @param pipe pipeline to add to.
+  @param stmt statement to add.
+*/
+static void putStmt(Pipeline *pipe, Stmt *stmt)
+{
+  int spins = 0;
+  while (!hasRoom(pipe))
+    backoff(pipe, &spins, hasRoom);
+
+  pipe->ring[pipe->head % PIPELINE_SLOTS] = stmt;
+  __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_RELEASE);
+  wakeOther(pipe);
+}
+
+/**
+  Starting point for the parser thread.
+  @param arg the pipeline.
+  @return always null.
+*/
+static void *parseThread(void *arg)
+{
+  Pipeline *pipe = arg;
+
+  // Profiling samples belong to the thread running statements.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  char tok[MAX_TOKEN + 1];
+  while (parseToken(tok, pipe->fp))
+    putStmt(pipe, parseStmt(tok, pipe->fp));
+
+  markDone(pipe);
+  return NULL;
+}
+
+Pipeline *startPipeline(FILE *fp)
+{
+  Pipeline *pipe = (Pipeline *) malloc(sizeof(Pipeline));
+  pipe->fp = fp;
+  pipe->head = 0;
+  pipe->tail = 0;
+  pipe->done = false;
+  pipe->failed = false;
+  pipe->error[0] = '\0';
+  pipe->sleepers = 0;
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_cond_init(&pipe->changed, NULL);
+
+  active = pipe;
+  setSyntaxErrorHandler(stopOnSyntaxError);
+  if (pthread_create(&pipe->thread, NULL, parseThread, pipe) != 0) {
+    fprintf(stderr, "Can't start parser thread\n");
+    exit(EXIT_FAILURE);
+  }
+  return pipe;
+}
+
+Stmt *nextPipelineStmt(Pipeline *pipe)
+{
+  int spins = 0;
+  while (__atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == pipe->tail) {
+    // The parser might have added something just before it finished,
+    // so check the ring again after we see it's done.
+    if (__atomic_load_n(&pipe->done, __ATOMIC_ACQUIRE) &&
+        __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == pipe->tail) {
+      if (pipe->failed) {
+        fputs(pipe->error, stderr);
+        exit(EXIT_FAILURE);
+      }
+      return NULL;
+    }
+    backoff(pipe, &spins, hasStmt);
+  }
+
+  Stmt *stmt = pipe->ring[pipe->tail % PIPELINE_SLOTS];
+  __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+  wakeOther(pipe);
+  return stmt;
+}
+
+void finishPipeline(Pipeline *pipe)
+{
+  pthread_join(pipe->thread, NULL);
+  setSyntaxErrorHandler(NULL);
+  active = NULL;
+  pthread_mutex_destroy(&pipe->lock);
+  pthread_cond_destroy(&pipe->changed);
+  free(pipe);
+}
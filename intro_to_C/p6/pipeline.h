@@ -0,0 +1,52 @@
+/**
+  @file pipeline.h
+  @author Maggie Lin
+
+  Pipelined parsing.  A parser thread reads top-level statements from
+  the source and passes them to the executing thread through a bounded
+  ring buffer, so reading and parsing the program overlaps with running
+  it.  Statements come out in the same order they're parsed, and a
+  syntax error is only reported once every statement before it has
+  been taken from the pipeline.
+*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdio.h>
+
+#include "syntax.h"
+
+/** Number of parsed statements the ring buffer can hold. */
+#define PIPELINE_SLOTS 256
+
+/**
+  Short name for a running pipeline.  Its definition is an
+  implementation detail of the pipeline component.
+*/
+typedef struct PipelineStruct Pipeline;
+
+/**
+  Start a parser thread reading statements from the given file.  Only
+  one pipeline can run at a time.
+  @param fp file to read the program from.
+  @return the new pipeline.
+*/
+Pipeline *startPipeline(FILE *fp);
+
+/**
+  Get the next parsed statement from the pipeline, waiting for the
+  parser if necessary.  If the parser found a syntax error, it's
+  reported here and the program exits.
+  @param pipe pipeline to read from.
+  @return the next statement, or null at the end of the program.
+*/
+Stmt *nextPipelineStmt(Pipeline *pipe);
+
+/**
+  Wait for the parser thread to finish and free the pipeline.
+  @param pipe pipeline to free.
+*/
+void finishPipeline(Pipeline *pipe);
+
+#endif
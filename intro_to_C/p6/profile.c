@@ -0,0 +1,151 @@
+/**
+  @file profile.c
+  @author Maggie Lin
+
+  Sampling profiler for the interpreter.  A SIGPROF handler looks at
+  the statement the dispatch loop says is running and bumps a counter
+  for its source line.  The handler can't allocate memory, so counts
+  are kept in a fixed-size, open-addressing table.
+*/
+
+#define _XOPEN_SOURCE 700
+
+#include "profile.h"
+#include "syntax.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+/** Source line for each bucket in the histogram, zero if it's unused. */
+static volatile int sampleLine[PROFILE_BUCKETS];
+
+/** Number of samples taken on the line in the matching bucket. */
+static volatile unsigned long sampleCount[PROFILE_BUCKETS];
+
+/** Samples taken between statements, while the parser is working. */
+static volatile unsigned long parseSamples;
+
+/** Samples we couldn't record because the table was full. */
+static volatile unsigned long droppedSamples;
+
+/** True once the timer is running and the histogram should be reported. */
+static bool profiling = false;
+
+/**
+  Signal handler for SIGPROF.  Record one sample for the line of the
+  statement that's currently executing.
+  @param sig signal number, always SIGPROF.
+*/
+static void takeSample(int sig)
+{
+  Stmt *stmt = currentStmt;
+  if (!stmt) {
+    parseSamples++;
+    return;
+  }
+
+  // Linear probing, starting from a bucket picked by the line number.
+  int line = stmt->line;
+  for (int i = 0; i < PROFILE_BUCKETS; i++) {
+    int b = (line + i) % PROFILE_BUCKETS;
+    if (sampleLine[b] == line) {
+      sampleCount[b]++;
+      return;
+    }
+    if (sampleLine[b] == 0) {
+      sampleLine[b] = line;
+      sampleCount[b] = 1;
+      return;
+    }
+  }
+
+  droppedSamples++;
+}
+
+/** Print the profile report to standard error, registered with atexit(). */
+static void reportAtExit()
+{
+  reportProfile(stderr);
+}
+
+void startProfile()
+{
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = takeSample;
+  act.sa_flags = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  if (sigaction(SIGPROF, &act, NULL) != 0) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = SAMPLE_INTERVAL;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    perror("setitimer");
+    exit(EXIT_FAILURE);
+  }
+
+  profiling = true;
+  atexit(reportAtExit);
+}
+
+/**
+  Comparison function for qsort(), putting the busiest buckets first
+  and breaking ties by line number.
+  @param aptr pointer to the first bucket index.
+  @param bptr pointer to the second bucket index.
+  @return negative, zero or positive, like strcmp().
+*/
+static int compareBuckets(const void *aptr, const void *bptr)
+{
+  int a = *(const int *)aptr;
+  int b = *(const int *)bptr;
+  if (sampleCount[a] != sampleCount[b])
+    return sampleCount[a] < sampleCount[b] ? 1 : -1;
+  return sampleLine[a] - sampleLine[b];
+}
+
+void reportProfile(FILE *fp)
+{
+  if (!profiling)
+    return;
+
+  // Stop the timer, so the counts hold still while we report them.
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  profiling = false;
+
+  // Collect the buckets that got used, and the total number of samples.
+  int used[PROFILE_BUCKETS];
+  int len = 0;
+  unsigned long total = parseSamples + droppedSamples;
+  for (int b = 0; b < PROFILE_BUCKETS; b++)
+    if (sampleLine[b]) {
+      used[len++] = b;
+      total += sampleCount[b];
+    }
+  qsort(used, len, sizeof(int), compareBuckets);
+
+  fprintf(fp, "sample profile: %lu samples, %d us interval\n",
+          total, SAMPLE_INTERVAL);
+  if (total == 0)
+    return;
+
+  fprintf(fp, "%8s %10s %8s\n", "line", "samples", "percent");
+  for (int i = 0; i < len; i++)
+    fprintf(fp, "%8d %10lu %7.2f%%\n", sampleLine[used[i]],
+            sampleCount[used[i]], 100.0 * sampleCount[used[i]] / total);
+  if (parseSamples)
+    fprintf(fp, "%8s %10lu %7.2f%%\n", "(parse)", parseSamples,
+            100.0 * parseSamples / total);
+  if (droppedSamples)
+    fprintf(fp, "%8s %10lu %7.2f%%\n", "(lost)", droppedSamples,
+            100.0 * droppedSamples / total);
+}
@@ -0,0 +1,36 @@
+/**
+  @file profile.h
+  @author Maggie Lin
+
+  Sampling profiler for the interpreter.  When it's turned on, a
+  SIGPROF timer periodically interrupts the program and records the
+  source line of the statement that's currently executing.  At exit,
+  the samples are reported as a histogram of lines.
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdio.h>
+
+/** Microseconds of CPU time between profile samples. */
+#define SAMPLE_INTERVAL 1000
+
+/** Number of distinct source lines the profiler can keep counts for. */
+#define PROFILE_BUCKETS 4096
+
+/**
+  Start taking samples.  This installs the SIGPROF handler, starts the
+  profiling timer and arranges for the histogram to be printed to
+  standard error when the program exits.
+*/
+void startProfile();
+
+/**
+  Stop the profiling timer and print a histogram of the samples taken
+  so far, busiest lines first.
+  @param fp stream to print the report to.
+*/
+void reportProfile(FILE *fp);
+
+#endif
@@ -0,0 +1,115 @@
+/**
+  @file repl.c
+  @author Maggie Lin
+
+  Interactive mode.  Syntax errors are recovered from by having the
+  parser's error handler jump back to the top of the read loop.  A
+  runtime error still ends the program, just like it does when running
+  a file.
+*/
+
+#include "repl.h"
+#include "parse.h"
+#include "syntax.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+
+/** Initial capacity for the list of statements that have been run. */
+#define INITIAL_HISTORY 16
+
+/** Where to go back to after a syntax error. */
+static jmp_buf recover;
+
+/** Statements that have been parsed, so they can be run again. */
+static Stmt **history = NULL;
+
+/** Number of statements in the history. */
+static int historyCount = 0;
+
+/** Capacity of the history list. */
+static int historyCap = 0;
+
+/**
+  Syntax error handler for interactive mode.  It prints the message,
+  then goes back to the read loop instead of exiting.
+  @param msg complete error message.
+*/
+static void recoverFromSyntaxError(char const *msg)
+{
+  fputs(msg, stderr);
+  longjmp(recover, 1);
+}
+
+/**
+  Add a statement to the end of the history.
+  @param stmt statement to add.
+*/
+static void addHistory(Stmt *stmt)
+{
+  if (historyCount >= historyCap) {
+    historyCap = historyCap ? historyCap * DOUBLE : INITIAL_HISTORY;
+    history = (Stmt **) realloc(history, historyCap * sizeof(Stmt *));
+  }
+  history[historyCount++] = stmt;
+}
+
+/**
+  Run a command given on a line starting with a colon.
+  @param line rest of the line, after the colon.
+  @param env environment to run statements in.
+*/
+static void runCommand(char const *line, Environment *env)
+{
+  char cmd[MAX_TOKEN + 1];
+  int n = historyCount;
+  int matched = sscanf(line, "%s %d", cmd, &n);
+
+  if (matched < 1 || strcmp(cmd, "rerun") != 0) {
+    fprintf(stderr, "Unknown command\n");
+    return;
+  }
+
+  if (n < 1 || n > historyCount) {
+    fprintf(stderr, "No statement %d\n", n);
+    return;
+  }
+
+  executeStmt(history[n - 1], env);
+}
+
+void runRepl(FILE *fp, Environment *env)
+{
+  // Results should show up as soon as a statement runs, even if the
+  // output is a pipe.
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  setSyntaxErrorHandler(recoverFromSyntaxError);
+
+  // After a syntax error, we come back here and skip the rest of the line.
+  if (setjmp(recover))
+    resetParser(fp);
+
+  char tok[MAX_TOKEN + 1];
+  while (parseToken(tok, fp)) {
+    if (strcmp(tok, ":") == 0) {
+      char line[MAX_TOKEN + 1];
+      parseRestOfLine(line, fp);
+      runCommand(line, env);
+    } else {
+      Stmt *stmt = parseStmt(tok, fp);
+      addHistory(stmt);
+      executeStmt(stmt, env);
+    }
+    fflush(stdout);
+  }
+
+  setSyntaxErrorHandler(NULL);
+
+  // We're done with the statements now.
+  for (int i = 0; i < historyCount; i++)
+    history[i]->destroy(history[i]);
+  free(history);
+  history = NULL;
+  historyCount = historyCap = 0;
+}
@@ -0,0 +1,33 @@
+/**
+  @file repl.h
+  @author Maggie Lin
+
+  Interactive mode.  Statements are read one at a time from an input
+  stream, like standard input or a pipe from another program, and each
+  one runs as soon as it's parsed, in the same environment as the ones
+  before it.  Output is flushed after every statement.
+*/
+
+#ifndef _REPL_H_
+#define _REPL_H_
+
+#include <stdio.h>
+
+#include "value.h"
+
+/**
+  Read and run statements from the given stream until it ends.  A
+  syntax error is reported and the rest of its line is skipped, then
+  reading continues with the next line.  Each statement that parses is
+  kept and numbered, starting from 1, so a line with a command like
+  these can run it again:
+
+    :rerun       run the most recent statement again.
+    :rerun N     run statement number N again.
+
+  @param fp stream to read statements and commands from.
+  @param env environment to run the statements in.
+*/
+void runRepl(FILE *fp, Environment *env);
+
+#endif
@@ -0,0 +1,465 @@
+/**
+  @file snapshot.c
+  @author Maggie Lin
+
+  Environment snapshots.  A snapshot file is a header followed by
+  tables of variables, sequences, maps and map entries, then the
+  elements of all the sequences.  Sequences and maps are referred to by
+  their index in their table and elements by their offset in the
+  element area, so nothing depends on where the file is mapped.
+*/
+
+#define _XOPEN_SOURCE 700
+
+#include "snapshot.h"
+#include "memstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Header at the start of every snapshot file. */
+typedef struct {
+  /** Always SNAPSHOT_MAGIC. */
+  uint32_t magic;
+
+  /** Always SNAPSHOT_VERSION. */
+  uint32_t version;
+
+  /** Number of variables. */
+  uint32_t vars;
+
+  /** Number of sequences. */
+  uint32_t seqs;
+
+  /** Number of maps. */
+  uint32_t maps;
+
+  /** Number of entries in all the maps. */
+  uint32_t entries;
+
+  /** Number of sequence elements. */
+  uint64_t words;
+} SnapHeader;
+
+/** A saved value, an int or a reference to a saved sequence or map. */
+typedef struct {
+  /** Type of the value. */
+  int32_t type;
+
+  /** The int, or the index of the sequence or map. */
+  int32_t val;
+} SnapValue;
+
+/** A saved variable. */
+typedef struct {
+  /** Name of the variable. */
+  char name[MAX_VAR_NAME + 1];
+
+  /** Value of the variable. */
+  SnapValue val;
+} SnapVar;
+
+/** A saved sequence. */
+typedef struct {
+  /** Number of elements. */
+  uint32_t count;
+
+  /** Offset of the first element in the element area. */
+  uint64_t start;
+} SnapSeq;
+
+/** A saved map. */
+typedef struct {
+  /** Number of keys. */
+  uint32_t count;
+
+  /** Index of its first entry in the entry table. */
+  uint32_t first;
+} SnapMap;
+
+/** A saved key and value from a map. */
+typedef struct {
+  /** The key. */
+  int32_t key;
+
+  /** Value stored under the key. */
+  SnapValue val;
+} SnapEntry;
+
+/** Hidden implementation of a mapped snapshot. */
+struct SnapshotStruct {
+  /** Start of the mapped file. */
+  void *map;
+
+  /** Size of the mapped file. */
+  size_t size;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Saving
+
+/**
+  List of the distinct sequences or maps we've found while saving, with
+  a hash table to find the index of each one.
+*/
+typedef struct {
+  /** Sequences or maps in the order they were found. */
+  void **list;
+
+  /** Number of items in the list. */
+  int len;
+
+  /** Hash table of indices into list, -1 for an empty slot. */
+  int *table;
+
+  /** Number of slots in the table, a power of two. */
+  int cap;
+} PtrSet;
+
+/**
+  Initialize an empty set of pointers.
+  @param set set to initialize.
+*/
+static void initPtrSet(PtrSet *set)
+{
+  set->len = 0;
+  set->cap = INIT_CAP + 3;
+  set->list = (void **) malloc(set->cap * sizeof(void *));
+  set->table = (int *) malloc(set->cap * sizeof(int));
+  memset(set->table, -1, set->cap * sizeof(int));
+}
+
+/**
+  Free the memory used by a set of pointers.
+  @param set set to free.
+*/
+static void freePtrSet(PtrSet *set)
+{
+  free(set->list);
+  free(set->table);
+}
+
+/**
+  Find the table slot for the given pointer, either the one holding it
+  or the empty slot where it would go.
+  @param set set to search.
+  @param ptr pointer to look for.
+  @return index of the slot.
+*/
+static int findPtr(PtrSet *set, void *ptr)
+{
+  unsigned mask = set->cap - 1;
+  unsigned pos = (unsigned)((uintptr_t)ptr >> 4) * 2654435769u & mask;
+  while (set->table[pos] >= 0 && set->list[set->table[pos]] != ptr)
+    pos = (pos + 1) & mask;
+  return pos;
+}
+
+/**
+  Add a pointer to the set, if it's not already there.
+  @param set set to add to.
+  @param ptr pointer to add.
+  @return true if the pointer was new.
+*/
+static bool addPtr(PtrSet *set, void *ptr)
+{
+  int pos = findPtr(set, ptr);
+  if (set->table[pos] >= 0)
+    return false;
+
+  // Keep the table no more than half full.
+  if ((set->len + 1) * DOUBLE > set->cap) {
+    set->cap *= DOUBLE;
+    set->list = (void **) realloc(set->list, set->cap * sizeof(void *));
+    set->table = (int *) realloc(set->table, set->cap * sizeof(int));
+    memset(set->table, -1, set->cap * sizeof(int));
+    for (int i = 0; i < set->len; i++)
+      set->table[findPtr(set, set->list[i])] = i;
+    pos = findPtr(set, ptr);
+  }
+
+  set->table[pos] = set->len;
+  set->list[set->len++] = ptr;
+  return true;
+}
+
+/**
+  Return the index of a pointer that's already in the set.
+  @param set set to look in.
+  @param ptr pointer to look for.
+  @return its index in the list.
+*/
+static int ptrIndex(PtrSet *set, void *ptr)
+{
+  return set->table[findPtr(set, ptr)];
+}
+
+/**
+  Add the sequence or map in a value to the right set, if it's not
+  there already.  Maps are added to the end of their list, so their
+  entries get visited later.
+  @param val value to visit.
+  @param seqs set of sequences found so far.
+  @param maps set of maps found so far.
+*/
+static void visitValue(Value val, PtrSet *seqs, PtrSet *maps)
+{
+  if (val.vtype == SeqType)
+    addPtr(seqs, val.sval);
+  else if (val.vtype == MapType)
+    addPtr(maps, val.mval);
+}
+
+/**
+  Convert a value to its saved form.
+  @param val value to convert.
+  @param seqs set of all the sequences being saved.
+  @param maps set of all the maps being saved.
+  @return saved form of the value.
+*/
+static SnapValue snapValue(Value val, PtrSet *seqs, PtrSet *maps)
+{
+  SnapValue sv = { val.vtype, val.ival };
+  if (val.vtype == SeqType)
+    sv.val = ptrIndex(seqs, val.sval);
+  else if (val.vtype == MapType)
+    sv.val = ptrIndex(maps, val.mval);
+  return sv;
+}
+
+bool saveSnapshot(char const *filename, Environment *env)
+{
+  // Find every sequence and map we can reach from a variable.  The map
+  // list grows as we go, so this also visits maps inside maps.
+  PtrSet seqs, maps;
+  initPtrSet(&seqs);
+  initPtrSet(&maps);
+  int vars = variableCount(env);
+  for (int i = 0; i < vars; i++)
+    visitValue(variableValue(env, i), &seqs, &maps);
+
+  uint32_t entries = 0;
+  for (int m = 0; m < maps.len; m++) {
+    Map *map = maps.list[m];
+    for (int i = 0; i < map->capacity; i++)
+      if (map->slots[i].used)
+        visitValue(map->slots[i].val, &seqs, &maps);
+    entries += map->count;
+  }
+
+  SnapHeader head;
+  memset(&head, 0, sizeof(head));
+  head.magic = SNAPSHOT_MAGIC;
+  head.version = SNAPSHOT_VERSION;
+  head.vars = vars;
+  head.seqs = seqs.len;
+  head.maps = maps.len;
+  head.entries = entries;
+  for (int s = 0; s < seqs.len; s++)
+    head.words += ((Sequence *)seqs.list[s])->count;
+
+  // Write to a temporary file, then move it into place.
+  char tmpname[FILENAME_MAX];
+  snprintf(tmpname, sizeof(tmpname), "%s.%ld.tmp", filename, (long)getpid());
+  FILE *fp = fopen(tmpname, "wb");
+  if (!fp) {
+    freePtrSet(&seqs);
+    freePtrSet(&maps);
+    return false;
+  }
+
+  bool ok = fwrite(&head, sizeof(head), 1, fp) == 1;
+
+  for (int i = 0; ok && i < vars; i++) {
+    SnapVar sv;
+    memset(&sv, 0, sizeof(sv));
+    strcpy(sv.name, variableName(env, i));
+    sv.val = snapValue(variableValue(env, i), &seqs, &maps);
+    ok = fwrite(&sv, sizeof(sv), 1, fp) == 1;
+  }
+
+  uint64_t start = 0;
+  for (int s = 0; ok && s < seqs.len; s++) {
+    SnapSeq ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.count = ((Sequence *)seqs.list[s])->count;
+    ss.start = start;
+    start += ss.count;
+    ok = fwrite(&ss, sizeof(ss), 1, fp) == 1;
+  }
+
+  uint32_t first = 0;
+  for (int m = 0; ok && m < maps.len; m++) {
+    SnapMap sm = { ((Map *)maps.list[m])->count, first };
+    first += sm.count;
+    ok = fwrite(&sm, sizeof(sm), 1, fp) == 1;
+  }
+
+  for (int m = 0; ok && m < maps.len; m++) {
+    Map *map = maps.list[m];
+    for (int i = 0; ok && i < map->capacity; i++)
+      if (map->slots[i].used) {
+        SnapEntry se;
+        memset(&se, 0, sizeof(se));
+        se.key = map->slots[i].key;
+        se.val = snapValue(map->slots[i].val, &seqs, &maps);
+        ok = fwrite(&se, sizeof(se), 1, fp) == 1;
+      }
+  }
+
+  for (int s = 0; ok && s < seqs.len; s++) {
+    Sequence *seq = seqs.list[s];
+    ok = fwrite(seq->list, sizeof(int), seq->count, fp) == seq->count;
+  }
+
+  freePtrSet(&seqs);
+  freePtrSet(&maps);
+
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok || rename(tmpname, filename) != 0) {
+    remove(tmpname);
+    return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loading
+
+/**
+  Check that a saved value is an int or refers to a sequence or map
+  that's really in the snapshot.
+  @param sv saved value to check.
+  @param head header of the snapshot.
+  @return true if the value is valid.
+*/
+static bool validValue(SnapValue sv, SnapHeader const *head)
+{
+  if (sv.type == IntType)
+    return true;
+  if (sv.type == SeqType)
+    return sv.val >= 0 && sv.val < head->seqs;
+  if (sv.type == MapType)
+    return sv.val >= 0 && sv.val < head->maps;
+  return false;
+}
+
+/**
+  Convert a saved value back to a value, grabbing a reference to any
+  sequence or map for the caller.
+  @param sv saved value.
+  @param seqs sequences loaded from the snapshot.
+  @param maps maps loaded from the snapshot.
+  @return the value.
+*/
+static Value loadValue(SnapValue sv, Sequence **seqs, Map **maps)
+{
+  Value val = { IntType, .ival = sv.val };
+  if (sv.type == SeqType)
+    val = (Value){ SeqType, .sval = seqs[sv.val] };
+  else if (sv.type == MapType)
+    val = (Value){ MapType, .mval = maps[sv.val] };
+  grabValue(val);
+  return val;
+}
+
+Snapshot *loadSnapshot(char const *filename, Environment *env)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(SnapHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  // Make sure the file is exactly as big as the header says.
+  SnapHeader const *head = map;
+  bool ok = head->magic == SNAPSHOT_MAGIC &&
+    head->version == SNAPSHOT_VERSION &&
+    head->words <= st.st_size / sizeof(int) &&
+    sizeof(SnapHeader) + head->vars * (uint64_t)sizeof(SnapVar) +
+    head->seqs * (uint64_t)sizeof(SnapSeq) +
+    head->maps * (uint64_t)sizeof(SnapMap) +
+    head->entries * (uint64_t)sizeof(SnapEntry) +
+    head->words * sizeof(int) == st.st_size;
+  if (!ok) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  // Find each table.
+  SnapVar const *vars = (SnapVar const *)(head + 1);
+  SnapSeq const *sseqs = (SnapSeq const *)(vars + head->vars);
+  SnapMap const *smaps = (SnapMap const *)(sseqs + head->seqs);
+  SnapEntry const *entries = (SnapEntry const *)(smaps + head->maps);
+  int *words = (int *)(entries + head->entries);
+
+  // Then, check everything that refers to something else in the file.
+  for (uint32_t i = 0; ok && i < head->vars; i++)
+    ok = memchr(vars[i].name, '\0', sizeof(vars[i].name)) &&
+      validValue(vars[i].val, head);
+  for (uint32_t i = 0; ok && i < head->seqs; i++)
+    ok = sseqs[i].start <= head->words &&
+      sseqs[i].count <= head->words - sseqs[i].start;
+  for (uint32_t i = 0; ok && i < head->maps; i++)
+    ok = smaps[i].first <= head->entries &&
+      smaps[i].count <= head->entries - smaps[i].first;
+  for (uint32_t i = 0; ok && i < head->entries; i++)
+    ok = validValue(entries[i].val, head);
+
+  if (!ok) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  // Sequences use their elements right from the file, but maps have to
+  // be rebuilt.  Make them all first, since they can refer to each other.
+  Sequence **seqs = (Sequence **) malloc((head->seqs + 1) * sizeof(Sequence *));
+  for (uint32_t i = 0; i < head->seqs; i++)
+    seqs[i] = makeMappedSequence(sseqs[i].count, words + sseqs[i].start);
+
+  Map **maps = (Map **) malloc((head->maps + 1) * sizeof(Map *));
+  for (uint32_t i = 0; i < head->maps; i++)
+    maps[i] = makeMap();
+  for (uint32_t i = 0; i < head->maps; i++)
+    for (uint32_t j = 0; j < smaps[i].count; j++) {
+      SnapEntry const *se = &entries[smaps[i].first + j];
+      mapSet(maps[i], se->key, loadValue(se->val, seqs, maps));
+    }
+
+  for (uint32_t i = 0; i < head->vars; i++)
+    setVariable(env, vars[i].name, loadValue(vars[i].val, seqs, maps));
+
+  // Now the variables and maps hold all the references they need.
+  for (uint32_t i = 0; i < head->seqs; i++)
+    releaseSequence(seqs[i]);
+  for (uint32_t i = 0; i < head->maps; i++)
+    releaseMap(maps[i]);
+  free(seqs);
+  free(maps);
+
+  Snapshot *snap = (Snapshot *) malloc(sizeof(Snapshot));
+  snap->map = map;
+  snap->size = st.st_size;
+  return snap;
+}
+
+void closeSnapshot(Snapshot *snap)
+{
+  munmap(snap->map, snap->size);
+  free(snap);
+}
@@ -0,0 +1,59 @@
+/**
+  @file snapshot.h
+  @author Maggie Lin
+
+  Environment snapshots.  After a program runs, its variables and every
+  sequence and map they reach can be saved to a file.  A later run can
+  start from that state by mapping the file into memory, without
+  running the setup program again.  Sequence elements are used right
+  out of the mapped file, and only copied when a sequence is changed.
+*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+
+#include "value.h"
+
+/** Value identifying a file as an environment snapshot. */
+#define SNAPSHOT_MAGIC 0x564e4550
+
+/** Version of the snapshot format, changed whenever it changes. */
+#define SNAPSHOT_VERSION 1
+
+/**
+  Short name for a snapshot that's been mapped into memory.  Its
+  definition is an implementation detail of the snapshot component.
+*/
+typedef struct SnapshotStruct Snapshot;
+
+/**
+  Save every variable in the given environment to a snapshot file,
+  along with all the sequences and maps they reach.  Values shared by
+  more than one variable are saved once, and still shared when the
+  snapshot is loaded.
+  @param filename name of the snapshot file.
+  @param env environment to save.
+  @return true if the snapshot was written successfully.
+*/
+bool saveSnapshot(char const *filename, Environment *env);
+
+/**
+  Map a snapshot file into memory and set the variables it contains in
+  the given environment.
+  @param filename name of the snapshot file.
+  @param env environment to add the variables to.
+  @return the mapped snapshot, or null if the file couldn't be read or
+  isn't a valid snapshot.
+*/
+Snapshot *loadSnapshot(char const *filename, Environment *env);
+
+/**
+  Unmap and free the given snapshot.  Every sequence loaded from it
+  must already have been freed.
+  @param snap snapshot to close.
+*/
+void closeSnapshot(Snapshot *snap);
+
+#endif
@@ -8,9 +8,11 @@
 */
 
 #include "syntax.h"
+#include "memstats.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 
 //////////////////////////////////////////////////////////////////////
 // Error-reporting functions
@@ -44,6 +46,123 @@ static void requireSeqType(Value const *v)
     reportTypeMismatch();
 }
 
+/**
+  Allocate memory for an expression or statement object, keeping count
+  of how many there are and how much memory they use.
+  @param size number of bytes in the object.
+  @return pointer to the new, uninitialized object.
+*/
+static void *allocNode(size_t size)
+{
+  // The parser may be on its own thread, so these are updated atomically.
+  __atomic_add_fetch(&memStats.nodeCount, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&memStats.nodeBytes, size, __ATOMIC_RELAXED);
+  return malloc(size);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Expression tables
+
+/** Initial capacity for a table of expressions. */
+#define EXPR_TABLE_CAP 16
+
+/** One expression in a hash table of expressions. */
+typedef struct {
+  /** Hash of the expression, or anything if expr is null. */
+  unsigned hash;
+
+  /** The expression, or null if this entry is unused. */
+  Expr *expr;
+
+  /** Where the expression is stored in its parent, if it's needed. */
+  Expr **slot;
+
+  /** Shared node wrapping the expression, once it has one. */
+  Expr *shared;
+} ExprEntry;
+
+/** Open-addressing hash table of expressions, kept at most half full. */
+typedef struct {
+  /** Number of entries in use. */
+  int count;
+
+  /** Capacity of the table, always a power of 2 (or zero). */
+  int cap;
+
+  /** Entries in the table. */
+  ExprEntry *list;
+} ExprTable;
+
+/**
+  Mix one more value into a hash.
+  @param hash hash so far.
+  @param val value to add to it.
+  @return new hash.
+*/
+static unsigned mixHash(unsigned hash, unsigned val)
+{
+  return (hash ^ val) * 16777619u;
+}
+
+/**
+  Find the entry for an expression in a table.  If it's not there, this
+  returns the unused entry where it belongs, and the caller can fill it
+  in and increment the table's count.
+  @param table table to look in.
+  @param hash hash of the expression we're looking for.
+  @param key expression we're looking for.
+  @param same function to tell if two expressions are the same.
+  @return entry for the expression, or the unused entry where it goes.
+*/
+static ExprEntry *findExpr(ExprTable *table, unsigned hash, Expr *key,
+                           bool (*same)(Expr *a, Expr *b))
+{
+  // Make room for one more, so the caller can add key if it's new.
+  if (2 * (table->count + 1) > table->cap) {
+    int cap = table->cap ? table->cap * DOUBLE : EXPR_TABLE_CAP;
+    ExprEntry *list = (ExprEntry *) calloc(cap, sizeof(ExprEntry));
+    for (int i = 0; i < table->cap; i++)
+      if (table->list[i].expr) {
+        int j = table->list[i].hash & (cap - 1);
+        while (list[j].expr)
+          j = (j + 1) & (cap - 1);
+        list[j] = table->list[i];
+      }
+    free(table->list);
+    table->list = list;
+    table->cap = cap;
+  }
+
+  int i = hash & (table->cap - 1);
+  while (table->list[i].expr &&
+         (table->list[i].hash != hash || !same(table->list[i].expr, key)))
+    i = (i + 1) & (table->cap - 1);
+  return &table->list[i];
+}
+
+/**
+  Literal expressions are interned, so the whole program shares one node
+  for each literal value, and these nodes are never freed.  Only the
+  thread that's parsing makes literals, so this needs no locking.
+*/
+static ExprTable literals = {0, 0, NULL};
+
+/**
+  Implementation of destroy for interned literals, which do nothing,
+  since the node may be used elsewhere in the program.
+  @param expr Expression to destroy.
+*/
+static void destroyInterned(Expr *expr)
+{
+}
+
+/**
+  Counter that's changed whenever a value cached by a shared
+  subexpression might be out of date, at the start of every statement
+  and after every function call.
+*/
+static unsigned long exprEpoch = 1;
+
 //////////////////////////////////////////////////////////////////////
 // LiteralInt
 
@@ -77,33 +196,155 @@ static Value evalLiteralInt(Expr *expr, Environment *env)
 }
 
 /**
-  Implementation of destroy for LiteralInt expressions. Frees the space
-  allocated to a LiteralInt expression.
-  @param expr Expression to destroy.
+  Tell if two interned literal ints have the same value.
+  @param a first expression, a LiteralInt.
+  @param b second expression, a LiteralInt.
+  @return true if they're the same.
 */
-static void destroyLiteralInt(Expr *expr)
+static bool sameLiteralInt(Expr *a, Expr *b)
 {
-  // This object is just one block of memory.  We can free it without
-  // even having to type-cast its pointer.
-  free(expr);
+  return a->eval == evalLiteralInt &&
+    ((LiteralInt *)a)->val == ((LiteralInt *)b)->val;
 }
 
 Expr *makeLiteralInt(int val)
 {
+  // Use the interned node for this value, if there already is one.
+  LiteralInt key = {evalLiteralInt, destroyInterned, val};
+  unsigned hash = mixHash(1, val);
+  ExprEntry *entry = findExpr(&literals, hash, (Expr *) &key, sameLiteralInt);
+  if (entry->expr)
+    return entry->expr;
+
   // Allocate space for the LiteralInt object
-  LiteralInt *this = (LiteralInt *) malloc(sizeof(LiteralInt));
+  LiteralInt *this = (LiteralInt *) allocNode(sizeof(LiteralInt));
 
-  // Remember the pointers to functions for evaluating and destroying ourself.
+  // Remember the pointers to functions for evaluating and destroying
+  // ourself.  Other expressions may be using this node, so it's never
+  // destroyed.
   this->eval = evalLiteralInt;
-  this->destroy = destroyLiteralInt;
+  this->destroy = destroyInterned;
 
   // Remember the integer value we contain.
   this->val = val;
 
-  // Return the result, as an instance of the Expr superclass.
+  // Add it to the table of literals and return the result, as an
+  // instance of the Expr superclass.
+  entry->hash = hash;
+  entry->expr = (Expr *) this;
+  literals.count++;
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ConstSeqExpr
+
+/**
+  Representation for a sequence whose elements are all known at parse
+  time, like a string literal.  Evaluating it just copies the values
+  into a new sequence.
+*/
+typedef struct {
+  /** An evaluate function for a ConstSeqExpr. */
+  Value (*eval)(Expr *expr, Environment *env);
+  /** A destroy function for a ConstSeqExpr. */
+  void (*destroy)(Expr *expr);
+
+  /** Number of values in the sequence. */
+  int count;
+
+  /** Values for the sequence. */
+  int const *vals;
+} ConstSeqExpr;
+
+/**
+  Implementation of eval for ConstSeqExpr expressions.
+  @param expr Expression to evaluate.
+  @param env The Environment.
+  @return Value with a new sequence containing a copy of the values.
+*/
+static Value evalConstSequence(Expr *expr, Environment *env)
+{
+  // If this function gets called, expr must really be a ConstSeqExpr.
+  ConstSeqExpr *this = (ConstSeqExpr *)expr;
+
+  Sequence *seq = makeSequence();
+  reserveSequence(seq, this->count);
+  memcpy(seq->list, this->vals, this->count * sizeof(int));
+  seq->count = this->count;
+  return (Value){SeqType, .sval = seq};
+}
+
+/**
+  Implementation of destroy for ConstSeqExpr expressions that aren't
+  interned.  The values belong to someone else.
+  @param expr Expression to destroy.
+*/
+static void destroyConstSequence(Expr *expr)
+{
+  free(expr);
+}
+
+/**
+  Make a constant sequence expression.
+  @param len number of values in the sequence.
+  @param vals values for the sequence, which belong to someone else
+  and will outlive the expression.
+  @return a new, dynamically allocated expression.
+*/
+static Expr *buildConstSequence(int len, int const *vals)
+{
+  ConstSeqExpr *this = (ConstSeqExpr *) allocNode(sizeof(ConstSeqExpr));
+  this->eval = evalConstSequence;
+  this->destroy = destroyConstSequence;
+  this->count = len;
+  this->vals = vals;
   return (Expr *) this;
 }
 
+/**
+  Tell if two constant sequences have the same values.
+  @param a first expression, which may not be a ConstSeqExpr.
+  @param b second expression, a ConstSeqExpr.
+  @return true if they're the same.
+*/
+static bool sameConstSequence(Expr *a, Expr *b)
+{
+  ConstSeqExpr *x = (ConstSeqExpr *)a;
+  ConstSeqExpr *y = (ConstSeqExpr *)b;
+  return a->eval == evalConstSequence && x->count == y->count &&
+    memcmp(x->vals, y->vals, x->count * sizeof(int)) == 0;
+}
+
+/**
+  Get the interned constant sequence expression for the given values,
+  making one if there isn't one already.  Like literal ints, these are
+  shared by the whole program and never freed.
+  @param len number of values in the sequence.
+  @param vals values for the sequence.  The interned expression takes
+  ownership of this list, or frees it if it's not needed.
+  @return the interned expression.
+*/
+static Expr *internConstSequence(int len, int *vals)
+{
+  unsigned hash = 2;
+  for (int i = 0; i < len; i++)
+    hash = mixHash(hash, vals[i]);
+
+  ConstSeqExpr key = {evalConstSequence, destroyInterned, len, vals};
+  ExprEntry *entry = findExpr(&literals, hash, (Expr *) &key,
+                              sameConstSequence);
+  if (entry->expr) {
+    free(vals);
+    return entry->expr;
+  }
+
+  entry->hash = hash;
+  entry->expr = buildConstSequence(len, vals);
+  entry->expr->destroy = destroyInterned;
+  literals.count++;
+  return entry->expr;
+}
 
 //////////////////////////////////////////////////////////////////////
 // SeqExpr
@@ -138,10 +379,7 @@ static Value evalSequenceInitializer(Expr *expr, Environment *env)
   SeqExpr *this = (SeqExpr *)expr;
   Sequence *seq = makeSequence();
   // grabSequence(seq);
-  if (this->count >= seq->capacity) {
-    seq->capacity = this->count;
-    seq->list = (int * ) realloc(seq->list, seq->capacity * sizeof(int));
-  }
+  reserveSequence(seq, this->count);
   for (int i = 0; i < this->count; i++) {
     seq->list[i] = this->exprs[i]->eval(this->exprs[i], env).ival;
     seq->count++;
@@ -168,8 +406,23 @@ static void destroySequenceInitializer(Expr *expr)
 
 Expr *makeSequenceInitializer(int len, Expr *eList[])
 {
+  // If every element is a literal int, we can make a constant sequence
+  // instead and throw away the element expressions.
+  int lits = 0;
+  while (lits < len && eList[lits]->eval == evalLiteralInt)
+    lits++;
+  if (len > 0 && lits == len) {
+    int *vals = (int *) malloc(len * sizeof(int));
+    for (int i = 0; i < len; i++) {
+      vals[i] = ((LiteralInt *)eList[i])->val;
+      eList[i]->destroy(eList[i]);
+    }
+    free(eList);
+    return internConstSequence(len, vals);
+  }
+
   // Allocate space for the LiteralSeq object
-  SeqExpr *this = (SeqExpr *) malloc(sizeof(SeqExpr));
+  SeqExpr *this = (SeqExpr *) allocNode(sizeof(SeqExpr));
   // Sequence *seq = makeSequence();
 
   // this->seq = makeSequence();
@@ -184,6 +437,75 @@ Expr *makeSequenceInitializer(int len, Expr *eList[])
   return (Expr *) this;
 }
 
+//////////////////////////////////////////////////////////////////////
+// MapExpr
+
+/**
+  Representation for a map literal, a subclass of Expr that evaluates
+  to a new Map.
+*/
+typedef struct {
+  /** An evaluate function for a MapExpr. */
+  Value (*eval)(Expr *expr, Environment *env);
+  /** A destroy function for a MapExpr. */
+  void (*destroy)(Expr *expr);
+
+  /** Number of key / value pairs in the literal. */
+  int count;
+
+  /** Expressions for the keys and values, alternating key then value. */
+  Expr **exprs;
+} MapExpr;
+
+/**
+  Implementation of eval for MapExpr expressions
+  @param expr Expression to evaluate into a Map.
+  @param env The Environment.
+  @return Value with the new map.
+*/
+static Value evalMapInitializer(Expr *expr, Environment *env)
+{
+  // If this function gets called, expr must really be a MapExpr.
+  MapExpr *this = (MapExpr *)expr;
+  Map *map = makeMap();
+  for (int i = 0; i < this->count; i++) {
+    Expr *kexpr = this->exprs[2 * i];
+    Expr *vexpr = this->exprs[2 * i + 1];
+    Value key = kexpr->eval(kexpr, env);
+    requireIntType(&key);
+    mapSet(map, key.ival, vexpr->eval(vexpr, env));
+  }
+  return (Value){MapType, .mval = map};
+}
+
+/**
+  Implementation of destroy for MapExpr expressions.
+  @param expr Expression to destroy.
+*/
+static void destroyMapInitializer(Expr *expr)
+{
+  MapExpr *this = (MapExpr *)expr;
+  for (int i = 0; i < 2 * this->count; i++)
+    this->exprs[i]->destroy(this->exprs[i]);
+
+  free(this->exprs);
+  free(this);
+}
+
+Expr *makeMapInitializer(int len, Expr *eList[])
+{
+  MapExpr *this = (MapExpr *) allocNode(sizeof(MapExpr));
+  this->count = len;
+  this->exprs = eList;
+
+  // Remember the pointers to functions for evaluating and destroying ourself.
+  this->eval = evalMapInitializer;
+  this->destroy = destroyMapInitializer;
+
+  // Return the result, as an instance of the Expr superclass.
+  return (Expr *) this;
+}
+
 //////////////////////////////////////////////////////////////////////
 // SimpleExpr Struct
 
@@ -239,7 +561,7 @@ static Expr *buildSimpleExpr(Expr *expr1, Expr *expr2,
 {
   // Allocate space for a new SimpleExpr and fill in the pointer for
   // its destroy function.
-  SimpleExpr *this = (SimpleExpr *) malloc(sizeof(SimpleExpr));
+  SimpleExpr *this = (SimpleExpr *) allocNode(sizeof(SimpleExpr));
   this->destroy = destroySimpleExpr;
 
   // Fill in the two parameters and the eval funciton.
@@ -471,14 +793,10 @@ static Value evalLess(Expr *expr, Environment *env)
   Value v1 = this->expr1->eval(this->expr1, env);
   Value v2 = this->expr2->eval(this->expr2, env);
 
-  // Make sure the operands are both the same type.
-  if (v1.vtype != v2.vtype) {
-    if (v1.vtype == SeqType) {
-      releaseSequence(v1.sval);
-    }
-    if (v2.vtype == SeqType) {
-      releaseSequence(v2.sval);
-    }
+  // Make sure the operands are both the same type, and not maps.
+  if (v1.vtype != v2.vtype || v1.vtype == MapType) {
+    releaseValue(v1);
+    releaseValue(v2);
     reportTypeMismatch();
   }
 
@@ -547,6 +865,12 @@ static Value evalEquals(Expr *expr, Environment *env)
   // Make sure the same type.
   if (v1.vtype == IntType && v2.vtype == IntType) {
     return (Value){IntType, .ival = (v1.ival == v2.ival)};
+  } else if (v1.vtype == MapType || v2.vtype == MapType) {
+    // A map is only equal to itself.
+    bool same = v1.vtype == v2.vtype && v1.mval == v2.mval;
+    releaseValue(v1);
+    releaseValue(v2);
+    return (Value){IntType, .ival = same};
   } else {
     // Replace with code to permit sequence-sequence comparison.
     // A sequence can also be compared to an int, but they should
@@ -599,7 +923,8 @@ Expr *makeEquals(Expr *left, Expr *right)
   Implementation of eval for Length.
   @param expr Expression to evaluate.
   @param env The Environment.
-  @return length of the given sequence.
+  @return length of the given sequence, or number of keys in the given
+  map.
 */
 static Value evalLen(Expr *expr, Environment *env)
 {
@@ -608,6 +933,11 @@ static Value evalLen(Expr *expr, Environment *env)
 
   // Evaluate our operand.
   Value v1 = this->expr1->eval(this->expr1, env);
+  if (v1.vtype == MapType) {
+    int value = v1.mval->count;
+    releaseMap(v1.mval);
+    return (Value){IntType, .ival = value};
+  }
   requireSeqType(&v1);
   
   int value = v1.sval->count;
@@ -621,6 +951,39 @@ Expr *makeLenExpr(Expr *expr)
   return buildSimpleExpr(expr, NULL, evalLen);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Keys of a map
+
+/** 
+  Implementation of eval for the keys operator.
+  @param expr Expression to evaluate.
+  @param env The Environment.
+  @return a new sequence with the keys of the given map, in increasing
+  order.
+*/
+static Value evalKeys(Expr *expr, Environment *env)
+{
+  // If this function gets called, expr must really be a SimpleExpr.
+  SimpleExpr *this = (SimpleExpr *)expr;
+
+  // Evaluate our operand.
+  Value v1 = this->expr1->eval(this->expr1, env);
+  if (v1.vtype != MapType) {
+    releaseValue(v1);
+    reportTypeMismatch();
+  }
+
+  Sequence *seq = mapKeys(v1.mval);
+  releaseMap(v1.mval);
+  return (Value){SeqType, .sval = seq};
+}
+
+Expr *makeKeysExpr(Expr *expr)
+{
+  // Use the convenience function to build a SimpleExpr for keys.
+  return buildSimpleExpr(expr, NULL, evalKeys);
+}
+
 //////////////////////////////////////////////////////////////////////
 // Retrieve element at index
 
@@ -628,7 +991,9 @@ Expr *makeLenExpr(Expr *expr)
   Implementation of eval for Index.
   @param expr Expression to evaluate.
   @param env The Environment.
-  @return value at the given index name.
+  @return value at the given index name, or the value stored under the
+  given key in a map.  A key that isn't in the map gives zero, like an
+  uninitialized variable.
 */
 static Value evalIndex(Expr *expr, Environment *env)
 {
@@ -638,8 +1003,25 @@ static Value evalIndex(Expr *expr, Environment *env)
   // Evaluate our left and right operands. 
   Value v1 = this->expr1->eval(this->expr1, env);
   Value v2 = this->expr2->eval(this->expr2, env);
-  requireIntType(&v2);
-  if (v2.ival > v1.sval->count - 1) {
+
+  // Make sure we have a sequence or map and an int index, releasing
+  // whatever we evaluated before reporting an error.
+  if (v1.vtype == IntType || v2.vtype != IntType) {
+    releaseValue(v1);
+    releaseValue(v2);
+    reportTypeMismatch();
+  }
+
+  if (v1.vtype == MapType) {
+    Value *found = mapLookup(v1.mval, v2.ival);
+    Value value = found ? *found : (Value){IntType, .ival = 0};
+    grabValue(value);
+    releaseMap(v1.mval);
+    return value;
+  }
+
+  if (v2.ival < 0 || v2.ival > v1.sval->count - 1) {
+    releaseSequence(v1.sval);
     fprintf(stderr, "Index out of bounds\n");
     exit(1);
   }
@@ -683,9 +1065,7 @@ static Value evalVariable(Expr *expr, Environment *env)
 
   // Get the value of this variable.
   Value val = lookupVariable(env, this->name);
-  if (val.vtype == SeqType) {
-    grabSequence(val.sval);
-  }
+  grabValue(val);
   return val;
 }
 
@@ -702,7 +1082,7 @@ Expr *makeVariable(char const *name)
 {
   // Allocate space for the Variable statement, and fill in its function
   // pointers and a copy of the variable name.
-  VariableExpr *this = (VariableExpr *) malloc(sizeof(VariableExpr));
+  VariableExpr *this = (VariableExpr *) allocNode(sizeof(VariableExpr));
   this->eval = evalVariable;
   this->destroy = destroyVariable;
   strcpy(this->name, name);
@@ -711,432 +1091,1913 @@ Expr *makeVariable(char const *name)
 }
 
 //////////////////////////////////////////////////////////////////////
-// SimpleStmt Struct
+// Functions and call frames
 
-/** 
-  Generic representation for a statement that contains one or two
-  expressions.  With different execute methods, this same struct
-  can be used to represent print and push statements.
+/** Limit on how deeply calls can nest, before we report an error. */
+#define MAX_CALL_DEPTH 5000
+
+/**
+  Representation of a user-defined function.  It's shared by the def
+  statement that made it and the table of defined functions, so it has
+  a reference count.
 */
 typedef struct {
-  void (*execute)(Stmt *stmt, Environment *env);
-  void (*destroy)(Stmt *stmt);
+  /** Name of the function. */
+  char name[MAX_VAR_NAME + 1];
 
-  /** First (or only) expression used by this statement. */
-  Expr *expr1;
-  /** Second expression used by this statement, or null */
-  Expr *expr2;
-} SimpleStmt;
+  /** Number of parameters, which are the first local variables. */
+  int params;
 
-/** Generic destroy function for SimpleStmt, with either one
-    or two sub-expressions. */
+  /** Number of local variables, including the parameters. */
+  int locals;
 
-/** 
-  Generic destroy function for SimpleStmt, with either one
-  or two sub-expressions.
-  @param stmt Statement to destroy.
+  /** Body of the function. */
+  Stmt *body;
+
+  /** Reference count for the function. */
+  int ref;
+} Function;
+
+/**
+  Local variables for every call in progress, one contiguous frame of
+  slots per call.  It's only reallocated when it has to grow, so calls
+  don't allocate memory.
 */
-static void destroySimpleStmt(Stmt *stmt)
-{
-  // If this function gets called, stmt must really be a SimpleStmt.
-  SimpleStmt *this = (SimpleStmt *)stmt;
+static Value *frameStack = NULL;
 
-  // Free our subexpression then the SimpleStmt object itself.
-  this->expr1->destroy(this->expr1);
-  if (this->expr2)
-    this->expr2->destroy(this->expr2);
-  free(this);
-}
+/** Capacity of frameStack. */
+static int stackCap = 0;
 
-//////////////////////////////////////////////////////////////////////
-// Print Statement
+/** Index of the first free slot, above the current frame. */
+static int stackTop = 0;
 
-/** 
-  Implementation of execute for a print statement.
-  @param stmt Statement object for Print.
-  @param env the Enviroment.
-*/
-static void executePrint(Stmt *stmt, Environment *env)
-{
-  // If this function gets called, stmt must really be a SimpleStmt.
-  SimpleStmt *this = (SimpleStmt *)stmt;
+/** Index of the first slot in the current frame. */
+static int frameBase = 0;
 
-  // Evaluate our argument.
-  Value v = this->expr1->eval(this->expr1, env);
+/** Number of calls in progress. */
+static int callDepth = 0;
 
-  // Print the value of our expression appropriately, based on its type.
-  if (v.vtype == IntType) {
-    printf("%d", v.ival);
-  } else {
-    // Replace with code to permit print a sequence as a string of
-    // ASCII character codes.
-    char seq[v.sval->count + 1];
-    for (int i = 0; i < v.sval->count; i++) {
-      seq[i] = v.sval->list[i];
-      printf("%c", seq[i]);
-    }
-    releaseSequence(v.sval);
-  }
-}
+/** List of all defined functions. */
+static Function **funcList = NULL;
 
-Stmt *makePrint(Expr *expr)
-{
-  // Allocate space for the SimpleStmt object
-  SimpleStmt *this = (SimpleStmt *) malloc(sizeof(SimpleStmt));
+/** Number of defined functions. */
+static int funcCount = 0;
 
-  // Remember the pointers to execute and destroy this statement.
-  this->execute = executePrint;
-  this->destroy = destroySimpleStmt;
+/** Capacity of funcList. */
+static int funcCap = 0;
 
-  // Remember the expression for the thing we're supposed to print.
-  this->expr1 = expr;
-  this->expr2 = NULL;
+/** Changed every time a function is defined, so call expressions know
+    when the function they found last time might not be right anymore. */
+static unsigned funcGeneration = 1;
 
-  // Return the SimpleStmt object, as an instance of the Stmt interface.
-  return (Stmt *) this;
-}
+/** Set by a return statement, so the statements around it stop early. */
+static bool returning = false;
 
-//////////////////////////////////////////////////////////////////////
-// Compound Statement
+/** Value given by the last return statement. */
+static Value returnValue;
 
-/** 
-  Representation for a compound statement, derived from Stmt.
-*/
-typedef struct {
-  void (*execute)(Stmt *stmt, Environment *env);
-  void (*destroy)(Stmt *stmt);
+/** If a return statement made a tail call, this is the function being
+    called.  Its arguments are on the stack, starting at tailBase. */
+static Function *tailFunc = NULL;
 
-  /** Number of statements in the compound. */
+/** Index of the first argument for a pending tail call. */
+static int tailBase;
+
+/** Number of arguments for a pending tail call. */
+static int tailArgs;
+
+/**
+  Make sure the frame stack has room for at least the given number of
+  slots.
+  @param slots number of slots needed.
+*/
+static void reserveStack(int slots)
+{
+  if (slots <= stackCap)
+    return;
+
+  int cap = stackCap ? stackCap : INIT_CAP;
+  while (cap < slots)
+    cap *= DOUBLE;
+  frameStack = (Value *) realloc(frameStack, cap * sizeof(Value));
+  memStats.bytesAllocated += cap * sizeof(Value);
+  stackCap = cap;
+}
+
+/**
+  Release the values in a range of stack slots.
+  @param start index of the first slot.
+  @param end index just past the last slot.
+*/
+static void releaseSlots(int start, int end)
+{
+  for (int i = start; i < end; i++)
+    releaseValue(frameStack[i]);
+}
+
+/**
+  Subtract one from the reference count for the given function,
+  freeing it if the count reaches zero.
+  @param func function to release.
+*/
+static void releaseFunction(Function *func)
+{
+  func->ref -= 1;
+  if (func->ref <= 0) {
+    func->body->destroy(func->body);
+    free(func);
+  }
+}
+
+/**
+  Add a function to the table of defined functions, replacing any
+  function that already has the same name.
+  @param func function to define.
+*/
+static void defineFunction(Function *func)
+{
+  func->ref += 1;
+  funcGeneration++;
+
+  for (int i = 0; i < funcCount; i++)
+    if (strcmp(funcList[i]->name, func->name) == 0) {
+      releaseFunction(funcList[i]);
+      funcList[i] = func;
+      return;
+    }
+
+  if (funcCount >= funcCap) {
+    funcCap = funcCap ? funcCap * DOUBLE : INIT_CAP;
+    funcList = (Function **) realloc(funcList, funcCap * sizeof(Function *));
+  }
+  funcList[funcCount++] = func;
+}
+
+/**
+  Find the function with the given name.
+  @param name name of the function.
+  @return the function, or null if there isn't one by that name.
+*/
+static Function *lookupFunction(char const *name)
+{
+  for (int i = 0; i < funcCount; i++)
+    if (strcmp(funcList[i]->name, name) == 0)
+      return funcList[i];
+  return NULL;
+}
+
+void freeFunctions()
+{
+  for (int i = 0; i < funcCount; i++)
+    releaseFunction(funcList[i]);
+  free(funcList);
+  funcList = NULL;
+  funcCount = funcCap = 0;
+
+  free(frameStack);
+  frameStack = NULL;
+  stackCap = 0;
+}
+
+/**
+  Evaluate a list of arguments, pushing each one on top of the frame
+  stack.  They're pushed as they're evaluated, so any call made while
+  evaluating an argument gets its frame above them.
+  @param argc number of arguments.
+  @param args expressions for the arguments.
+  @param env The Environment.
+  @return index of the slot holding the first argument.
+*/
+static int pushArgs(int argc, Expr **args, Environment *env)
+{
+  int base = stackTop;
+  for (int i = 0; i < argc; i++) {
+    Value v = args[i]->eval(args[i], env);
+    reserveStack(stackTop + 1);
+    frameStack[stackTop++] = v;
+  }
+  return base;
+}
+
+/**
+  Run a function, with its arguments already on the stack.  If the
+  function ends with a tail call, the called function reuses the same
+  frame, so a chain of tail calls runs in constant space.
+  @param func function to run.
+  @param base index of the first argument on the stack, which becomes
+  the start of the function's frame.
+  @param argc number of arguments.
+  @param env The Environment.
+  @return the value the function returned, or zero if it didn't
+  return a value.
+*/
+static Value runFunction(Function *func, int base, int argc, Environment *env)
+{
+  if (callDepth >= MAX_CALL_DEPTH) {
+    fprintf(stderr, "Call stack overflow\n");
+    exit(EXIT_FAILURE);
+  }
+  callDepth++;
+  int callerBase = frameBase;
+
+  bool returned;
+  while (true) {
+    if (argc != func->params) {
+      fprintf(stderr, "Wrong number of arguments\n");
+      exit(EXIT_FAILURE);
+    }
+
+    // The rest of the frame holds locals, which start out as zero.
+    reserveStack(base + func->locals);
+    for (int i = base + argc; i < base + func->locals; i++)
+      frameStack[i] = (Value){IntType, .ival = 0};
+    stackTop = base + func->locals;
+    frameBase = base;
+
+    executeStmt(func->body, env);
+    returned = returning;
+    returning = false;
+    if (!tailFunc)
+      break;
+
+    // Tail call, slide its arguments down to replace this frame.
+    releaseSlots(base, base + func->locals);
+    memmove(frameStack + base, frameStack + tailBase,
+            tailArgs * sizeof(Value));
+    func = tailFunc;
+    argc = tailArgs;
+    tailFunc = NULL;
+  }
+
+  Value result = returned ? returnValue : (Value){IntType, .ival = 0};
+  releaseSlots(base, stackTop);
+  stackTop = base;
+  frameBase = callerBase;
+  callDepth--;
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Local variable in an expression
+
+/** 
+  Representation for an occurrence of a local variable inside a
+  function, subclass of Expr.  Locals are found by their slot in the
+  current frame, not by name.
+*/
+typedef struct {
+  Value (*eval)(Expr *expr, Environment *env);
+  void (*destroy)(Expr *expr);
+
+  /** Index of the variable in its function's frame. */
+  int slot;
+} LocalExpr;
+
+/** 
+  Implementation of eval for local variables.
+  @param expr Expression to evaluate.
+  @param env The Environment.
+  @return value of the local variable.
+*/
+static Value evalLocal(Expr *expr, Environment *env)
+{
+  // If this function gets called, expr must really be a LocalExpr
+  LocalExpr *this = (LocalExpr *) expr;
+
+  Value val = frameStack[frameBase + this->slot];
+  grabValue(val);
+  return val;
+}
+
+Expr *makeLocal(int slot)
+{
+  LocalExpr *this = (LocalExpr *) allocNode(sizeof(LocalExpr));
+  this->eval = evalLocal;
+  this->destroy = destroyVariable;
+  this->slot = slot;
+
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Function call
+
+/** 
+  Representation for a call to a user-defined function, subclass of
+  Expr.
+*/
+typedef struct {
+  Value (*eval)(Expr *expr, Environment *env);
+  void (*destroy)(Expr *expr);
+
+  /** Name of the function to call. */
+  char name[MAX_VAR_NAME + 1];
+
+  /** Number of arguments. */
+  int argc;
+
+  /** Expressions for the arguments. */
+  Expr **args;
+
+  /** Function this call found the last time it was run. */
+  Function *func;
+
+  /** Value of funcGeneration when func was found. */
+  unsigned generation;
+} CallExpr;
+
+/** 
+  Find the function a call expression should run, reusing the one it
+  found last time if no functions have been defined since then.
+  @param this call expression.
+  @return function to call.
+*/
+static Function *findCallee(CallExpr *this)
+{
+  if (this->generation != funcGeneration) {
+    this->func = lookupFunction(this->name);
+    this->generation = funcGeneration;
+  }
+
+  if (!this->func) {
+    fprintf(stderr, "Undefined function\n");
+    exit(EXIT_FAILURE);
+  }
+  return this->func;
+}
+
+/** 
+  Implementation of eval for function calls.
+  @param expr Expression to evaluate.
+  @param env The Environment.
+  @return value returned by the function.
+*/
+static Value evalCall(Expr *expr, Environment *env)
+{
+  // If this function gets called, expr must really be a CallExpr
+  CallExpr *this = (CallExpr *) expr;
+
+  Function *func = findCallee(this);
+  int base = pushArgs(this->argc, this->args, env);
+  Value result = runFunction(func, base, this->argc, env);
+
+  // The function may have changed sequences the caller can see.
+  exprEpoch++;
+  return result;
+}
+
+/** 
+  Implementation of destroy for function calls.
+  @param expr Expression to destroy.
+*/
+static void destroyCall(Expr *expr)
+{
+  CallExpr *this = (CallExpr *) expr;
+  for (int i = 0; i < this->argc; i++)
+    this->args[i]->destroy(this->args[i]);
+  free(this->args);
+  free(this);
+}
+
+Expr *makeCall(char const *name, int argc, Expr **args)
+{
+  CallExpr *this = (CallExpr *) allocNode(sizeof(CallExpr));
+  this->eval = evalCall;
+  this->destroy = destroyCall;
+  strcpy(this->name, name);
+  this->argc = argc;
+  this->args = args;
+  this->func = NULL;
+  this->generation = 0;
+
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Shared subexpressions
+
+/** 
+  Representation for a subexpression that's used in more than one
+  place in a statement.  It evaluates its expression the first time
+  it's needed, then gives back the same value until exprEpoch changes.
+  Only int values are kept.  Anything else is evaluated every time.
+*/
+typedef struct {
+  Value (*eval)(Expr *expr, Environment *env);
+  void (*destroy)(Expr *expr);
+
+  /** The expression being shared. */
+  Expr *expr;
+
+  /** Number of places using this node. */
+  int uses;
+
+  /** Value of exprEpoch when val was computed. */
+  unsigned long epoch;
+
+  /** Value the expression had at that time. */
+  int val;
+} SharedExpr;
+
+/** 
+  Implementation of eval for shared subexpressions.
+  @param expr Expression to evaluate.
+  @param env The Environment.
+  @return value of the shared expression.
+*/
+static Value evalShared(Expr *expr, Environment *env)
+{
+  // If this function gets called, expr must really be a SharedExpr.
+  SharedExpr *this = (SharedExpr *) expr;
+
+  if (this->epoch == exprEpoch)
+    return (Value){IntType, .ival = this->val};
+
+  Value result = this->expr->eval(this->expr, env);
+  if (result.vtype == IntType) {
+    this->val = result.ival;
+    this->epoch = exprEpoch;
+  }
+  return result;
+}
+
+/** 
+  Implementation of destroy for shared subexpressions.  The shared
+  expression is freed once the last place using it is destroyed.
+  @param expr Expression to destroy.
+*/
+static void destroyShared(Expr *expr)
+{
+  SharedExpr *this = (SharedExpr *) expr;
+  if (--this->uses == 0) {
+    this->expr->destroy(this->expr);
+    free(this);
+  }
+}
+
+/** 
+  Make a shared node for the given expression, with one use.
+  @param expr expression to share.
+  @return new shared node.
+*/
+static Expr *makeShared(Expr *expr)
+{
+  SharedExpr *this = (SharedExpr *) allocNode(sizeof(SharedExpr));
+  this->eval = evalShared;
+  this->destroy = destroyShared;
+  this->expr = expr;
+  this->uses = 1;
+  this->epoch = 0;
+  return (Expr *) this;
+}
+
+/** 
+  Tell what operator a SimpleExpr evaluates, if it's one that has no
+  side effects and doesn't make a new sequence or map.
+  @param eval eval function of the expression.
+  @return a small number identifying the operator, or zero if it's not
+  one of these operators.
+*/
+static int pureOperator(Value (*eval)(Expr *, Environment *))
+{
+  Value (*ops[])(Expr *, Environment *) = {
+    evalAdd, evalSub, evalMul, evalDiv, evalAnd, evalOr,
+    evalLess, evalEquals, evalLen, evalIndex
+  };
+  for (int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    if (ops[i] == eval)
+      return i + 1;
+  return 0;
+}
+
+/** 
+  Tell if two expressions without side effects always evaluate to the
+  same value.  Their subexpressions are expected to be shared already,
+  so only leaves need to be compared by value.
+  @param a first expression.
+  @param b second expression.
+  @return true if they're the same.
+*/
+static bool sameExpr(Expr *a, Expr *b)
+{
+  // Literals are interned, so they're only the same as themselves.
+  if (a == b)
+    return true;
+  if (a->eval != b->eval)
+    return false;
+
+  if (a->eval == evalVariable)
+    return strcmp(((VariableExpr *)a)->name, ((VariableExpr *)b)->name) == 0;
+  if (a->eval == evalLocal)
+    return ((LocalExpr *)a)->slot == ((LocalExpr *)b)->slot;
+
+  if (!pureOperator(a->eval))
+    return false;
+  SimpleExpr *x = (SimpleExpr *)a;
+  SimpleExpr *y = (SimpleExpr *)b;
+  if (!sameExpr(x->expr1, y->expr1))
+    return false;
+  return x->expr2 ? sameExpr(x->expr2, y->expr2) : true;
+}
+
+/** 
+  Look for common subexpressions in an expression, replacing each
+  subexpression that's been seen before with a node shared with its
+  first occurrence.  The first occurrence is replaced by the shared
+  node at the same time, using the slot remembered for it.
+  @param slot where the expression is stored, so it can be replaced.
+  @param table subexpressions seen so far in this statement.
+  @return hash of the expression, or zero if it can't be shared.
+*/
+static unsigned shareSubtree(Expr **slot, ExprTable *table)
+{
+  Expr *expr = *slot;
+
+  // Leaves can be the same as each other, but there's no point in
+  // sharing something as quick to evaluate as a shared node.
+  if (expr->eval == evalLiteralInt)
+    return mixHash(1, ((LiteralInt *)expr)->val);
+  if (expr->eval == evalVariable) {
+    unsigned hash = 2;
+    for (char const *c = ((VariableExpr *)expr)->name; *c; c++)
+      hash = mixHash(hash, *c);
+    return hash;
+  }
+  if (expr->eval == evalLocal)
+    return mixHash(3, ((LocalExpr *)expr)->slot);
+
+  // Calls and expressions that make a new sequence or map aren't
+  // shared, but their subexpressions can be.
+  if (expr->eval == evalSequenceInitializer) {
+    SeqExpr *this = (SeqExpr *)expr;
+    for (int i = 0; i < this->count; i++)
+      shareSubtree(&this->exprs[i], table);
+    return 0;
+  }
+  if (expr->eval == evalMapInitializer) {
+    MapExpr *this = (MapExpr *)expr;
+    for (int i = 0; i < 2 * this->count; i++)
+      shareSubtree(&this->exprs[i], table);
+    return 0;
+  }
+  if (expr->eval == evalCall) {
+    CallExpr *this = (CallExpr *)expr;
+    for (int i = 0; i < this->argc; i++)
+      shareSubtree(&this->args[i], table);
+    return 0;
+  }
+  if (expr->eval == evalKeys) {
+    shareSubtree(&((SimpleExpr *)expr)->expr1, table);
+    return 0;
+  }
+
+  int op = pureOperator(expr->eval);
+  if (!op)
+    return 0;
+
+  // Share the operands first, so we can tell if this is the same as
+  // an expression we've seen.
+  SimpleExpr *this = (SimpleExpr *)expr;
+  unsigned hash1 = shareSubtree(&this->expr1, table);
+  unsigned hash2 = this->expr2 ? shareSubtree(&this->expr2, table) : 1;
+  if (!hash1 || !hash2)
+    return 0;
+  unsigned hash = mixHash(mixHash(mixHash(4, op), hash1), hash2);
+
+  ExprEntry *entry = findExpr(table, hash, expr, sameExpr);
+  if (!entry->expr) {
+    entry->hash = hash;
+    entry->expr = expr;
+    entry->slot = slot;
+    entry->shared = NULL;
+    table->count++;
+    return hash;
+  }
+
+  // We've seen this before.  Make sure the first one is shared, then
+  // use the shared node here too.
+  if (!entry->shared) {
+    entry->shared = makeShared(entry->expr);
+    *entry->slot = entry->shared;
+  }
+  ((SharedExpr *)entry->shared)->uses++;
+  expr->destroy(expr);
+  *slot = entry->shared;
+  return hash;
+}
+
+/** 
+  Find subexpressions that occur more than once in the expressions of
+  a statement, and replace them with shared nodes that are evaluated
+  just once each time the statement runs.
+  @param count number of expressions in the statement.
+  @param roots the statement's expressions, some of which may be
+  replaced.  Null entries are skipped.
+*/
+static void shareCommonExprs(int count, Expr **roots)
+{
+  ExprTable table = {0, 0, NULL};
+  for (int i = 0; i < count; i++)
+    if (roots[i])
+      shareSubtree(&roots[i], &table);
+  free(table.list);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Statement dispatch
+
+Stmt *volatile currentStmt = NULL;
+
+unsigned long stmtCount = 0;
+
+void executeStmt(Stmt *stmt, Environment *env)
+{
+  // Remember what was running before, so a statement with a body goes
+  // back to being the current statement once its child finishes.
+  Stmt *prev = currentStmt;
+  currentStmt = stmt;
+  stmtCount++;
+  exprEpoch++;
+
+  stmt->execute(stmt, env);
+
+  currentStmt = prev;
+}
+
+//////////////////////////////////////////////////////////////////////
+// SimpleStmt Struct
+
+/** 
+  Generic representation for a statement that contains one or two
+  expressions.  With different execute methods, this same struct
+  can be used to represent print and push statements.
+*/
+typedef struct {
+  void (*execute)(Stmt *stmt, Environment *env);
+  void (*destroy)(Stmt *stmt);
+  int line;
+
+  /** First (or only) expression used by this statement. */
+  Expr *expr1;
+  /** Second expression used by this statement, or null */
+  Expr *expr2;
+} SimpleStmt;
+
+/** Generic destroy function for SimpleStmt, with either one
+    or two sub-expressions. */
+
+/** 
+  Generic destroy function for SimpleStmt, with either one
+  or two sub-expressions.
+  @param stmt Statement to destroy.
+*/
+static void destroySimpleStmt(Stmt *stmt)
+{
+  // If this function gets called, stmt must really be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *)stmt;
+
+  // Free our subexpression then the SimpleStmt object itself.
+  this->expr1->destroy(this->expr1);
+  if (this->expr2)
+    this->expr2->destroy(this->expr2);
+  free(this);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Print Statement
+
+/** 
+  Implementation of execute for a print statement.
+  @param stmt Statement object for Print.
+  @param env the Enviroment.
+*/
+static void executePrint(Stmt *stmt, Environment *env)
+{
+  // If this function gets called, stmt must really be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *)stmt;
+
+  // Evaluate our argument.
+  Value v = this->expr1->eval(this->expr1, env);
+
+  // Print the value of our expression appropriately, based on its type.
+  // There's no printed form for a map.
+  if (v.vtype == MapType) {
+    releaseMap(v.mval);
+    reportTypeMismatch();
+  } else if (v.vtype == IntType) {
+    printf("%d", v.ival);
+  } else {
+    // Replace with code to permit print a sequence as a string of
+    // ASCII character codes.
+    char seq[v.sval->count + 1];
+    for (int i = 0; i < v.sval->count; i++) {
+      seq[i] = v.sval->list[i];
+      printf("%c", seq[i]);
+    }
+    releaseSequence(v.sval);
+  }
+}
+
+Stmt *makePrint(Expr *expr)
+{
+  // Allocate space for the SimpleStmt object
+  SimpleStmt *this = (SimpleStmt *) allocNode(sizeof(SimpleStmt));
+
+  // Remember the pointers to execute and destroy this statement.
+  this->execute = executePrint;
+  this->destroy = destroySimpleStmt;
+  this->line = 0;
+
+  // Remember the expression for the thing we're supposed to print.
+  shareCommonExprs(1, &expr);
+  this->expr1 = expr;
+  this->expr2 = NULL;
+
+  // Return the SimpleStmt object, as an instance of the Stmt interface.
+  return (Stmt *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compound Statement
+
+/** 
+  Representation for a compound statement, derived from Stmt.
+*/
+typedef struct {
+  void (*execute)(Stmt *stmt, Environment *env);
+  void (*destroy)(Stmt *stmt);
+  int line;
+
+  /** Number of statements in the compound. */
   int len;
   
-  /** List of statements in the compound. */
-  Stmt **stmtList;
-} CompoundStmt;
+  /** List of statements in the compound. */
+  Stmt **stmtList;
+} CompoundStmt;
+
+/** 
+  Implementation of execute for CompountStmt.
+  @param stmt Statement object for CompountStmt.
+  @param env the Enviroment.
+*/
+static void executeCompound(Stmt *stmt, Environment *env)
+{
+  // If this function gets called, stmt must really be a CompoundStmt.
+  CompoundStmt *this = (CompoundStmt *)stmt;
+
+  // Execute the sequence of statements in this compound, stopping
+  // early if one of them returns from a function.
+  for (int i = 0; i < this->len; i++) {
+    executeStmt(this->stmtList[i], env);
+    if (returning)
+      return;
+  }
+}
+
+/** 
+  Implementation of destroy for CompountStmt.
+  @param stmt Statement object for CompountStmt.
+*/
+static void destroyCompound(Stmt *stmt)
+{
+  // If this function gets called, stmt must really be a CompoundStmt.
+  CompoundStmt *this = (CompoundStmt *)stmt;
+
+  // Free the list of statements inside this compond.
+  for (int i = 0; i < this->len; i++)
+    this->stmtList[i]->destroy( this->stmtList[i]);
+
+  // Then, free the array of pointers and the compund statement itself.
+  free(this->stmtList);
+  free(this);
+}
+
+Stmt *makeCompound(int len, Stmt **stmtList)
+{
+  // Allocate space for the CompoundStmt object
+  CompoundStmt *this = (CompoundStmt *) allocNode(sizeof(CompoundStmt));
+
+  // Remember the pointers to execute and destroy this statement.
+  this->execute = executeCompound;
+  this->destroy = destroyCompound;
+  this->line = 0;
+
+  // Remember the list of statements in the compound.
+  this->len = len;
+  this->stmtList = stmtList;
+
+  // Return the result, as an instance of the Stmt interface.
+  return (Stmt *) this;
+}
+
+///////////////////////////////////////////////////////////////////////
+// ConditioanlStatement (for while/if)
+
+/** 
+  Representation for either a while or if statement, subclass of Stmt
+*/
+typedef struct {
+  void (*execute)(Stmt *stmt, Environment *env);
+  void (*destroy)(Stmt *stmt);
+  int line;
+
+  /** Condition to be checked before running the body. */
+  Expr *cond;
+
+  /** Body to execute if / while cond is true. */
+  Stmt *body;
+} ConditionalStmt;
+
+/** 
+  Implementation of destroy for either while of if statements.
+*/
+static void destroyConditional(Stmt *stmt)
+{
+  // If this function gets called, stmt must really be a ConditionalStmt.
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+
+  // Destroy the condition expression and the statement in the body.
+  this->cond->destroy(this->cond);
+  this->body->destroy(this->body);
+
+  // Then, free the ConditionalStmt struct.
+  free(this);
+}
+
+///////////////////////////////////////////////////////////////////////
+// If statement
+
+/** 
+  Implementation of th execute function for an if statement. 
+  @param stmt Statement object for if.
+  @param env the Enviroment.
+*/
+static void executeIf(Stmt *stmt, Environment *env)
+{
+  // If this function gets called, stmt must really be a ConditionalStmt.
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+
+  // Evaluate our operand and see if it's true.
+  Value result = this->cond->eval(this->cond, env);
+  requireIntType(&result);
+
+  // Execute the body if the condition evaluated to true.
+  if (result.ival)
+    executeStmt(this->body, env);
+}
+
+Stmt *makeIf(Expr *cond, Stmt *body)
+{
+  // Allocate an instance of ConditionalStmt
+  ConditionalStmt *this =
+    (ConditionalStmt *) allocNode(sizeof(ConditionalStmt));
+
+  // Functions to execute and destroy an if statement.
+  this->execute = executeIf;
+  this->destroy = destroyConditional;
+  this->line = 0;
+
+  // Fill in the condition and the body of the if.
+  shareCommonExprs(1, &cond);
+  this->cond = cond;
+  this->body = body;
+
+  // Return the result, as an instance of the Stmt interface.
+  return (Stmt *) this;
+}
+
+///////////////////////////////////////////////////////////////////////
+// While statement
+
+/** 
+  Implementation of th execute function for a while statement.
+  @param stmt Statement object for while.
+  @param env the Enviroment.
+*/
+static void executeWhile(Stmt *stmt, Environment *env)
+{
+  // If this function gets called, stmt must really be a ConditionalStmt.
+  ConditionalStmt *this = (ConditionalStmt *)stmt;
+
+  // Evaluate our condition and see if it's true.
+  Value result = this->cond->eval(this->cond, env);
+  requireIntType(&result);
+  
+  // Execute the body while the condition evaluates to true.
+  while (result.ival) {
+    executeStmt(this->body, env);
+    if (returning)
+      return;
+    
+    // Get the value of the condition for the next iteration.
+    result = this->cond->eval(this->cond, env);
+    requireIntType(&result);
+  }
+}
+
+Stmt *makeWhile(Expr *cond, Stmt *body)
+{
+  // Allocate an instance of ConditionalStmt
+  ConditionalStmt *this =
+    (ConditionalStmt *) allocNode(sizeof(ConditionalStmt));
+
+  // Functions to execute and destroy a while statement.
+  this->execute = executeWhile;
+  this->destroy = destroyConditional;
+  this->line = 0;
+
+  // Fill in the condition and the body of the while.
+  shareCommonExprs(1, &cond);
+  this->cond = cond;
+  this->body = body;
+
+  // Return the result, as an instance of the Stmt interface.
+  return (Stmt *) this;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Assignment statement
 
 /** 
-  Implementation of execute for CompountStmt.
-  @param stmt Statement object for CompountStmt.
+  Representation of an assignment statement, a subclass of
+  Stmt. This representation should be suitable for assigning to a
+  variable or an element of a sequence.
+*/
+typedef struct {
+  void (*execute)(Stmt *stmt, Environment *env);
+  void (*destroy)(Stmt *stmt);
+  int line;
+
+  /** Name of the variable we're assigning to. */
+  char name[MAX_VAR_NAME + 1];
+
+  /** Slot for the variable in its function's frame, if it's local. */
+  int slot;
+  
+  /** If we're assigning to an element of a sequence, this is the index
+      expression. Otherwise, it's zero. */
+  Expr *iexpr;
+
+  /** Expression for the right-hand side of the assignment (the source). */
+  Expr *expr;
+} AssignmentStmt;
+
+/** 
+  Implementation of destroy for assignment Statements.
+*/
+static void destroyAssignment(Stmt *stmt)
+{
+  AssignmentStmt *this = (AssignmentStmt *)stmt;
+
+  // Destroy the source expression and the index (if there is one)
+  this->expr->destroy(this->expr);
+  if (this->iexpr)
+    this->iexpr->destroy(this->iexpr);
+  free(this);
+}
+
+/** 
+  Assign to a sequence element or store a value in a map, for an
+  assignment with an index.
+  @param target value of the variable being assigned to.
+  @param idx value of the index.
+  @param result value being assigned.
+*/
+static void assignElement(Value target, Value idx, Value result)
+{
+  requireIntType(&idx);
+  if (target.vtype == MapType) {
+    // The map takes over our reference to the result.
+    mapSet(target.mval, idx.ival, result);
+    return;
+  }
+  requireSeqType(&target);
+  requireIntType(&result);
+  if (idx.ival < 0 || idx.ival > target.sval->count - 1) {
+    fprintf(stderr, "Index out of bounds\n");
+    exit(1);
+  }
+  makeSequenceWritable(target.sval);
+  target.sval->list[idx.ival] = result.ival;
+}
+
+/** 
+  Implementation of execute for assignment Statements.
+  @param stmt Statement object for assignment.
   @param env the Enviroment.
 */
-static void executeCompound(Stmt *stmt, Environment *env)
+static void executeAssignment(Stmt *stmt, Environment *env)
 {
-  // If this function gets called, stmt must really be a CompoundStmt.
-  CompoundStmt *this = (CompoundStmt *)stmt;
+  // If we get to this function, stmt must be an AssignmentStmt.
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
 
-  // Execute the sequence of statements in this compound
-  for (int i = 0; i < this->len; i++)
-    this->stmtList[i]->execute(this->stmtList[ i ], env);
+  // Evaluate the right-hand side of the equals.
+  Value result = this->expr->eval(this->expr, env);
+  
+  if (this->iexpr) {
+    Value target = lookupVariable(env, this->name);
+    Value idx = this->iexpr->eval(this->iexpr, env);
+    assignElement(target, idx, result);
+  } else {
+    setVariable(env, this->name, result);
+  }
 }
 
 /** 
-  Implementation of destroy for CompountStmt.
-  @param stmt Statement object for CompountStmt.
+  Implementation of execute for assignment Statements that assign to
+  a local variable.
+  @param stmt Statement object for assignment.
+  @param env the Enviroment.
 */
-static void destroyCompound(Stmt *stmt)
+static void executeLocalAssignment(Stmt *stmt, Environment *env)
 {
-  // If this function gets called, stmt must really be a CompoundStmt.
-  CompoundStmt *this = (CompoundStmt *)stmt;
+  // If we get to this function, stmt must be an AssignmentStmt.
+  AssignmentStmt *this = (AssignmentStmt *) stmt;
 
-  // Free the list of statements inside this compond.
-  for (int i = 0; i < this->len; i++)
-    this->stmtList[i]->destroy( this->stmtList[i]);
+  // Evaluate the right-hand side of the equals.  This could call a
+  // function and move the stack, so find the slot afterward.
+  Value result = this->expr->eval(this->expr, env);
 
-  // Then, free the array of pointers and the compund statement itself.
-  free(this->stmtList);
-  free(this);
+  if (this->iexpr) {
+    Value idx = this->iexpr->eval(this->iexpr, env);
+    assignElement(frameStack[frameBase + this->slot], idx, result);
+  } else {
+    Value *slot = &frameStack[frameBase + this->slot];
+    releaseValue(*slot);
+    *slot = result;
+  }
 }
 
-Stmt *makeCompound(int len, Stmt **stmtList)
+Stmt *makeAssignment(char const *name, Expr *iexpr, Expr *expr)
 {
-  // Allocate space for the CompoundStmt object
-  CompoundStmt *this = (CompoundStmt *) malloc(sizeof(CompoundStmt));
+
+  // Allocate the AssignmentStmt representations.
+  AssignmentStmt *this =
+    (AssignmentStmt *) allocNode(sizeof(AssignmentStmt));
+
+  // Fill in functions to execute or destory this statement.
+  this->execute = executeAssignment;
+  this->destroy = destroyAssignment;
+  this->line = 0;
+
+  // Get a copy of the destination variable name, the source
+  // expression and the sequence index (if it's non-null).  These two
+  // can share subexpressions.
+  Expr *roots[] = {iexpr, expr};
+  shareCommonExprs(2, roots);
+  strcpy(this->name, name);
+  this->slot = -1;
+  this->iexpr = roots[0];
+  this->expr = roots[1];
+
+  // Return this object, as an instance of Stmt.
+  return (Stmt *) this;
+}
+
+Stmt *makeLocalAssignment(int slot, Expr *iexpr, Expr *expr)
+{
+  // Start with an ordinary assignment, then make it use the slot.
+  AssignmentStmt *this = (AssignmentStmt *) makeAssignment("", iexpr, expr);
+  this->execute = executeLocalAssignment;
+  this->slot = slot;
+  return (Stmt *) this;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Push statement
+
+/** 
+  Representation of an push statement, a subclass of
+  Stmt.  A push can append several values at once.  If they're all
+  literal ints, they're kept as a plain array of ints instead of a
+  list of expressions, so they can be copied in one step.
+*/
+typedef struct {
+  void (*execute)(Stmt *stmt, Environment *env);
+  void (*destroy)(Stmt *stmt);
+  int line;
+  
+  /** Expression for the sequence */
+  Expr *seqExpr;
+
+  /** Number of values that will be pushed */
+  int count;
+
+  /** Capacity of whichever list of values we're using. */
+  int cap;
+
+  /** Expressions for the values that will be pushed, or null if they're
+      all constants. */
+  Expr **valExprs;
+
+  /** Values to be pushed, if they're all constants, or null if not. */
+  int *consts;
+} PushStmt;
+
+/** 
+  Implementation of destroy for push Statements.
+  @param stmt Statement object for push.
+*/
+static void destroyPush(Stmt *stmt)
+{
+  PushStmt *this = (PushStmt *)stmt;
+
+  // Destroy the sequence expression and the value expressions.
+  this->seqExpr->destroy(this->seqExpr);
+  if (this->valExprs)
+    for (int i = 0; i < this->count; i++)
+      this->valExprs[i]->destroy(this->valExprs[i]);
+  free(this->valExprs);
+  free(this->consts);
+  free( this );
+}
+
+/** 
+  Make sure there's room to add the given number of values to the end
+  of a sequence, growing it at least geometrically so a loop of
+  appends doesn't reallocate every time.
+  @param seq sequence that's going to be appended to.
+  @param extra number of values that will be appended.
+*/
+static void reserveForAppend(Sequence *seq, int extra)
+{
+  int need = seq->count + extra;
+  if (need > seq->capacity) {
+    int cap = seq->capacity * DOUBLE;
+    reserveSequence(seq, cap > need ? cap : need);
+  }
+}
+
+/** 
+  Implementation of execute for push Statements.
+  @param stmt Statement object for push.
+  @param env the Enviroment.
+*/
+static void executePush(Stmt *stmt, Environment *env)
+{
+  // If we get to this function, stmt must be an PushStmt.
+  PushStmt *this = (PushStmt *) stmt;
+
+  Value seqResult = this->seqExpr->eval(this->seqExpr, env);
+  requireSeqType(&seqResult);
+  Sequence *seq = seqResult.sval;
+
+  // Make room for everything we're pushing, all at once.
+  reserveForAppend(seq, this->count);
+  if (this->consts) {
+    memcpy(seq->list + seq->count, this->consts, this->count * sizeof(int));
+    seq->count += this->count;
+  } else {
+    for (int i = 0; i < this->count; i++) {
+      Value valResult = this->valExprs[i]->eval(this->valExprs[i], env);
+      requireIntType(&valResult);
+      // A value expression could have pushed to this same sequence.
+      reserveForAppend(seq, 1);
+      seq->list[seq->count++] = valResult.ival;
+
+      // Shared values computed before this push may be out of date.
+      exprEpoch++;
+    }
+  }
+  releaseSequence(seq);
+}
+
+Stmt *makePushStmt(Expr *sexpr, int len, Expr **vlist)
+{
+  // Allocate the PushStmt representations.
+  PushStmt *this =
+    (PushStmt *) allocNode(sizeof(PushStmt));
+
+  // Fill in functions to execute or destory this statement.
+  this->execute = executePush;
+  this->destroy = destroyPush;
+  this->line = 0;
+
+  this->seqExpr = sexpr;
+  this->count = len;
+  this->cap = len;
+  this->valExprs = vlist;
+  this->consts = NULL;
+
+  // If every value is a literal int, just keep the values.
+  int lits = 0;
+  while (lits < len && vlist[lits]->eval == evalLiteralInt)
+    lits++;
+  if (lits == len) {
+    this->consts = (int *) malloc(len * sizeof(int));
+    for (int i = 0; i < len; i++) {
+      this->consts[i] = ((LiteralInt *)vlist[i])->val;
+      vlist[i]->destroy(vlist[i]);
+    }
+    free(vlist);
+    this->valExprs = NULL;
+  } else {
+    shareCommonExprs(len, vlist);
+  }
+
+  // Return this object, as an instance of Stmt.
+  return (Stmt *) this;
+}
+
+char const *constPushTarget(Stmt *stmt)
+{
+  if (stmt->execute != executePush)
+    return NULL;
+
+  PushStmt *this = (PushStmt *)stmt;
+  if (!this->consts || this->seqExpr->eval != evalVariable)
+    return NULL;
+  return ((VariableExpr *)this->seqExpr)->name;
+}
+
+bool mergeStmts(Stmt *prev, Stmt *next)
+{
+  // Only a push of constants can be merged into a push before it.
+  char const *name = constPushTarget(next);
+  if (!name || prev->execute != executePush)
+    return false;
+
+  PushStmt *this = (PushStmt *)prev;
+  if (this->seqExpr->eval != evalVariable ||
+      strcmp(((VariableExpr *)this->seqExpr)->name, name) != 0)
+    return false;
+
+  PushStmt *other = (PushStmt *)next;
+  int len = this->count + other->count;
+  if (len > this->cap) {
+    this->cap = this->cap * DOUBLE > len ? this->cap * DOUBLE : len;
+    if (this->consts)
+      this->consts = (int *) realloc(this->consts, this->cap * sizeof(int));
+    else
+      this->valExprs = (Expr **) realloc(this->valExprs,
+                                         this->cap * sizeof(Expr *));
+  }
+
+  // Copy over the values, as ints or as new literals.
+  for (int i = 0; i < other->count; i++) {
+    if (this->consts)
+      this->consts[this->count + i] = other->consts[i];
+    else
+      this->valExprs[this->count + i] = makeLiteralInt(other->consts[i]);
+  }
+  this->count = len;
+
+  next->destroy(next);
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Extend statement
+
+/** 
+  Implementation of execute for extend Statements, which append every
+  value of one sequence to the end of another.
+  @param stmt Statement object for extend.
+  @param env the Enviroment.
+*/
+static void executeExtend(Stmt *stmt, Environment *env)
+{
+  // If we get to this function, stmt must be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *) stmt;
+
+  Value dest = this->expr1->eval(this->expr1, env);
+  Value src = this->expr2->eval(this->expr2, env);
+  requireSeqType(&dest);
+  requireSeqType(&src);
+
+  // Count is read before we grow dest, in case src is the same sequence.
+  int n = src.sval->count;
+  reserveForAppend(dest.sval, n);
+  memcpy(dest.sval->list + dest.sval->count, src.sval->list, n * sizeof(int));
+  dest.sval->count += n;
+
+  releaseSequence(dest.sval);
+  releaseSequence(src.sval);
+}
+
+Stmt *makeExtendStmt(Expr *sexpr, Expr *texpr)
+{
+  // Allocate space for the SimpleStmt object
+  SimpleStmt *this = (SimpleStmt *) allocNode(sizeof(SimpleStmt));
 
   // Remember the pointers to execute and destroy this statement.
-  this->execute = executeCompound;
-  this->destroy = destroyCompound;
+  this->execute = executeExtend;
+  this->destroy = destroySimpleStmt;
+  this->line = 0;
 
-  // Remember the list of statements in the compound.
-  this->len = len;
-  this->stmtList = stmtList;
+  // Remember the sequence to extend and the one to copy from.
+  Expr *roots[] = {sexpr, texpr};
+  shareCommonExprs(2, roots);
+  this->expr1 = roots[0];
+  this->expr2 = roots[1];
 
-  // Return the result, as an instance of the Stmt interface.
+  // Return the SimpleStmt object, as an instance of the Stmt interface.
   return (Stmt *) this;
 }
 
-///////////////////////////////////////////////////////////////////////
-// ConditioanlStatement (for while/if)
+//////////////////////////////////////////////////////////////////////
+// Def statement
 
 /** 
-  Representation for either a while or if statement, subclass of Stmt
+  Representation of a def statement, a subclass of Stmt.  Running it
+  defines the function.
 */
 typedef struct {
   void (*execute)(Stmt *stmt, Environment *env);
   void (*destroy)(Stmt *stmt);
+  int line;
 
-  /** Condition to be checked before running the body. */
-  Expr *cond;
+  /** Function this statement defines. */
+  Function *func;
+} DefStmt;
 
-  /** Body to execute if / while cond is true. */
-  Stmt *body;
-} ConditionalStmt;
+/** 
+  Implementation of execute for def Statements.
+  @param stmt Statement object for def.
+  @param env the Enviroment.
+*/
+static void executeDef(Stmt *stmt, Environment *env)
+{
+  DefStmt *this = (DefStmt *) stmt;
+  defineFunction(this->func);
+}
 
 /** 
-  Implementation of destroy for either while of if statements.
+  Implementation of destroy for def Statements.  The function itself
+  stays around if it's been defined.
+  @param stmt Statement object for def.
 */
-static void destroyConditional(Stmt *stmt)
+static void destroyDef(Stmt *stmt)
 {
-  // If this function gets called, stmt must really be a ConditionalStmt.
-  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  DefStmt *this = (DefStmt *) stmt;
+  releaseFunction(this->func);
+  free(this);
+}
 
-  // Destroy the condition expression and the statement in the body.
-  this->cond->destroy(this->cond);
-  this->body->destroy(this->body);
+Stmt *makeDef(char const *name, int params, int locals, Stmt *body)
+{
+  Function *func = (Function *) allocNode(sizeof(Function));
+  strcpy(func->name, name);
+  func->params = params;
+  func->locals = locals;
+  func->body = body;
+  func->ref = 1;
+
+  DefStmt *this = (DefStmt *) allocNode(sizeof(DefStmt));
+  this->execute = executeDef;
+  this->destroy = destroyDef;
+  this->line = 0;
+  this->func = func;
 
-  // Then, free the ConditionalStmt struct.
-  free(this);
+  return (Stmt *) this;
 }
 
-///////////////////////////////////////////////////////////////////////
-// If statement
+//////////////////////////////////////////////////////////////////////
+// Return statement
 
 /** 
-  Implementation of th execute function for an if statement. 
-  @param stmt Statement object for if.
+  Representation of a return statement, a subclass of Stmt.
+*/
+typedef struct {
+  void (*execute)(Stmt *stmt, Environment *env);
+  void (*destroy)(Stmt *stmt);
+  int line;
+
+  /** Expression for the value to return, or null to return zero. */
+  Expr *expr;
+
+  /** True if expr is a call, which can reuse the current frame. */
+  bool tail;
+} ReturnStmt;
+
+/** 
+  Implementation of execute for return Statements.
+  @param stmt Statement object for return.
   @param env the Enviroment.
 */
-static void executeIf(Stmt *stmt, Environment *env)
+static void executeReturn(Stmt *stmt, Environment *env)
 {
-  // If this function gets called, stmt must really be a ConditionalStmt.
-  ConditionalStmt *this = (ConditionalStmt *)stmt;
-
-  // Evaluate our operand and see if it's true.
-  Value result = this->cond->eval(this->cond, env);
-  requireIntType(&result);
+  ReturnStmt *this = (ReturnStmt *) stmt;
+
+  if (this->tail) {
+    // Leave the call for runFunction(), once this frame is finished.
+    CallExpr *call = (CallExpr *) this->expr;
+    Function *func = findCallee(call);
+    tailBase = pushArgs(call->argc, call->args, env);
+    tailArgs = call->argc;
+    tailFunc = func;
+  } else if (this->expr) {
+    returnValue = this->expr->eval(this->expr, env);
+  } else {
+    returnValue = (Value){IntType, .ival = 0};
+  }
 
-  // Execute the body if the condition evaluated to true.
-  if (result.ival)
-    this->body->execute(this->body, env);
+  returning = true;
 }
 
-Stmt *makeIf(Expr *cond, Stmt *body)
+/** 
+  Implementation of destroy for return Statements.
+  @param stmt Statement object for return.
+*/
+static void destroyReturn(Stmt *stmt)
 {
-  // Allocate an instance of ConditionalStmt
-  ConditionalStmt *this =
-    (ConditionalStmt *) malloc(sizeof(ConditionalStmt));
-
-  // Functions to execute and destroy an if statement.
-  this->execute = executeIf;
-  this->destroy = destroyConditional;
+  ReturnStmt *this = (ReturnStmt *) stmt;
+  if (this->expr)
+    this->expr->destroy(this->expr);
+  free(this);
+}
 
-  // Fill in the condition and the body of the if.
-  this->cond = cond;
-  this->body = body;
+Stmt *makeReturn(Expr *expr)
+{
+  ReturnStmt *this = (ReturnStmt *) allocNode(sizeof(ReturnStmt));
+  this->execute = executeReturn;
+  this->destroy = destroyReturn;
+  this->line = 0;
+  shareCommonExprs(1, &expr);
+  this->expr = expr;
+  this->tail = expr && expr->eval == evalCall;
 
-  // Return the result, as an instance of the Stmt interface.
   return (Stmt *) this;
 }
 
-///////////////////////////////////////////////////////////////////////
-// While statement
+//////////////////////////////////////////////////////////////////////
+// Call statement
 
 /** 
-  Implementation of th execute function for a while statement.
-  @param stmt Statement object for while.
+  Implementation of execute for a function call used as a statement,
+  which just throws away the returned value.
+  @param stmt Statement object for the call.
   @param env the Enviroment.
 */
-static void executeWhile(Stmt *stmt, Environment *env)
+static void executeCallStmt(Stmt *stmt, Environment *env)
 {
-  // If this function gets called, stmt must really be a ConditionalStmt.
-  ConditionalStmt *this = (ConditionalStmt *)stmt;
+  // If this function gets called, stmt must really be a SimpleStmt.
+  SimpleStmt *this = (SimpleStmt *)stmt;
 
-  // Evaluate our condition and see if it's true.
-  Value result = this->cond->eval(this->cond, env);
-  requireIntType(&result);
-  
-  // Execute the body while the condition evaluates to true.
-  while (result.ival) {
-    this->body->execute(this->body, env);
-    
-    // Get the value of the condition for the next iteration.
-    result = this->cond->eval(this->cond, env);
-    requireIntType(&result);
-  }
+  releaseValue(this->expr1->eval(this->expr1, env));
 }
 
-Stmt *makeWhile(Expr *cond, Stmt *body)
+Stmt *makeCallStmt(Expr *call)
 {
-  // Allocate an instance of ConditionalStmt
-  ConditionalStmt *this =
-    (ConditionalStmt *) malloc(sizeof(ConditionalStmt));
+  // Allocate space for the SimpleStmt object
+  SimpleStmt *this = (SimpleStmt *) allocNode(sizeof(SimpleStmt));
 
-  // Functions to execute and destroy a while statement.
-  this->execute = executeWhile;
-  this->destroy = destroyConditional;
+  // Remember the pointers to execute and destroy this statement.
+  this->execute = executeCallStmt;
+  this->destroy = destroySimpleStmt;
+  this->line = 0;
 
-  // Fill in the condition and the body of the while.
-  this->cond = cond;
-  this->body = body;
+  // Remember the call we're supposed to make.
+  shareCommonExprs(1, &call);
+  this->expr1 = call;
+  this->expr2 = NULL;
 
-  // Return the result, as an instance of the Stmt interface.
+  // Return the SimpleStmt object, as an instance of the Stmt interface.
   return (Stmt *) this;
 }
 
 ///////////////////////////////////////////////////////////////////////
-// Assignment statement
+// Flattened form
+
+/** Number of words used to store a variable name in flattened code. */
+#define NAME_WORDS ((MAX_VAR_NAME + sizeof(int)) / sizeof(int))
+
+/** Codes for each type of node in flattened code. */
+enum {
+  FlatLiteralInt = 1,
+  FlatConstSeq,
+  FlatSeqInit,
+  FlatAdd,
+  FlatSub,
+  FlatMul,
+  FlatDiv,
+  FlatAnd,
+  FlatOr,
+  FlatLess,
+  FlatEquals,
+  FlatLen,
+  FlatIndex,
+  FlatVariable,
+  FlatPrint,
+  FlatCompound,
+  FlatIf,
+  FlatWhile,
+  FlatAssignment,
+  FlatPush,
+  FlatExtend,
+  FlatMapInit,
+  FlatKeys,
+  FlatLocal,
+  FlatCall,
+  FlatLocalAssignment,
+  FlatDef,
+  FlatReturn,
+  FlatCallStmt
+};
 
 /** 
-  Representation of an assignment statement, a subclass of
-  Stmt. This representation should be suitable for assigning to a
-  variable or an element of a sequence.
+  Expressions built with SimpleExpr, along with their flattened code
+  and the function that makes them.  Len and keys are the only ones
+  with just one sub-expression.
 */
-typedef struct {
-  void (*execute)(Stmt *stmt, Environment *env);
-  void (*destroy)(Stmt *stmt);
+static struct {
+  /** Eval function for this type of expression. */
+  Value (*eval)(Expr *expr, Environment *env);
 
-  /** Name of the variable we're assigning to. */
-  char name[MAX_VAR_NAME + 1];
-  
-  /** If we're assigning to an element of a sequence, this is the index
-      expression. Otherwise, it's zero. */
-  Expr *iexpr;
+  /** Code for this expression in flattened form. */
+  int code;
+
+  /** Function to make a two-operand expression, or null for len. */
+  Expr *(*make)(Expr *left, Expr *right);
+} simpleExprTypes[] = {
+  { evalAdd, FlatAdd, makeAdd },
+  { evalSub, FlatSub, makeSub },
+  { evalMul, FlatMul, makeMul },
+  { evalDiv, FlatDiv, makeDiv },
+  { evalAnd, FlatAnd, makeAnd },
+  { evalOr, FlatOr, makeOr },
+  { evalLess, FlatLess, makeLess },
+  { evalEquals, FlatEquals, makeEquals },
+  { evalIndex, FlatIndex, makeSequenceIndex },
+  { evalLen, FlatLen, NULL },
+  { evalKeys, FlatKeys, NULL },
+};
+
+/** Number of entries in simpleExprTypes. */
+#define SIMPLE_EXPR_TYPES (sizeof(simpleExprTypes) / sizeof(simpleExprTypes[0]))
+
+FlatCode *makeFlatCode()
+{
+  FlatCode *code = (FlatCode *) malloc(sizeof(FlatCode));
+  code->cap = INIT_CAP;
+  code->len = 0;
+  code->words = (int *) malloc(code->cap * sizeof(int));
+  return code;
+}
 
-  /** Expression for the right-hand side of the assignment (the source). */
-  Expr *expr;
-} AssignmentStmt;
+void freeFlatCode(FlatCode *code)
+{
+  free(code->words);
+  free(code);
+}
 
 /** 
-  Implementation of destroy for assignment Statements.
+  Add one word to the end of some flattened code.
+  @param code code to add to.
+  @param word value to add.
 */
-static void destroyAssignment(Stmt *stmt)
+static void addWord(FlatCode *code, int word)
 {
-  AssignmentStmt *this = (AssignmentStmt *)stmt;
+  if (code->len >= code->cap) {
+    code->cap *= DOUBLE;
+    code->words = (int *) realloc(code->words, code->cap * sizeof(int));
+  }
+  code->words[code->len++] = word;
+}
 
-  // Destroy the source expression and the index (if there is one)
-  this->expr->destroy(this->expr);
-  if (this->iexpr)
-    this->iexpr->destroy(this->iexpr);
-  free(this);
+/** 
+  Add a variable name to some flattened code, padded out to NAME_WORDS.
+  @param code code to add to.
+  @param name variable name to add.
+*/
+static void addName(FlatCode *code, char const *name)
+{
+  int words[NAME_WORDS];
+  memset(words, 0, sizeof(words));
+  strcpy((char *)words, name);
+  for (int i = 0; i < NAME_WORDS; i++)
+    addWord(code, words[i]);
 }
 
 /** 
-  Implementation of execute for assignment Statements.
-  @param stmt Statement object for assignment.
-  @param env the Enviroment.
+  Append the flattened form of an expression to code.
+  @param expr expression to flatten.
+  @param code array to add the flattened expression to.
+  @return true if successful.
 */
-static void executeAssignment(Stmt *stmt, Environment *env)
+static bool flattenExpr(Expr *expr, FlatCode *code)
 {
-  // If we get to this function, stmt must be an AssignmentStmt.
-  AssignmentStmt *this = (AssignmentStmt *) stmt;
+  // A shared subexpression is written out everywhere it's used.  It
+  // will be shared again when the statement is rebuilt.
+  if (expr->eval == evalShared)
+    return flattenExpr(((SharedExpr *)expr)->expr, code);
+
+  if (expr->eval == evalLiteralInt) {
+    addWord(code, FlatLiteralInt);
+    addWord(code, ((LiteralInt *)expr)->val);
+    return true;
+  }
 
-  // Evaluate the right-hand side of the equals.
-  Value result = this->expr->eval(this->expr, env);
-  
-  if (this->iexpr) {
-    // Replace with code to permit assigning to a sequence element.
-    Value seqval = lookupVariable(env, this->name);
-    Value idx = this->iexpr->eval(this->iexpr, env);
-    if (idx.ival > seqval.sval->count - 1) {
-      fprintf(stderr, "Index out of bounds\n");
-      exit(1);
-    }
-    seqval.sval->list[idx.ival] = result.ival;
-  } else {
-    setVariable(env, this->name, result);
+  if (expr->eval == evalConstSequence) {
+    ConstSeqExpr *this = (ConstSeqExpr *)expr;
+    addWord(code, FlatConstSeq);
+    addWord(code, this->count);
+    for (int i = 0; i < this->count; i++)
+      addWord(code, this->vals[i]);
+    return true;
+  }
+
+  if (expr->eval == evalSequenceInitializer) {
+    SeqExpr *this = (SeqExpr *)expr;
+    addWord(code, FlatSeqInit);
+    addWord(code, this->count);
+    for (int i = 0; i < this->count; i++)
+      if (!flattenExpr(this->exprs[i], code))
+        return false;
+    return true;
+  }
+
+  if (expr->eval == evalMapInitializer) {
+    MapExpr *this = (MapExpr *)expr;
+    addWord(code, FlatMapInit);
+    addWord(code, this->count);
+    for (int i = 0; i < 2 * this->count; i++)
+      if (!flattenExpr(this->exprs[i], code))
+        return false;
+    return true;
   }
+
+  if (expr->eval == evalVariable) {
+    addWord(code, FlatVariable);
+    addName(code, ((VariableExpr *)expr)->name);
+    return true;
+  }
+
+  if (expr->eval == evalLocal) {
+    addWord(code, FlatLocal);
+    addWord(code, ((LocalExpr *)expr)->slot);
+    return true;
+  }
+
+  if (expr->eval == evalCall) {
+    CallExpr *this = (CallExpr *)expr;
+    addWord(code, FlatCall);
+    addName(code, this->name);
+    addWord(code, this->argc);
+    for (int i = 0; i < this->argc; i++)
+      if (!flattenExpr(this->args[i], code))
+        return false;
+    return true;
+  }
+
+  for (int i = 0; i < SIMPLE_EXPR_TYPES; i++)
+    if (expr->eval == simpleExprTypes[i].eval) {
+      SimpleExpr *this = (SimpleExpr *)expr;
+      addWord(code, simpleExprTypes[i].code);
+      if (!flattenExpr(this->expr1, code))
+        return false;
+      return !this->expr2 || flattenExpr(this->expr2, code);
+    }
+
+  return false;
 }
 
-Stmt *makeAssignment(char const *name, Expr *iexpr, Expr *expr)
+bool flattenStmt(Stmt *stmt, FlatCode *code)
 {
+  if (stmt->execute == executePrint) {
+    addWord(code, FlatPrint);
+    addWord(code, stmt->line);
+    return flattenExpr(((SimpleStmt *)stmt)->expr1, code);
+  }
 
-  // Allocate the AssignmentStmt representations.
-  AssignmentStmt *this =
-    (AssignmentStmt *) malloc(sizeof(AssignmentStmt));
+  if (stmt->execute == executeCompound) {
+    CompoundStmt *this = (CompoundStmt *)stmt;
+    addWord(code, FlatCompound);
+    addWord(code, stmt->line);
+    addWord(code, this->len);
+    for (int i = 0; i < this->len; i++)
+      if (!flattenStmt(this->stmtList[i], code))
+        return false;
+    return true;
+  }
 
-  // Fill in functions to execute or destory this statement.
-  this->execute = executeAssignment;
-  this->destroy = destroyAssignment;
+  if (stmt->execute == executeIf || stmt->execute == executeWhile) {
+    ConditionalStmt *this = (ConditionalStmt *)stmt;
+    addWord(code, stmt->execute == executeIf ? FlatIf : FlatWhile);
+    addWord(code, stmt->line);
+    return flattenExpr(this->cond, code) && flattenStmt(this->body, code);
+  }
 
-  // Get a copy of the destination variable name, the source
-  // expression and the sequence index (if it's non-null).
-  strcpy(this->name, name);
-  this->iexpr = iexpr;
-  this->expr = expr;
+  if (stmt->execute == executeAssignment ||
+      stmt->execute == executeLocalAssignment) {
+    AssignmentStmt *this = (AssignmentStmt *)stmt;
+    if (stmt->execute == executeAssignment) {
+      addWord(code, FlatAssignment);
+      addWord(code, stmt->line);
+      addName(code, this->name);
+    } else {
+      addWord(code, FlatLocalAssignment);
+      addWord(code, stmt->line);
+      addWord(code, this->slot);
+    }
+    addWord(code, this->iexpr != NULL);
+    if (this->iexpr && !flattenExpr(this->iexpr, code))
+      return false;
+    return flattenExpr(this->expr, code);
+  }
 
-  // Return this object, as an instance of Stmt.
-  return (Stmt *) this;
-}
+  if (stmt->execute == executePush) {
+    PushStmt *this = (PushStmt *)stmt;
+    addWord(code, FlatPush);
+    addWord(code, stmt->line);
+    if (!flattenExpr(this->seqExpr, code))
+      return false;
+    addWord(code, this->count);
+    addWord(code, this->consts != NULL);
+    for (int i = 0; i < this->count; i++) {
+      if (this->consts)
+        addWord(code, this->consts[i]);
+      else if (!flattenExpr(this->valExprs[i], code))
+        return false;
+    }
+    return true;
+  }
 
-///////////////////////////////////////////////////////////////////////
-// Push statement
+  if (stmt->execute == executeExtend) {
+    SimpleStmt *this = (SimpleStmt *)stmt;
+    addWord(code, FlatExtend);
+    addWord(code, stmt->line);
+    return flattenExpr(this->expr1, code) && flattenExpr(this->expr2, code);
+  }
 
-/** 
-  Representation of an push statement, a subclass of
-  Stmt.
-*/
-typedef struct {
-  void (*execute)(Stmt *stmt, Environment *env);
-  void (*destroy)(Stmt *stmt);
-  
-  /** Expression for the sequence */
-  Expr *seqExpr;
+  if (stmt->execute == executeDef) {
+    Function *func = ((DefStmt *)stmt)->func;
+    addWord(code, FlatDef);
+    addWord(code, stmt->line);
+    addName(code, func->name);
+    addWord(code, func->params);
+    addWord(code, func->locals);
+    return flattenStmt(func->body, code);
+  }
 
-  /** Expression for the val that will be pushed */
-  Expr *valExpr;
-} PushStmt;
+  if (stmt->execute == executeReturn) {
+    ReturnStmt *this = (ReturnStmt *)stmt;
+    addWord(code, FlatReturn);
+    addWord(code, stmt->line);
+    addWord(code, this->expr != NULL);
+    return !this->expr || flattenExpr(this->expr, code);
+  }
+
+  if (stmt->execute == executeCallStmt) {
+    addWord(code, FlatCallStmt);
+    addWord(code, stmt->line);
+    return flattenExpr(((SimpleStmt *)stmt)->expr1, code);
+  }
+
+  return false;
+}
 
 /** 
-  Implementation of destroy for push Statements.
-  @param stmt Statement object for push.
+  Read the next word from some flattened code.
+  @param pos position in the code, moved past the word we read.
+  @return the word we read.
 */
-static void destroyPush(Stmt *stmt)
+static int nextWord(int const **pos)
 {
-  PushStmt *this = (PushStmt *)stmt;
-
-  // Destroy the source expression and the index (if there is one)
-  this->seqExpr->destroy(this->seqExpr);
-  this->valExpr->destroy(this->valExpr);
-  free( this );
+  return *(*pos)++;
 }
 
-/** Implementation of execute for assignment Statements. */
+/** 
+  Read a variable name from some flattened code.
+  @param pos position in the code, moved past the name.
+  @param name storage for the name, with room for MAX_VAR_NAME
+  characters.
+*/
+static void nextName(int const **pos, char name[MAX_VAR_NAME + 1])
+{
+  memcpy(name, *pos, MAX_VAR_NAME);
+  name[MAX_VAR_NAME] = '\0';
+  *pos += NAME_WORDS;
+}
 
 /** 
-  Implementation of execute for push Statements.
-  @param stmt Statement object for push.
-  @param env the Enviroment.
+  Rebuild an expression from its flattened form.
+  @param pos pointer to the start of the flattened expression, moved
+  past it when this function returns.
+  @return the rebuilt expression.
 */
-static void executePush(Stmt *stmt, Environment *env)
+static Expr *unflattenExpr(int const **pos)
 {
-  // If we get to this function, stmt must be an PushStmt.
-  PushStmt *this = (PushStmt *) stmt;
+  int type = nextWord(pos);
 
-  Value seqResult = this->seqExpr->eval(this->seqExpr, env);
-  Value valResult = this->valExpr->eval(this->valExpr, env);
-  requireSeqType(&seqResult);
-  requireIntType(&valResult);
-  // assign value to the last element of the sequence
-  //right here 
-  if (seqResult.sval->count >= seqResult.sval->capacity) {
-    seqResult.sval->capacity *= DOUBLE;
-    seqResult.sval->list = (int * ) realloc(seqResult.sval->list, seqResult.sval->capacity * sizeof(int));
+  if (type == FlatLiteralInt)
+    return makeLiteralInt(nextWord(pos));
+
+  if (type == FlatConstSeq) {
+    int len = nextWord(pos);
+    Expr *expr = buildConstSequence(len, *pos);
+    *pos += len;
+    return expr;
   }
-  seqResult.sval->list[seqResult.sval->count++] = valResult.ival;
-  releaseSequence(seqResult.sval);
-}
 
-Stmt *makePushStmt(Expr *sexpr, Expr *vexpr)
-{
-  // Allocate the PushStmt representations.
-  PushStmt *this =
-    (PushStmt *) malloc(sizeof(PushStmt));
+  if (type == FlatSeqInit) {
+    int len = nextWord(pos);
+    Expr **exprs = NULL;
+    if (len > 0) {
+      exprs = (Expr **) malloc(len * sizeof(Expr *));
+      for (int i = 0; i < len; i++)
+        exprs[i] = unflattenExpr(pos);
+    }
+    return makeSequenceInitializer(len, exprs);
+  }
 
-  // Fill in functions to execute or destory this statement.
-  this->execute = executePush;
-  this->destroy = destroyPush;
+  if (type == FlatMapInit) {
+    int len = nextWord(pos);
+    Expr **exprs = (Expr **) malloc((len ? 2 * len : 1) * sizeof(Expr *));
+    for (int i = 0; i < 2 * len; i++)
+      exprs[i] = unflattenExpr(pos);
+    return makeMapInitializer(len, exprs);
+  }
 
-  this->seqExpr = sexpr;
-  this->valExpr = vexpr;
+  if (type == FlatVariable) {
+    char name[MAX_VAR_NAME + 1];
+    nextName(pos, name);
+    return makeVariable(name);
+  }
 
-  // Return this object, as an instance of Stmt.
-  return (Stmt *) this;
+  if (type == FlatLocal)
+    return makeLocal(nextWord(pos));
+
+  if (type == FlatCall) {
+    char name[MAX_VAR_NAME + 1];
+    nextName(pos, name);
+    int argc = nextWord(pos);
+    Expr **args = (Expr **) malloc((argc ? argc : 1) * sizeof(Expr *));
+    for (int i = 0; i < argc; i++)
+      args[i] = unflattenExpr(pos);
+    return makeCall(name, argc, args);
+  }
+
+  if (type == FlatLen)
+    return makeLenExpr(unflattenExpr(pos));
+
+  if (type == FlatKeys)
+    return makeKeysExpr(unflattenExpr(pos));
+
+  for (int i = 0; i < SIMPLE_EXPR_TYPES; i++)
+    if (type == simpleExprTypes[i].code) {
+      Expr *left = unflattenExpr(pos);
+      Expr *right = unflattenExpr(pos);
+      return simpleExprTypes[i].make(left, right);
+    }
+
+  fprintf(stderr, "Invalid flattened code\n");
+  exit(EXIT_FAILURE);
+}
+
+Stmt *unflattenStmt(int const **pos)
+{
+  int type = nextWord(pos);
+  int line = nextWord(pos);
+  Stmt *stmt = NULL;
+
+  if (type == FlatPrint) {
+    stmt = makePrint(unflattenExpr(pos));
+  } else if (type == FlatCompound) {
+    int len = nextWord(pos);
+    Stmt **stmtList = (Stmt **) malloc((len ? len : 1) * sizeof(Stmt *));
+    for (int i = 0; i < len; i++)
+      stmtList[i] = unflattenStmt(pos);
+    stmt = makeCompound(len, stmtList);
+  } else if (type == FlatIf || type == FlatWhile) {
+    Expr *cond = unflattenExpr(pos);
+    Stmt *body = unflattenStmt(pos);
+    stmt = type == FlatIf ? makeIf(cond, body) : makeWhile(cond, body);
+  } else if (type == FlatAssignment) {
+    char name[MAX_VAR_NAME + 1];
+    nextName(pos, name);
+    Expr *iexpr = nextWord(pos) ? unflattenExpr(pos) : NULL;
+    stmt = makeAssignment(name, iexpr, unflattenExpr(pos));
+  } else if (type == FlatLocalAssignment) {
+    int slot = nextWord(pos);
+    Expr *iexpr = nextWord(pos) ? unflattenExpr(pos) : NULL;
+    stmt = makeLocalAssignment(slot, iexpr, unflattenExpr(pos));
+  } else if (type == FlatDef) {
+    char name[MAX_VAR_NAME + 1];
+    nextName(pos, name);
+    int params = nextWord(pos);
+    int locals = nextWord(pos);
+    stmt = makeDef(name, params, locals, unflattenStmt(pos));
+  } else if (type == FlatReturn) {
+    stmt = makeReturn(nextWord(pos) ? unflattenExpr(pos) : NULL);
+  } else if (type == FlatCallStmt) {
+    stmt = makeCallStmt(unflattenExpr(pos));
+  } else if (type == FlatPush) {
+    Expr *sexpr = unflattenExpr(pos);
+    int len = nextWord(pos);
+    bool consts = nextWord(pos);
+    Expr **vlist = (Expr **) malloc(len * sizeof(Expr *));
+    for (int i = 0; i < len; i++)
+      vlist[i] = consts ? makeLiteralInt(nextWord(pos)) : unflattenExpr(pos);
+    stmt = makePushStmt(sexpr, len, vlist);
+  } else if (type == FlatExtend) {
+    Expr *sexpr = unflattenExpr(pos);
+    stmt = makeExtendStmt(sexpr, unflattenExpr(pos));
+  } else {
+    fprintf(stderr, "Invalid flattened code\n");
+    exit(EXIT_FAILURE);
+  }
+
+  stmt->line = line;
+  return stmt;
 }
@@ -9,6 +9,7 @@
 #ifndef _SYNTAX_H_
 #define _SYNTAX_H_
 
+#include <stdbool.h>
 #include "value.h"
 
 //////////////////////////////////////////////////////////////////////
@@ -70,6 +71,48 @@ Expr *makeSequenceInitializer(int len, Expr *eList[]);
 */
 Expr *makeLenExpr(Expr *expr);
 
+/** 
+  Make a representation of a map literal, a value that gives back a
+  Value containing a new map.
+  @param len number of key / value pairs in the literal.
+  @param eList list of 2 * len expressions, alternating between a key
+  and the value stored under it.
+  @return a new, dynamically allocated expression that evaluates to
+  a Value containing the new map.
+*/
+Expr *makeMapInitializer(int len, Expr *eList[]);
+
+/** 
+  Make a representation of the keys of a map, which evaluates to a
+  new sequence of all the map's keys in increasing order.
+  @param expr expression for the map.
+  @return a new, dynamically allocated expression that evaluates to
+  a Value containing the sequence of keys.
+*/
+Expr *makeKeysExpr(Expr *expr);
+
+/** 
+  Make a representation of a local variable inside a function.  Locals
+  live in the frame of the current call, and are found by their slot
+  number instead of by name.
+  @param slot index of the variable in its function's frame.
+  @return a new, dynamically allocated expression that evaluates to
+  the value of the local variable.
+*/
+Expr *makeLocal(int slot);
+
+/** 
+  Make a representation of a call to a user-defined function.  The
+  function is found by name when the call runs.  This new object takes
+  ownership of args and the expressions in it.
+  @param name name of the function to call.
+  @param argc number of arguments.
+  @param args expressions for the arguments.
+  @return a new, dynamically allocated expression that evaluates to
+  the value returned by the function.
+*/
+Expr *makeCall(char const *name, int argc, Expr **args);
+
 /** 
   Make a representation of the index of a sequence expression.
   @param aexpr expression that represents a sequence.
@@ -176,11 +219,12 @@ typedef struct StmtStruct Stmt;
 
 /** 
   Representation for the Stmt interface, a superclass for all types
-  of statements.  Classes implementing this have these two fields as
+  of statements.  Classes implementing this have these three fields as
   their first members.  They will set execute to point to an
   appropriate functions to execute the type of statement their
   class represents, and they will set destroy to point to a function
-  that frees memory for their type of statement.
+  that frees memory for their type of statement.  The parser fills in
+  the line field after the statement is constructed.
 */
 struct StmtStruct {
   /** 
@@ -196,8 +240,31 @@ struct StmtStruct {
     @param stmt statement to free.
   */
   void (*destroy)(Stmt *stmt);
+
+  /** Source line this statement starts on, for error and profile reports. */
+  int line;
 };
 
+/** 
+  Statement the interpreter is currently executing, or null between
+  top-level statements.  This is maintained by executeStmt() so the
+  sampling profiler can see where the program is when a signal arrives.
+*/
+extern Stmt *volatile currentStmt;
+
+/** Number of statements executeStmt() has run so far. */
+extern unsigned long stmtCount;
+
+/** 
+  Execute the given statement, keeping track of it as the current
+  statement while it runs.  Code that runs a statement (the top-level
+  loop and any statement with a body) should go through this function
+  rather than calling the execute pointer directly.
+  @param stmt statement to execute.
+  @param env current values of all variables.
+*/
+void executeStmt(Stmt *stmt, Environment *env);
+
 /** 
   Make a statement that evaluates the given argument and prints it
   to the terminal.
@@ -253,14 +320,140 @@ Stmt *makeWhile(Expr *cond, Stmt *body);
 Stmt *makeAssignment(char const *name, Expr *iexpr, Expr *expr);
 
 /** 
-  Make a representation of a while statement.  This new object
-  will take ownership of the memory pointed to by cond and body
-  and will be responsible for freeing that memory when it is
-  destroyed.
+  Make a representation of an assignment to a local variable inside a
+  function, or to an element of one.
+  @param slot index of the variable in its function's frame.
+  @param iexpr If this is an assignment to an array element, this is the
+  index for the target element, or null if not.
+  @param expr Expression on the right-hand side of the assignemnt.
+  @return A new statement object that can perform the assignment.
+*/
+Stmt *makeLocalAssignment(int slot, Expr *iexpr, Expr *expr);
+
+/** 
+  Make a representation of a push statement, which appends one or more
+  values to a sequence.  This new object will take ownership of sexpr,
+  vlist and the expressions in it, and will be responsible for freeing
+  that memory when it is destroyed.
   @param sexpr Expression for the sequence to push to.
-  @param vexpr Expression for the value to push into the sequence.
+  @param len Number of values to push, at least one.
+  @param vlist Expressions for the values to push into the sequence.
   @return A new statement object that can perform the push statement.
 */
-Stmt *makePushStmt(Expr *sexpr, Expr *vexpr);
+Stmt *makePushStmt(Expr *sexpr, int len, Expr **vlist);
+
+/** 
+  Make a representation of an extend statement, which appends every
+  value of one sequence to the end of another.  This new object will
+  take ownership of sexpr and texpr.
+  @param sexpr Expression for the sequence to extend.
+  @param texpr Expression for the sequence whose values are appended.
+  @return A new statement object that can perform the extend statement.
+*/
+Stmt *makeExtendStmt(Expr *sexpr, Expr *texpr);
+
+/** 
+  Make a representation of a def statement, which defines a function
+  when it runs.  The function's parameters are its first local
+  variables.  This new object takes ownership of body.
+  @param name name of the function.
+  @param params number of parameters.
+  @param locals number of local variables, including the parameters.
+  @param body statement to run when the function is called.
+  @return A new statement object that can perform the def statement.
+*/
+Stmt *makeDef(char const *name, int params, int locals, Stmt *body);
+
+/** 
+  Make a representation of a return statement.  If expr is a function
+  call, the call reuses the returning function's frame.
+  @param expr Expression for the value to return, or null to return
+  zero.
+  @return A new statement object that can perform the return statement.
+*/
+Stmt *makeReturn(Expr *expr);
+
+/** 
+  Make a representation of a function call used as a statement.
+  @param call Expression for the function call.
+  @return A new statement object that makes the call and ignores the
+  value it returns.
+*/
+Stmt *makeCallStmt(Expr *call);
+
+/** 
+  Free all defined functions and the stack used for their calls.
+*/
+void freeFunctions();
+
+/** 
+  If the given statement pushes only literal values onto a plain
+  variable, return the variable's name.
+  @param stmt statement to check.
+  @return name of the variable being pushed to, or null.
+*/
+char const *constPushTarget(Stmt *stmt);
+
+/** 
+  Try to merge a statement into the one right before it, so the two
+  run as one.  Right now, a push of literal values is merged into a
+  push to the same variable just before it, making a single bulk push.
+  @param prev statement that runs first.
+  @param next statement that runs right after prev.
+  @return true if next was merged into prev, in which case next has
+  been destroyed.
+*/
+bool mergeStmts(Stmt *prev, Stmt *next);
+
+//////////////////////////////////////////////////////////////////////
+// Flattened form, a position-independent copy of a statement that can
+// be saved to a file and turned back into a statement later.
+
+/** 
+  Resizable array of words holding statements in flattened form.
+  Each node is stored as a code for its type followed by its fields,
+  with its children right after it.
+*/
+typedef struct {
+  /** Words of flattened code. */
+  int *words;
+
+  /** Number of words in use. */
+  int len;
+
+  /** Capacity of the words array. */
+  int cap;
+} FlatCode;
+
+/** 
+  Make a new, empty array for flattened statements.
+  @return pointer to the new, dynamically allocated FlatCode.
+*/
+FlatCode *makeFlatCode();
+
+/** 
+  Free the given FlatCode and the words it contains.
+  @param code FlatCode to free.
+*/
+void freeFlatCode(FlatCode *code);
+
+/** 
+  Append the flattened form of the given statement to code.
+  @param stmt statement to flatten.
+  @param code array to add the flattened statement to.
+  @return true if successful, or false if the statement contains
+  something that doesn't have a flattened form.
+*/
+bool flattenStmt(Stmt *stmt, FlatCode *code);
+
+/** 
+  Rebuild a statement from its flattened form.  Constant data in the
+  flattened code isn't copied, so the words must stay valid for as
+  long as the statement exists.
+  @param pos pointer to the start of the flattened statement.  It's
+  moved past the statement when this function returns.
+  @return a new statement equivalent to the one that was flattened.
+*/
+Stmt *unflattenStmt(int const **pos);
 
 #endif
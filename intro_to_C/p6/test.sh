@@ -91,16 +91,43 @@ checkEmpty() {
   return 0
 }
 
-# Test one execution of the interpreter
+# Test one execution of the interpreter, with any options given after
+# the expected exit status.
 testInterpreter() {
   TESTNO=$1
   ESTATUS=$2
+  OPTIONS=$3
 
-  echo "Test $TESTNO"
+  echo "Test $TESTNO $OPTIONS"
   rm -f output.txt stderr.txt
 
-  echo "   ./interpret prog-$TESTNO.txt > output.txt 2> stderr.txt"
-  ./interpret prog-$TESTNO.txt > output.txt 2> stderr.txt
+  echo "   ./interpret $OPTIONS prog-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./interpret $OPTIONS prog-$TESTNO.txt > output.txt 2> stderr.txt
+  ASTATUS=$?
+
+  if ! checkStatus "$ESTATUS" "$ASTATUS" ||
+     ! checkFile "Stdout output" "expected-$TESTNO.txt" "output.txt" ||
+     ! checkFileOrEmpty "Stderr output" "message-$TESTNO.txt" "stderr.txt"
+  then
+      FAIL=1
+      return 1
+  fi
+
+  echo "Test $TESTNO PASS"
+  return 0
+}
+
+# Test the interpreter in interactive mode, with the program given on
+# standard input.
+testRepl() {
+  TESTNO=$1
+  ESTATUS=$2
+
+  echo "Test $TESTNO --repl"
+  rm -f output.txt stderr.txt
+
+  echo "   ./interpret --repl < prog-$TESTNO.txt > output.txt 2> stderr.txt"
+  ./interpret --repl < prog-$TESTNO.txt > output.txt 2> stderr.txt
   ASTATUS=$?
 
   if ! checkStatus "$ESTATUS" "$ASTATUS" ||
@@ -140,6 +167,17 @@ if [ -x interpret ]; then
     testInterpreter 17 1
     testInterpreter 18 1
     testInterpreter 19 1
+    testInterpreter 20 0
+    testInterpreter 21 0
+    testInterpreter 22 0
+    testInterpreter 23 1
+    testInterpreter 24 1
+    testInterpreter 14 0 --pipeline
+    testInterpreter 24 1 --pipeline
+    testInterpreter 25 0 "--save-env env-25.bin"
+    testInterpreter 26 0 "--load-env env-25.bin"
+    testInterpreter 27 0
+    testRepl 28 0
 else
     fail "Since your program didn't compile, we couldn't test it"
 fi
@@ -7,6 +7,7 @@
 */
 
 #include "value.h"
+#include "memstats.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -15,6 +16,17 @@
 //////////////////////////////////////////////////////////////////////
 // Sequence.
 
+/**
+  Account for a change in the number of bytes used by sequences.
+  @param delta number of bytes added (or removed, if negative).
+*/
+static void countSequenceBytes(long delta)
+{
+  memStats.seqBytes += delta;
+  if (memStats.seqBytes > memStats.seqPeakBytes)
+    memStats.seqPeakBytes = memStats.seqBytes;
+}
+
 Sequence *makeSequence()
 {
   Sequence *seq = (Sequence *)malloc(sizeof(Sequence));
@@ -22,15 +34,75 @@ Sequence *makeSequence()
   seq->count = 0;
   seq->list = malloc(seq->capacity * sizeof(int));
   seq->ref = 1;
+  seq->mapped = false;
+
+  size_t bytes = sizeof(Sequence) + seq->capacity * sizeof(int);
+  memStats.bytesAllocated += bytes;
+  memStats.seqCreated++;
+  memStats.seqLive++;
+  countSequenceBytes(bytes);
   return seq;
 }
 
+Sequence *makeMappedSequence(int count, int *list)
+{
+  // An empty sequence doesn't need anything from the snapshot.
+  if (count == 0)
+    return makeSequence();
+
+  Sequence *seq = (Sequence *)malloc(sizeof(Sequence));
+  seq->capacity = count;
+  seq->count = count;
+  seq->list = list;
+  seq->ref = 1;
+  seq->mapped = true;
+
+  memStats.bytesAllocated += sizeof(Sequence);
+  memStats.seqCreated++;
+  memStats.seqLive++;
+  countSequenceBytes(sizeof(Sequence));
+  return seq;
+}
+
+void makeSequenceWritable(Sequence *seq)
+{
+  if (!seq->mapped)
+    return;
+
+  // Copy the list out of the snapshot, into memory of our own.
+  int *list = (int *) malloc(seq->capacity * sizeof(int));
+  memcpy(list, seq->list, seq->count * sizeof(int));
+  seq->list = list;
+  seq->mapped = false;
+
+  memStats.bytesAllocated += seq->capacity * sizeof(int);
+  countSequenceBytes((long)seq->capacity * sizeof(int));
+}
+
 void freeSequence(Sequence *seq)
 {
-  free(seq->list);
+  memStats.seqLive--;
+  size_t listBytes = seq->mapped ? 0 : seq->capacity * sizeof(int);
+  countSequenceBytes(-(long)(sizeof(Sequence) + listBytes));
+
+  if (!seq->mapped)
+    free(seq->list);
   free(seq);
 }
 
+void reserveSequence(Sequence *seq, int capacity)
+{
+  if (capacity <= seq->capacity)
+    return;
+  makeSequenceWritable(seq);
+
+  seq->list = (int *) realloc(seq->list, capacity * sizeof(int));
+  memStats.bytesAllocated += capacity * sizeof(int);
+  memStats.seqReallocs++;
+  countSequenceBytes((long)(capacity - seq->capacity) * sizeof(int));
+  seq->capacity = capacity;
+}
+
 void grabSequence(Sequence *seq)
 {
   seq->ref += 1;
@@ -47,6 +119,173 @@ void releaseSequence(Sequence *seq)
   }
 }
 
+//////////////////////////////////////////////////////////////////////
+// Value.
+
+void grabValue(Value val)
+{
+  if (val.vtype == SeqType)
+    grabSequence(val.sval);
+  else if (val.vtype == MapType)
+    grabMap(val.mval);
+}
+
+void releaseValue(Value val)
+{
+  if (val.vtype == SeqType)
+    releaseSequence(val.sval);
+  else if (val.vtype == MapType)
+    releaseMap(val.mval);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Map.
+
+/** Number of slots in the table for a new map, a power of two. */
+#define MAP_INIT_SLOTS 8
+
+/** The table grows once it's more than MAP_LOAD_NUM / MAP_LOAD_DEN full. */
+#define MAP_LOAD_NUM 3
+
+/** Denominator for the maximum load factor. */
+#define MAP_LOAD_DEN 4
+
+/**
+  Scramble the bits of a key, so nearby keys land in different slots.
+  @param key key to hash.
+  @return hash of the key.
+*/
+static unsigned hashKey(int key)
+{
+  unsigned h = (unsigned) key * 2654435769u;
+  return h ^ (h >> 16);
+}
+
+/**
+  Find the slot for the given key, either the one holding it or the
+  empty slot where it would go.
+  @param slots table to search.
+  @param capacity number of slots in the table, a power of two.
+  @param key key to look for.
+  @return pointer to the slot.
+*/
+static MapSlot *findSlot(MapSlot *slots, int capacity, int key)
+{
+  unsigned mask = capacity - 1;
+  unsigned pos = hashKey(key) & mask;
+  while (slots[pos].used && slots[pos].key != key)
+    pos = (pos + 1) & mask;
+  return &slots[pos];
+}
+
+/**
+  Allocate a table of empty slots.
+  @param capacity number of slots.
+  @return new, dynamically allocated table.
+*/
+static MapSlot *makeSlots(int capacity)
+{
+  memStats.bytesAllocated += capacity * sizeof(MapSlot);
+  return (MapSlot *) calloc(capacity, sizeof(MapSlot));
+}
+
+Map *makeMap()
+{
+  Map *map = (Map *) malloc(sizeof(Map));
+  map->count = 0;
+  map->capacity = MAP_INIT_SLOTS;
+  map->slots = makeSlots(map->capacity);
+  map->ref = 1;
+
+  memStats.bytesAllocated += sizeof(Map);
+  memStats.mapCreated++;
+  memStats.mapLive++;
+  return map;
+}
+
+void freeMap(Map *map)
+{
+  memStats.mapLive--;
+  for (int i = 0; i < map->capacity; i++)
+    if (map->slots[i].used)
+      releaseValue(map->slots[i].val);
+  free(map->slots);
+  free(map);
+}
+
+Value *mapLookup(Map *map, int key)
+{
+  MapSlot *slot = findSlot(map->slots, map->capacity, key);
+  return slot->used ? &slot->val : NULL;
+}
+
+void mapSet(Map *map, int key, Value val)
+{
+  MapSlot *slot = findSlot(map->slots, map->capacity, key);
+  if (slot->used) {
+    releaseValue(slot->val);
+    slot->val = val;
+    return;
+  }
+
+  // Grow the table first if this key would make it too full.
+  if ((map->count + 1) * MAP_LOAD_DEN > map->capacity * MAP_LOAD_NUM) {
+    int capacity = map->capacity * DOUBLE;
+    MapSlot *slots = makeSlots(capacity);
+    for (int i = 0; i < map->capacity; i++)
+      if (map->slots[i].used)
+        *findSlot(slots, capacity, map->slots[i].key) = map->slots[i];
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = capacity;
+    slot = findSlot(map->slots, map->capacity, key);
+  }
+
+  slot->used = true;
+  slot->key = key;
+  slot->val = val;
+  map->count++;
+}
+
+/**
+  Comparison function for sorting ints with qsort.
+  @param a pointer to the first int.
+  @param b pointer to the second int.
+  @return negative, zero or positive, like strcmp.
+*/
+static int compareInts(void const *a, void const *b)
+{
+  int x = *(int const *)a;
+  int y = *(int const *)b;
+  return (x > y) - (x < y);
+}
+
+Sequence *mapKeys(Map *map)
+{
+  Sequence *seq = makeSequence();
+  reserveSequence(seq, map->count);
+  for (int i = 0; i < map->capacity; i++)
+    if (map->slots[i].used)
+      seq->list[seq->count++] = map->slots[i].key;
+  qsort(seq->list, seq->count, sizeof(int), compareInts);
+  return seq;
+}
+
+void grabMap(Map *map)
+{
+  map->ref += 1;
+}
+
+void releaseMap(Map *map)
+{
+  map->ref -= 1;
+
+  if (map->ref <= 0) {
+    assert(map->ref == 0);
+    freeMap(map);
+  }
+}
+
 //////////////////////////////////////////////////////////////////////
 // Environment.
 
@@ -81,6 +320,9 @@ Environment *makeEnvironment()
   env->capacity = INIT_CAP;
   env->len = 0;
   env->vlist = (VarRec *) malloc(sizeof(VarRec) * env->capacity);
+
+  memStats.bytesAllocated += sizeof(Environment) + sizeof(VarRec) * env->capacity;
+  memStats.envBytes += sizeof(Environment) + sizeof(VarRec) * env->capacity;
   return env;
 }
 
@@ -103,8 +345,11 @@ void setVariable(Environment *env, char const *name, Value value)
 
   if (pos >= env->len) {
     if (env->len >= env->capacity) {
+      memStats.envBytes += sizeof(VarRec) * env->capacity;
       env->capacity *= DOUBLE;
       env->vlist = (VarRec *) realloc(env->vlist, sizeof(VarRec) * env->capacity);
+      memStats.bytesAllocated += sizeof(VarRec) * env->capacity;
+      memStats.envReallocs++;
     }
   }
 
@@ -112,25 +357,37 @@ void setVariable(Environment *env, char const *name, Value value)
   if (pos == env->len) {
     pos = env->len++;
     strcpy( env->vlist[pos ].name, name );
-  } else if ((env->vlist[pos].val.vtype) == SeqType) {
-    releaseSequence(env->vlist[pos].val.sval);
-    releaseSequence(env->vlist[pos].val.sval);
-  }
-  if (value.vtype == SeqType) {
-    grabSequence(value.sval);
+  } else {
+    releaseValue(env->vlist[pos].val);
+    releaseValue(env->vlist[pos].val);
   }
+  grabValue(value);
   env->vlist[pos].val = value;
 
 }
 
+int variableCount(Environment *env)
+{
+  return env->len;
+}
+
+char const *variableName(Environment *env, int i)
+{
+  return env->vlist[i].name;
+}
+
+Value variableValue(Environment *env, int i)
+{
+  return env->vlist[i].val;
+}
+
 void freeEnvironment(Environment *env)
 {
   for (int i = 0; i < env->len; i++) {
-    if (env->vlist[i].val.vtype == SeqType) {
-      releaseSequence(env->vlist[i].val.sval);
-      releaseSequence(env->vlist[i].val.sval);
-    }
+    releaseValue(env->vlist[i].val);
+    releaseValue(env->vlist[i].val);
   }
+  memStats.envBytes -= sizeof(Environment) + sizeof(VarRec) * env->capacity;
   free(env->vlist);
   free(env);
 }
@@ -30,6 +30,9 @@ typedef struct {
   int *list;
   /** Reference count for the sequence. */
   int ref;
+  /** True if list points into a mapped environment snapshot, so it
+      has to be copied before it's changed. */
+  bool mapped;
 } Sequence;
 
 /**
@@ -38,12 +41,38 @@ typedef struct {
 */
 Sequence *makeSequence();
 
+/**
+  Create a sequence whose list is stored somewhere else, in a mapped
+  environment snapshot.  The list is read-only, and it's copied the
+  first time the sequence is changed.
+  @param count number of elements in the list.
+  @param list the elements, which must stay mapped as long as the
+  sequence uses them.
+  @return pointer to the new, dynamically allocated sequence.
+*/
+Sequence *makeMappedSequence(int count, int *list);
+
+/**
+  Make sure the elements of a sequence can be changed, copying them
+  out of a mapped snapshot if that's where they are.
+  @param seq sequence that's about to be changed.
+*/
+void makeSequenceWritable(Sequence *seq);
+
 /**
   Free all the memory used to store the given sequence.
   @param seq sequence to free.
 */
 void freeSequence(Sequence *seq);
 
+/**
+  Make sure the given sequence has room for at least the given number
+  of elements, reallocating its list if necessary.
+  @param seq sequence to enlarge.
+  @param capacity number of elements the list needs to hold.
+*/
+void reserveSequence(Sequence *seq, int capacity);
+
 /**
   Add one to the reference count for the given sequence.
   @param seq sequence in which to increate the reference count.
@@ -61,14 +90,17 @@ void releaseSequence(Sequence *seq);
 // Value Representat
 
 /** Type of value in our langauge */
-typedef enum {IntType, SeqType} ValType;
+typedef enum {IntType, SeqType, MapType} ValType;
 
 /** A short name to use for the Value interface. */
 typedef struct ValueStruct Value;
 
+/** A short name for the map representation, defined below. */
+typedef struct MapStruct Map;
+
 /**
-  Representation of a value in our programming language, either an int
-  or a sequence of ints.
+  Representation of a value in our programming language, either an int,
+  a sequence of ints or a map from ints to values.
 */
 struct ValueStruct {
   ValType vtype;
@@ -79,9 +111,110 @@ struct ValueStruct {
 
     /** If this value is a sequence, this is its value. */
     Sequence *sval;
+
+    /** If this value is a map, this is its value. */
+    Map *mval;
   };
 };
 
+/**
+  Add one to the reference count for the given value, if it's a
+  sequence or a map.  Nothing happens for an int.
+  @param val value to grab.
+*/
+void grabValue(Value val);
+
+/**
+  Subtract one from the reference count for the given value, if it's
+  a sequence or a map, freeing it if the count reaches zero.
+  @param val value to release.
+*/
+void releaseValue(Value val);
+
+//////////////////////////////////////////////////////////////////////
+// Map
+
+/** One slot in the hash table for a map. */
+typedef struct {
+  /** True if there's a key stored in this slot. */
+  bool used;
+
+  /** Key stored in this slot. */
+  int key;
+
+  /** Value stored under this key. */
+  Value val;
+} MapSlot;
+
+/**
+  Representation for a map from int keys to values, another type of
+  value supported by the language.  It's a hash table with open
+  addressing and linear probing.
+*/
+struct MapStruct {
+  /** Number of keys in the map. */
+  int count;
+  /** Number of slots in the table, always a power of two. */
+  int capacity;
+  /** Table of slots for the keys and values. */
+  MapSlot *slots;
+  /** Reference count for the map. */
+  int ref;
+};
+
+/**
+  Create an empty map.
+  @return pointer to the new, dynamically allocated map.
+*/
+Map *makeMap();
+
+/**
+  Free all the memory used to store the given map, releasing the
+  values stored in it.
+  @param map map to free.
+*/
+void freeMap(Map *map);
+
+/**
+  Find the value stored under the given key.
+  @param map map to look in.
+  @param key key to look for.
+  @return pointer to the value in the map, or null if the key isn't
+  there.  The map still owns the value.
+*/
+Value *mapLookup(Map *map, int key);
+
+/**
+  Store a value under the given key, replacing (and releasing) any
+  value that was already there.  The map takes over the caller's
+  reference to val.
+  @param map map to store into.
+  @param key key to store the value under.
+  @param val value to store.
+*/
+void mapSet(Map *map, int key, Value val);
+
+/**
+  Make a sequence containing all the keys of the given map, in
+  increasing order.
+  @param map map to get the keys from.
+  @return new sequence holding the keys.
+*/
+Sequence *mapKeys(Map *map);
+
+/**
+  Add one to the reference count for the given map.
+  @param map map in which to increase the reference count.
+*/
+void grabMap(Map *map);
+
+/**
+  Subtract one from the reference count for the given map.  If the
+  reference count reaches zero, free the memory for the map.
+  @param map map in which to decrease the reference count.
+*/
+void releaseMap(Map *map);
+
 //////////////////////////////////////////////////////////////////////
 // Environment, a mapping from variables names to their value.
 
@@ -122,6 +255,30 @@ Value lookupVariable(Environment *env, char const *name);
 */
 void setVariable(Environment *env, char const *name, Value value);
 
+/**
+  Return the number of variables in the given environment.
+  @param env environment to look at.
+  @return number of variables with values.
+*/
+int variableCount(Environment *env);
+
+/**
+  Return the name of one of the variables in an environment.
+  @param env environment to look at.
+  @param i index of the variable, less than variableCount().
+  @return the variable's name.
+*/
+char const *variableName(Environment *env, int i);
+
+/**
+  Return the value of one of the variables in an environment.  Like
+  lookupVariable(), this doesn't grab a reference.
+  @param env environment to look at.
+  @param i index of the variable, less than variableCount().
+  @return the variable's value.
+*/
+Value variableValue(Environment *env, int i);
+
 /**
   Free all the memory associated with this environment.
   @param env environment to free memory for.